@@ -2,9 +2,13 @@
 #define COMPILERUTILITY_H
 #include <iostream>
 #include <unordered_set>
+#include <algorithm>
+#include <climits>
 #include "ForthDictionary.h"
+#include "quit.h"
 #include "JitGenerator.h"
 #include "StringInterner.h"
+#include "Tokenizer.h"
 
 // Declaration of compileWord function
 void compileWord(const std::string& wordName, const std::string& compileText, const std::string& sourceCode);
@@ -36,8 +40,9 @@ inline void clearR15()
 
 inline void exec(ForthFunction f)
 {
+    f = JitGenerator::runnable(f);
     clearR15();
-    f();
+    runGenerated(f);
 }
 
 inline double parseFloat(const std::string& word) {
@@ -66,96 +71,1001 @@ inline double parseFloat(const std::string& word) {
 }
 
 
-inline int64_t parseNumber(const std::string& word) {
-    if (word.empty()) {
-        throw std::invalid_argument("Empty string is not a valid number");
+// Split source code into words, dropping comments.
+// Each literal string is interned, and replaced by sPtr_ and its index for the
+// immediate words (s" ." ...) that use it at compile time.
+inline std::vector<std::string> splitAndLogWords(const std::string& sourceCode)
+{
+    std::vector<std::string> words;
+    Tokenizer tokens(sourceCode);
+    for (Tokenizer::Token token; tokens.next(token);)
+    {
+        if (token.kind == Tokenizer::Kind::LITERAL)
+        {
+            words.push_back("sPtr_" + std::to_string(StringInterner::getInstance().intern(token.text)));
+        }
+        else
+        {
+            words.emplace_back(token.text);
+        }
     }
 
-    size_t startIndex = 0;
-    bool isNegative = false;
+    if (logging)
+    {
+        printf("Split words: ");
+        for (const auto& word : words)
+        {
+            printf("%s ", word.c_str());
+        }
+        printf("\n");
+    }
 
-    // Check for an optional leading minus sign for decimal numbers
-    if (word[0] == '-') {
-        isNegative = true;
-        startIndex = 1;
+    return words;
+}
+
+// Tokens of a definition
+// The optimization passes below read the words of a definition and write them out again,
+// adding instructions for the compiler: register blocks, known lengths and fused addresses.
+// Each token carries a tag, so an instruction and what it reads are never taken for words
+// of the program, and a word of the program that shares a name with one is never taken
+// for an instruction.
+struct CompileToken
+{
+    std::string text; // empty for an instruction, its name is JitGenerator::tagName
+    TokenTag tag = TokenTag::WORD;
+};
+
+using CompileTokens = std::vector<CompileToken>;
+
+inline CompileTokens splitTokens(const std::string& text)
+{
+    CompileTokens tokens;
+    for (auto& word : split(text)) tokens.push_back({std::move(word), TokenTag::WORD});
+    return tokens;
+}
+
+// the text the compiler reads, the tag of each of its words is added to tags
+inline std::string renderTokens(const CompileTokens& tokens, std::vector<TokenTag>* tags = nullptr)
+{
+    std::string text;
+    for (const auto& token : tokens)
+    {
+        const bool instruction = token.tag != TokenTag::WORD && token.tag != TokenTag::OPERAND;
+        text += instruction ? JitGenerator::tagName(token.tag) : token.text;
+        text += " ";
+        if (tags != nullptr) tags->push_back(token.tag);
+    }
+    return text;
+}
+
+// compile a definition the passes wrote, the instructions in it know themselves by their tags
+inline void compileTokens(const std::string& wordName, const CompileTokens& tokens, const std::string& sourceCode)
+{
+    std::vector<TokenTag> tags;
+    const std::string text = renderTokens(tokens, &tags);
+    const auto* saved = jc.wordTags;
+    jc.wordTags = &tags;
+    try
+    {
+        compileWord(wordName, text, sourceCode);
     }
+    catch (const std::exception&)
+    {
+        jc.wordTags = saved;
+        throw;
+    }
+    jc.wordTags = saved;
+}
+
+inline const std::string& tokenText(const std::string& word)
+{
+    return word;
+}
+
+inline const std::string& tokenText(const CompileToken& token)
+{
+    return token.text;
+}
+
+// copy a locals declaration { ... } starting at words[i], leaving i on the closing }.
+// The names are recorded, as they may shadow dictionary words.
+template <typename Token, typename Emit>
+inline void readLocals(const std::vector<Token>& words, size_t& i,
+                       std::unordered_set<std::string>& localNames, Emit emit)
+{
+    while (i < words.size() && tokenText(words[i]) != "}")
+    {
+        localNames.insert(to_lower(tokenText(words[i])));
+        emit(words[i++]);
+    }
+    if (i < words.size()) emit(words[i]);
+}
+
+
+
+// Constant folding (*FOLD ON)
+// Runs over the tokens of a definition before it is compiled.
+// Literals and constants are kept on a virtual stack; pure words whose inputs are all
+// known are evaluated here, so that `3 4 + 8*` compiles to the single literal 56.
+// Anything else flushes the virtual stack back out as literals, in stack order.
+
+// evaluate a foldable word on the virtual stack, returns false if it can not be folded.
+inline bool foldWord(const ForthFunction gen, std::vector<int64_t>& vs)
+{
+    using G = JitGenerator;
+    const size_t n = vs.size();
+
+    // unary words
+    if (n >= 1)
+    {
+        int64_t& x = vs.back();
+        const auto u = static_cast<uint64_t>(x);
+        if (gen == G::genNegate) { x = static_cast<int64_t>(0 - u); return true; }
+        if (gen == G::genInvert) { x = ~x; return true; }
+        if (gen == G::genAbs) { x = x < 0 ? static_cast<int64_t>(0 - u) : x; return true; }
+        if (gen == G::genZeroEquals) { x = x == 0 ? -1 : 0; return true; }
+        if (gen == G::genZeroLessThan) { x = x < 0 ? -1 : 0; return true; }
+        if (gen == G::genZeroGreaterThan) { x = x > 0 ? -1 : 0; return true; }
+        if (gen == G::gen1Inc) { x = static_cast<int64_t>(u + 1); return true; }
+        if (gen == G::gen2Inc) { x = static_cast<int64_t>(u + 2); return true; }
+        if (gen == G::gen16Inc) { x = static_cast<int64_t>(u + 16); return true; }
+        if (gen == G::gen1Dec) { x = static_cast<int64_t>(u - 1); return true; }
+        if (gen == G::gen2Dec) { x = static_cast<int64_t>(u - 2); return true; }
+        if (gen == G::gen16Dec) { x = static_cast<int64_t>(u - 16); return true; }
+        if (gen == G::gen2mul) { x = static_cast<int64_t>(u << 1); return true; }
+        if (gen == G::gen4mul) { x = static_cast<int64_t>(u << 2); return true; }
+        if (gen == G::gen8mul) { x = static_cast<int64_t>(u << 3); return true; }
+        if (gen == G::gen16mul) { x = static_cast<int64_t>(u << 4); return true; }
+        if (gen == G::genMulBy10) { x = static_cast<int64_t>(u * 10); return true; }
+        // the shifts are logical
+        if (gen == G::gen2Div) { x = static_cast<int64_t>(u >> 1); return true; }
+        if (gen == G::gen4Div) { x = static_cast<int64_t>(u >> 2); return true; }
+        if (gen == G::gen8Div) { x = static_cast<int64_t>(u >> 3); return true; }
+        if (gen == G::genDup) { vs.push_back(x); return true; }
+        if (gen == G::genDrop) { vs.pop_back(); return true; }
+    }
+
+    // binary words, a is second and b is top of stack
+    if (n >= 2)
+    {
+        const int64_t a = vs[n - 2];
+        const int64_t b = vs[n - 1];
+        const auto ua = static_cast<uint64_t>(a);
+        const auto ub = static_cast<uint64_t>(b);
+        int64_t r;
+        if (gen == G::genPlus) r = static_cast<int64_t>(ua + ub);
+        else if (gen == G::genSub) r = static_cast<int64_t>(ua - ub);
+        else if (gen == G::genMul) r = static_cast<int64_t>(ua * ub);
+        else if (gen == G::genAnd) r = a & b;
+        else if (gen == G::genOR) r = a | b;
+        else if (gen == G::genXOR) r = a ^ b;
+        else if (gen == G::genEq) r = a == b ? -1 : 0;
+        else if (gen == G::genLt) r = a < b ? -1 : 0;
+        else if (gen == G::genGt) r = a > b ? -1 : 0;
+        else if (gen == G::genMin) r = a < b ? a : b;
+        else if (gen == G::genMax) r = a > b ? a : b;
+        // division is left to run time for negative operands and zero divisors
+        else if (gen == G::genDiv && a >= 0 && b > 0) r = a / b;
+        else if (gen == G::genMod && a >= 0 && b > 0) r = a % b;
+        else if (gen == G::genSwap) { std::swap(vs[n - 2], vs[n - 1]); return true; }
+        else if (gen == G::genOver) { vs.push_back(a); return true; }
+        else if (gen == G::genNip) { vs.erase(vs.end() - 2); return true; }
+        else if (gen == G::genTuck) { vs.insert(vs.end() - 2, b); return true; }
+        else if (n >= 3 && gen == G::genRot) { std::rotate(vs.end() - 3, vs.end() - 2, vs.end()); return true; }
+        else return false;
+
+        vs.pop_back();
+        vs.back() = r;
+        return true;
+    }
+
+    return false;
+}
+
+// the text the compiler will turn back into the same literal
+inline std::string foldedLiteral(const int64_t value)
+{
+    // the decimal form of the most negative value does not parse back
+    if (value == INT64_MIN) return "0x8000000000000000";
+    return std::to_string(value);
+}
+
+inline CompileTokens foldConstants(const CompileTokens& tokens)
+{
+    if (!jc.optFold) return tokens;
+
+    std::vector<int64_t> vs;
+    std::unordered_set<std::string> localNames;
+    CompileTokens out;
+    int folded = 0;
+
+    auto emit = [&](const CompileToken& token)
+    {
+        out.push_back(token);
+    };
+    auto flush = [&]()
+    {
+        for (const auto value : vs) emit({foldedLiteral(value)});
+        vs.clear();
+    };
+
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        const CompileToken& token = tokens[i];
+        const std::string& word = token.text;
+        const std::string lower = to_lower(word);
+
+        // instructions, and what they read
+        if (token.tag != TokenTag::WORD)
+        {
+            flush();
+            emit(token);
+            continue;
+        }
+
+        // locals declarations, the names may shadow dictionary words
+        if (lower == "{")
+        {
+            flush();
+            readLocals(tokens, i, localNames, emit);
+            continue;
+        }
 
-    // Handle hexadecimal and binary prefixes
-    if (startIndex + 2 < word.length() && word[startIndex] == '0') {
-        if (word[startIndex + 1] == 'x' || word[startIndex + 1] == 'X') {
-            return std::stoull(word.substr(startIndex), nullptr, 16); // Hexadecimal (unsigned)
-        } else if (word[startIndex + 1] == 'b' || word[startIndex + 1] == 'B') {
-            return std::stoull(word.substr(startIndex + 2), nullptr, 2); // Binary (unsigned)
+        // words that read the following token
+        if (readsNextToken(lower))
+        {
+            flush();
+            emit(token);
+            if (i + 1 < tokens.size()) emit(tokens[++i]);
+            continue;
+        }
+
+        if (localNames.contains(lower))
+        {
+            flush();
+            emit(token);
+            continue;
+        }
+
+        const ForthWord* fword = d.findWord(word.c_str());
+        try
+        {
+            if (fword != nullptr && fword->type == ForthWordType::CONSTANT)
+            {
+                // built in constants such as 1 and -1 are named by their value
+                if (fword->generatorFunc != nullptr && is_number(word))
+                {
+                    vs.push_back(parseNumber(word));
+                    continue;
+                }
+                if (fword->generatorFunc == nullptr && std::holds_alternative<uint64_t>(fword->data))
+                {
+                    vs.push_back(static_cast<int64_t>(std::get<uint64_t>(fword->data)));
+                    continue;
+                }
+            }
+            else if (fword == nullptr && !is_float(word) && is_number(word))
+            {
+                vs.push_back(parseNumber(word));
+                continue;
+            }
+        }
+        catch (const std::exception&)
+        {
+            // leave bad numbers for the compiler to report
+        }
+
+        if (fword != nullptr && fword->generatorFunc != nullptr && foldWord(fword->generatorFunc, vs))
+        {
+            folded++;
+            continue;
         }
+
+        flush();
+        emit(token);
     }
+    flush();
 
-    // Default to decimal
-    int64_t number = std::stoll(word.substr(startIndex), nullptr, 10); // Decimal
+    if (logging && folded > 0) std::cout << "; folded " << folded << " words: " << renderTokens(out) << std::endl;
+    return out;
+}
 
-    // Apply the negative sign if necessary
-    if (isNegative) {
-        number = -number;
+// Known lengths
+// A MOVE, FILL or ERASE whose length is a literal, usually after folding, is rewritten
+// so that the copy or fill can be generated in line for that length:
+//   64 MOVE      becomes  [MOVE] 64
+//   64 ERASE     becomes  [ERASE] 64
+//   64 32 FILL   becomes  [FILL] 64 32
+// where [MOVE] is the instruction and the literals are its operands.
+
+// the number of literals a bulk memory word needs to have its length known, 0 for other words
+inline size_t knownLengthLiterals(const ForthWord* fword, TokenTag& rewritten)
+{
+    using G = JitGenerator;
+    if (fword == nullptr) return 0;
+    if (fword->generatorFunc == G::genMove) { rewritten = TokenTag::MOVE; return 1; }
+    if (fword->generatorFunc == G::genErase) { rewritten = TokenTag::ERASE; return 1; }
+    if (fword->generatorFunc == G::genFill) { rewritten = TokenTag::FILL; return 2; }
+    return 0;
+}
+
+inline CompileTokens knownLengths(const CompileTokens& tokens)
+{
+    if (!jc.optFold) return tokens;
+
+    std::unordered_set<std::string> localNames;
+    CompileTokens out;
+    // how many of the tokens at the end of out are literals
+    size_t literals = 0;
+    int rewrites = 0;
+
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        const CompileToken& token = tokens[i];
+        const std::string& word = token.text;
+        const std::string lower = to_lower(word);
+
+        // instructions, and what they read
+        if (token.tag != TokenTag::WORD)
+        {
+            literals = 0;
+            out.push_back(token);
+            continue;
+        }
+
+        if (lower == "{")
+        {
+            literals = 0;
+            readLocals(tokens, i, localNames, [&](const CompileToken& t) { out.push_back(t); });
+            continue;
+        }
+
+        // words that read the following token
+        if (readsNextToken(lower))
+        {
+            literals = 0;
+            out.push_back(token);
+            if (i + 1 < tokens.size()) out.push_back(tokens[++i]);
+            continue;
+        }
+
+        int64_t value = 0;
+        if (!localNames.contains(lower) && JitGenerator::caseLiteral(word, value))
+        {
+            literals++;
+            out.push_back(token);
+            continue;
+        }
+
+        TokenTag rewritten = TokenTag::WORD;
+        const size_t needed = localNames.contains(lower) ? 0 : knownLengthLiterals(d.findWord(word.c_str()), rewritten);
+        if (needed > 0 && literals >= needed)
+        {
+            // the literals are read by the instruction, which takes the place of the word
+            const size_t first = out.size() - needed;
+            for (size_t k = first; k < out.size(); ++k) out[k].tag = TokenTag::OPERAND;
+            out.insert(out.begin() + static_cast<std::ptrdiff_t>(first), CompileToken{"", rewritten});
+            rewrites++;
+        }
+        else
+        {
+            out.push_back(token);
+        }
+        literals = 0;
     }
 
-    return number;
+    if (logging && rewrites > 0) std::cout << "; " << rewrites << " known lengths: " << renderTokens(out) << std::endl;
+    return out;
 }
 
-// also removes comments between ( and )
-inline std::string scanForLiterals(const std::string& compileText)
+// Address fusion
+// An address calculation just before a memory access becomes the addressing mode of the access:
+//   addr 16 + @          becomes  addr [DISP] 16 @
+//   addr i CELLS + @     becomes  addr i [INDEX] 8 @
+//   addr i + C@          becomes  addr i [INDEX] 1 C@
+// where [DISP] and [INDEX] are instructions, and the number and the access word their operands.
+// See JitGenerator::memoryAccess for the words this applies to.
+
+inline CompileTokens fuseAddresses(const CompileTokens& tokens)
 {
-    // Regex to match literals (s" ..." or .")
-    std::regex literalRegex(R"((\w*")\s(.*?[^\\])\")");
-    // Regex to match ( ... ) comments
-    std::regex commentRegex(R"(\(.*?\))");
+    if (!jc.optFold) return tokens;
 
-    std::string result;
-    std::smatch match;
-    std::string tmpText = compileText;
-    StringInterner& interner = StringInterner::getInstance();
+    using G = JitGenerator;
+    std::unordered_set<std::string> localNames;
+    CompileTokens out;
+    // the last token in out is a literal the code will push, or was read by the token before it
+    bool literal = false;
+    bool read = false;
+    int fused = 0;
+
+    auto generatorOf = [&](const CompileToken& token) -> ForthFunction
+    {
+        if (token.tag != TokenTag::WORD || localNames.contains(to_lower(token.text))) return nullptr;
+        const ForthWord* fword = d.findWord(token.text.c_str());
+        return fword == nullptr ? nullptr : fword->generatorFunc;
+    };
+
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        const CompileToken& token = tokens[i];
+        const std::string& word = token.text;
+        const std::string lower = to_lower(word);
+
+        // instructions, and what they read
+        if (token.tag != TokenTag::WORD)
+        {
+            literal = false;
+            read = true;
+            out.push_back(token);
+            continue;
+        }
+
+        if (lower == "{")
+        {
+            literal = false;
+            read = true;
+            readLocals(tokens, i, localNames, [&](const CompileToken& t) { out.push_back(t); });
+            continue;
+        }
+
+        // words that read the following token
+        if (readsNextToken(lower))
+        {
+            literal = false;
+            read = true;
+            out.push_back(token);
+            if (i + 1 < tokens.size()) out.push_back(tokens[++i]);
+            continue;
+        }
+
+        G::MemoryAccess access{};
+        if (generatorOf(token) == G::genPlus && i + 1 < tokens.size() &&
+            G::memoryAccess(generatorOf(tokens[i + 1]), access))
+        {
+            int64_t disp = 0;
+            if (literal && G::caseLiteral(out.back().text, disp) && disp >= INT32_MIN && disp <= INT32_MAX)
+            {
+                out.back() = {"", TokenTag::DISP};
+                out.push_back({std::to_string(disp), TokenTag::OPERAND});
+            }
+            else
+            {
+                uint32_t scale = out.empty() || read ? 0 : G::indexScale(generatorOf(out.back()));
+                if (scale != 0) out.pop_back();
+                else scale = 1;
+                out.push_back({"", TokenTag::INDEX});
+                out.push_back({std::to_string(scale), TokenTag::OPERAND});
+            }
+            out.push_back({tokens[++i].text, TokenTag::OPERAND});
+            literal = false;
+            read = true;
+            fused++;
+            continue;
+        }
+
+        int64_t value = 0;
+        literal = !localNames.contains(lower) && G::caseLiteral(word, value);
+        read = false;
+        out.push_back(token);
+    }
+
+    if (logging && fused > 0) std::cout << "; " << fused << " fused addresses: " << renderTokens(out) << std::endl;
+    return out;
+}
+
+// Inlining (*INLINE ON)
+// The tokens of each colon definition are kept in the dictionary.  When a later
+// definition uses a small word, its tokens are replayed in place of the call.
+// A word is inlined if it is marked INLINE, or if it is not marked NOINLINE and has
+// at most jc.inlineMaxTokens tokens.
+
+// words a body may not contain if it is to be replayed inside another word
+inline bool blocksInlining(const std::string& lower)
+{
+    return lower == "recurse" || lower == "exit" || lower == "{" || lower == "}";
+}
 
-    // Remove comments from the input text
-    tmpText = std::regex_replace(tmpText, commentRegex, "");
+// remember the body of the word just compiled
+inline void recordInlineBody(const std::string& wordName, const std::string& compileText)
+{
+    const ForthWord* latest = d.getLatestWord();
+    if (latest == nullptr || to_lower(wordName) != latest->name) return;
 
-    // Process literals
-    while (std::regex_search(tmpText, match, literalRegex))
+    InlineBody body;
+    body.tokens = split(compileText);
+    for (const auto& token : body.tokens)
     {
-        std::string literalStart = match[1].str(); // s" or ."
-        std::string literalString = match[2].str(); // The literal content after the first space
+        body.bindings.push_back(d.findWord(token.c_str()));
+        if (blocksInlining(to_lower(token))) body.inlinable = false;
+    }
+    d.setInlineBody(std::move(body));
+}
 
-        // Intern the literal string content
-        auto internedPtr = interner.intern(literalString);
-        std::ostringstream replacementWord;
-        replacementWord << "sPtr_" << reinterpret_cast<std::uintptr_t>(internedPtr);
+// the body of word if it should be inlined here, otherwise nullptr
+inline const InlineBody* inlineBodyFor(const ForthWord* word, const std::unordered_set<std::string>& localNames)
+{
+    if (word == nullptr || word->type != ForthWordType::WORD || word->state != ForthWordState::NORMAL) return nullptr;
+    if (word->inlineMode == INLINE_NEVER) return nullptr;
 
-        result += match.prefix().str();
-        result += literalStart + " " + replacementWord.str() + " ";
+    const InlineBody* body = d.getInlineBody(word);
+    if (body == nullptr || !body->inlinable) return nullptr;
+    if (word->inlineMode != INLINE_ALWAYS && body->tokens.size() > jc.inlineMaxTokens) return nullptr;
 
-        tmpText = match.suffix().str();
+    // the tokens must still mean what they meant when the word was defined
+    for (size_t i = 0; i < body->tokens.size(); ++i)
+    {
+        if (localNames.contains(to_lower(body->tokens[i]))) return nullptr;
+        if (d.findWord(body->tokens[i].c_str()) != body->bindings[i]) return nullptr;
     }
-    result += tmpText;
+    return body;
+}
+
+inline std::string inlineWords(const std::string& compileText)
+{
+    if (!jc.optInline) return compileText;
+
+    const std::vector<std::string> words = split(compileText);
+    std::unordered_set<std::string> localNames;
+    std::string result;
+    int inlined = 0;
 
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        const std::string& word = words[i];
+        const std::string lower = to_lower(word);
+
+        if (lower == "{")
+        {
+            readLocals(words, i, localNames, [&](const std::string& w) { result += w + " "; });
+            continue;
+        }
+
+        // words that read the following token
+        if (readsNextToken(lower))
+        {
+            result += word + " ";
+            if (i + 1 < words.size()) result += words[++i] + " ";
+            continue;
+        }
+
+        // bodies were recorded after their own calls were inlined, so one level is enough
+        const InlineBody* body = localNames.contains(lower) ? nullptr : inlineBodyFor(d.findWord(word.c_str()), localNames);
+        if (body == nullptr)
+        {
+            result += word + " ";
+            continue;
+        }
+        for (const auto& token : body->tokens) result += token + " ";
+        inlined++;
+    }
+
+    if (logging && inlined > 0) std::cout << "; inlined " << inlined << " words: " << result << std::endl;
     return result;
 }
 
-inline std::vector<std::string> splitAndLogWords(const std::string& sourceCode)
+// Stack effects
+// The primitives are given their ( in -- out ) in main.cpp.  The effect of a colon
+// definition is inferred from its tokens when it is compiled, so that words built on
+// it, and the register blocks that call it, know how many cells it takes and leaves.
+
+// the effect of a single token, false if it is not known
+inline bool tokenStackEffect(const std::string& word, int& in, int& out)
+{
+    const ForthWord* fword = d.findWord(word.c_str());
+    if (fword != nullptr && fword->stackIn >= 0)
+    {
+        in = fword->stackIn;
+        out = fword->stackOut;
+        return true;
+    }
+    if (fword != nullptr && (fword->type & (CONSTANT | VARIABLE | VALUE | FLOAT | FLOATARRAY)) != 0)
+    {
+        in = 0;
+        out = 1;
+        return true;
+    }
+    if (fword == nullptr && (is_float(word) || is_number(word)))
+    {
+        in = 0;
+        out = 1;
+        return true;
+    }
+    return false;
+}
+
+// infer the stack effect of a definition, false if it can not be worked out,
+// for example for words with locals, EXIT, or branches that leave different depths
+inline bool inferStackEffect(const std::string& compileText, int& in, int& out)
 {
-    std::string newCompileText = scanForLiterals(sourceCode);
-    const std::vector<std::string> words = split(newCompileText);
+    const std::vector<std::string> words = split(compileText);
+    int height = 0; // cells above the stack the word was called with
+    int need = 0; // cells taken from below it
 
-    if (logging)
+    auto apply = [&](const int takes, const int leaves)
     {
-        printf("Split words: ");
-        for (const auto& word : words)
+        need = std::max(need, takes - height);
+        height += leaves - takes;
+    };
+
+    // the depth at IF, ELSE, BEGIN, WHILE and DO
+    struct Mark
+    {
+        std::string word;
+        int height;
+    };
+    std::vector<Mark> marks;
+
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        const std::string lower = to_lower(words[i]);
+
+        if (lower == "if")
         {
-            printf("%s ", word.c_str());
+            apply(1, 0);
+            marks.push_back({lower, height});
+        }
+        else if (lower == "else")
+        {
+            if (marks.empty() || marks.back().word != "if") return false;
+            const int ifHeight = marks.back().height;
+            marks.back() = {lower, height};
+            height = ifHeight;
+        }
+        else if (lower == "then")
+        {
+            if (marks.empty() || (marks.back().word != "if" && marks.back().word != "else")) return false;
+            if (marks.back().height != height) return false;
+            marks.pop_back();
+        }
+        else if (lower == "begin")
+        {
+            marks.push_back({lower, height});
+        }
+        else if (lower == "until")
+        {
+            apply(1, 0);
+            if (marks.empty() || marks.back().word != "begin" || marks.back().height != height) return false;
+            marks.pop_back();
+        }
+        else if (lower == "while")
+        {
+            apply(1, 0);
+            if (marks.empty() || marks.back().word != "begin") return false;
+            marks.push_back({lower, height});
+        }
+        else if (lower == "repeat")
+        {
+            if (marks.size() < 2 || marks.back().word != "while") return false;
+            const int exitHeight = marks.back().height;
+            marks.pop_back();
+            if (marks.back().word != "begin" || marks.back().height != height) return false;
+            marks.pop_back();
+            height = exitHeight;
+        }
+        else if (lower == "do")
+        {
+            apply(2, 0);
+            marks.push_back({lower, height});
+        }
+        else if (lower == "loop" || lower == "+loop")
+        {
+            if (lower == "+loop") apply(1, 0);
+            if (marks.empty() || marks.back().word != "do" || marks.back().height != height) return false;
+            marks.pop_back();
+        }
+        else if (readsNextToken(lower))
+        {
+            if (lower == "char" || lower == "strfieldoffsets") apply(0, 1);
+            // a string value is set from the string stack, any other value from the data stack
+            if (lower == "to")
+            {
+                const ForthWord* target = i + 1 < words.size() ? d.findWord(words[i + 1].c_str()) : nullptr;
+                if (target == nullptr || target->type != ForthWordType::STRING) apply(1, 0);
+            }
+            ++i;
+        }
+        else
+        {
+            int takes = 0;
+            int leaves = 0;
+            if (!tokenStackEffect(words[i], takes, leaves)) return false;
+            apply(takes, leaves);
         }
-        printf("\n");
     }
+    if (!marks.empty()) return false;
 
-    return words;
+    in = need;
+    out = need + height;
+    return true;
+}
+
+// record the effect of the word just compiled
+inline void recordStackEffect(const std::string& wordName, const std::string& compileText)
+{
+    const ForthWord* latest = d.getLatestWord();
+    if (latest == nullptr || to_lower(wordName) != latest->name) return;
+
+    int in = 0;
+    int out = 0;
+    if (inferStackEffect(compileText, in, out) && in <= INT8_MAX && out <= INT8_MAX)
+    {
+        d.setStackEffect(in, out);
+    }
+}
+
+// Register allocation (*REGALLOC ON, *FPREGS ON)
+// Runs of two or more literals and simple stack words are marked with the REGBLOCK
+// instruction, which keeps the items in registers across the run, or with FPBLOCK when
+// the run does floating point arithmetic, see JitGenerator::genBlock.  A call to a
+// colon definition whose stack effect is known does not end the run.
+
+enum class BlockToken
+{
+    NONE, // ends a run
+    SHUFFLE, // goes in either kind of run
+    CALL, // so does a call, but it does not count towards the length of the run
+    INTEGER,
+    FLOAT
+};
+
+inline BlockToken blockToken(const std::string& word, const std::unordered_set<std::string>& localNames)
+{
+    using G = JitGenerator;
+    if (localNames.contains(to_lower(word))) return BlockToken::NONE;
+    const ForthWord* fword = d.findWord(word.c_str());
+    int64_t value = 0;
+    if (G::caseLiteral(word, value)) return jc.optRegAlloc ? BlockToken::INTEGER : BlockToken::NONE;
+    if (fword == nullptr && is_float(word)) return jc.optFloatRegs ? BlockToken::FLOAT : BlockToken::NONE;
+    if (fword == nullptr) return BlockToken::NONE;
+
+    if (G::blockCallWord(fword)) return BlockToken::CALL;
+    const ForthFunction gen = fword->generatorFunc;
+    if (G::shuffleWord(gen)) return BlockToken::SHUFFLE;
+    if (jc.optRegAlloc && G::intBlockWord(gen)) return BlockToken::INTEGER;
+    if (jc.optFloatRegs && G::floatBlockWord(gen)) return BlockToken::FLOAT;
+    return BlockToken::NONE;
+}
+
+inline CompileTokens allocateRegisters(const CompileTokens& tokens)
+{
+    if (!jc.optRegAlloc && !jc.optFloatRegs) return tokens;
+
+    std::unordered_set<std::string> localNames;
+    std::vector<std::string> run;
+    std::vector<bool> calls; // which words of the run are calls
+    BlockToken runKind = BlockToken::SHUFFLE;
+    CompileTokens out;
+    int blocks = 0;
+
+    auto emit = [&](const CompileToken& token)
+    {
+        out.push_back(token);
+    };
+    auto flush = [&]()
+    {
+        // calls at either end of a run save nothing in it, and the last may be a tail call
+        size_t first = 0;
+        size_t last = run.size();
+        while (first < last && calls[first]) ++first;
+        while (last > first && calls[last - 1]) --last;
+        const auto words = static_cast<size_t>(std::count(calls.begin() + static_cast<std::ptrdiff_t>(first),
+                                                          calls.begin() + static_cast<std::ptrdiff_t>(last), false));
+
+        for (size_t k = 0; k < first; ++k) emit({run[k]});
+        if (words >= 2)
+        {
+            // a run of shuffles alone moves cells the same way in either kind of block
+            emit({"", runKind == BlockToken::FLOAT ? TokenTag::FPBLOCK : TokenTag::REGBLOCK});
+            emit({std::to_string(last - first), TokenTag::OPERAND});
+            blocks++;
+        }
+        for (size_t k = first; k < run.size(); ++k) emit({run[k]});
+        run.clear();
+        calls.clear();
+        runKind = BlockToken::SHUFFLE;
+    };
+
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        const CompileToken& token = tokens[i];
+        const std::string& word = token.text;
+        const std::string lower = to_lower(word);
+
+        // instructions, and what they read
+        if (token.tag != TokenTag::WORD)
+        {
+            flush();
+            emit(token);
+            continue;
+        }
+
+        if (lower == "{")
+        {
+            flush();
+            readLocals(tokens, i, localNames, emit);
+            continue;
+        }
+
+        // words that read the following token
+        if (readsNextToken(lower))
+        {
+            flush();
+            emit(token);
+            if (i + 1 < tokens.size()) emit(tokens[++i]);
+            continue;
+        }
+
+        const BlockToken kind = blockToken(word, localNames);
+        if (kind != BlockToken::NONE)
+        {
+            // integer and floating point words go in separate blocks
+            const bool typed = kind == BlockToken::INTEGER || kind == BlockToken::FLOAT;
+            if (typed && runKind != BlockToken::SHUFFLE && kind != runKind) flush();
+            if (typed) runKind = kind;
+            run.push_back(word);
+            calls.push_back(kind == BlockToken::CALL);
+            continue;
+        }
+
+        // the literal before OF is the selector of a CASE arm, and has to stay where CASE looks for it
+        if (lower == "of" && !run.empty())
+        {
+            const std::string selector = run.back();
+            run.pop_back();
+            calls.pop_back();
+            flush();
+            emit({selector});
+        }
+        flush();
+        emit(token);
+    }
+    flush();
+
+    if (logging && blocks > 0) std::cout << "; " << blocks << " register blocks: " << renderTokens(out) << std::endl;
+    return out;
+}
+
+// the passes that run after inlining, over the words of a definition
+inline CompileTokens optimizeTokens(const std::string& compileText)
+{
+    return allocateRegisters(fuseAddresses(knownLengths(foldConstants(splitTokens(compileText)))));
+}
+
+// Tiered compilation (*TIERED ON)
+// A word is first compiled without TOS caching, inlining, constant folding, register loops or
+// register allocation of either kind, and counts its calls and loop back edges.  When the count runs out it is
+// compiled again from its tokens with those optimizations, see JitGenerator::tierUp.
+
+struct TierOptions
+{
+    bool tosCache;
+    bool inlining;
+    bool fold;
+    bool registerLoops;
+    bool regAlloc;
+    bool floatRegs;
+};
+
+// switch the optimizations of the top tier on or off, returns the options as they were
+inline TierOptions setTierOptions(const bool optimize)
+{
+    const TierOptions saved{
+        jc.optTosCache, jc.optInline, jc.optFold, jc.optRegisterLoops, jc.optRegAlloc, jc.optFloatRegs
+    };
+    jc.optTosCache = jc.optInline = jc.optFold = jc.optRegisterLoops = jc.optRegAlloc = jc.optFloatRegs = optimize;
+    return saved;
+}
+
+inline void restoreTierOptions(const TierOptions& saved)
+{
+    jc.optTosCache = saved.tosCache;
+    jc.optInline = saved.inlining;
+    jc.optFold = saved.fold;
+    jc.optRegisterLoops = saved.registerLoops;
+    jc.optRegAlloc = saved.regAlloc;
+    jc.optFloatRegs = saved.floatRegs;
+}
+
+inline ForthFunction compileHotWord(ForthWord* word);
+
+// Lazy compilation (*LAZY ON)
+// While a file is loaded, ';' only keeps the tokens of the definition, as its inline body,
+// and gives the word a stub (JitGenerator::genLazyStub).  The word is compiled from the
+// tokens the first time it is called, so words a program never uses are never compiled.
+
+// compile a word again from its tokens, as a new definition whose code then replaces that of word
+inline void recompileWord(ForthWord* word, const bool counted)
+{
+    const InlineBody* body = d.getInlineBody(word);
+    if (body == nullptr)
+    {
+        throw std::runtime_error("No tokens kept for word: " + std::string(word->name));
+    }
+    std::string compileText;
+    for (const auto& token : body->tokens) compileText += token + " ";
+    const std::string sourceCode = d.getSourceCode(word);
+    if (logging) std::cout << "; compiling " << word->name << " from its tokens" << std::endl;
+
+    // the tokens must mean what they meant when the word was defined
+    const auto hidden = d.hideWordsAfter(word);
+    const ForthWord* latest = d.getLatestWord();
+    const bool batchMode = jc.batchMode;
+    const bool arenaOption = jc.optArena;
+    const auto* words = jc.words;
+    const size_t posNextWord = jc.pos_next_word;
+    const size_t posLastWord = jc.pos_last_word;
+    auto restore = [&]()
+    {
+        jc.batchMode = batchMode;
+        jc.optArena = arenaOption;
+        jc.words = words;
+        jc.pos_next_word = posNextWord;
+        jc.pos_last_word = posLastWord;
+        d.showWords(hidden);
+    };
+
+    // the word is compiled on its own, into the arena where its callers can be patched
+    jc.batchMode = false;
+    jc.optArena = true;
+    if (counted) JitGenerator::beginTierCounting(compileHotWord);
+    try
+    {
+        compileTokens(word->name, optimizeTokens(inlineWords(compileText)), sourceCode);
+        if (d.getLatestWord() == latest)
+        {
+            throw std::runtime_error("Word did not compile: " + std::string(word->name));
+        }
+        d.adoptLatestWord(word);
+    }
+    catch (const std::exception&)
+    {
+        JitGenerator::endTierCounting(nullptr);
+        restore();
+        throw;
+    }
+    JitGenerator::endTierCounting(word);
+    restore();
 }
 
+// compile a word at the baseline or the top tier
+inline ForthFunction compileAtTier(ForthWord* word, const bool optimize)
+{
+    const TierOptions saved = setTierOptions(optimize);
+    try
+    {
+        recompileWord(word, !optimize);
+    }
+    catch (const std::exception&)
+    {
+        restoreTierOptions(saved);
+        throw;
+    }
+    restoreTierOptions(saved);
+    return word->compiledFunc;
+}
+
+// called once a tiered word is hot
+inline ForthFunction compileHotWord(ForthWord* word)
+{
+    return compileAtTier(word, true);
+}
+
+// the first call to a lazy word, the stub passes the result on to the callers
+inline ForthFunction compileLazyBody(ForthWord* word)
+{
+    if (jc.optTiered)
+    {
+        return compileAtTier(word, false);
+    }
+    recompileWord(word, false);
+    return word->compiledFunc;
+}
 
+inline void defineLazyWord(const std::string& wordName, const std::string& sourceCode)
+{
+    d.addWord(wordName.c_str(), nullptr, nullptr, nullptr, nullptr, sourceCode);
+    d.setCompiledFunction(JitGenerator::genLazyStub(d.getLatestWord(), compileLazyBody));
+}
 
 // Function to handle compile mode (defining new words)
 inline void handleCompileMode(size_t& i, const std::vector<std::string>& words, const std::string& sourceCode)
@@ -191,7 +1101,34 @@ inline void handleCompileMode(size_t& i, const std::vector<std::string>& words,
     }
 
 
-    compileWord(wordName, compileText, sourceCode);
+    // tiered words start at the baseline
+    const bool tiered = jc.optTiered;
+    TierOptions saved{};
+    if (tiered) saved = setTierOptions(false);
+    try
+    {
+        const std::string expandedText = inlineWords(compileText);
+        if (jc.lazyMode)
+        {
+            defineLazyWord(wordName, sourceCode);
+        }
+        else
+        {
+            if (tiered) JitGenerator::beginTierCounting(compileHotWord);
+            compileTokens(wordName, optimizeTokens(expandedText), sourceCode);
+            const ForthWord* latest = d.getLatestWord();
+            JitGenerator::endTierCounting(latest != nullptr && to_lower(wordName) == latest->name ? latest : nullptr);
+        }
+        recordInlineBody(wordName, expandedText);
+        recordStackEffect(wordName, expandedText);
+    }
+    catch (const std::exception&)
+    {
+        JitGenerator::endTierCounting(nullptr);
+        if (tiered) restoreTierOptions(saved);
+        throw;
+    }
+    if (tiered) restoreTierOptions(saved);
 
     ++i;
 }
@@ -206,6 +1143,8 @@ inline void interpreterProcessWord(const std::string& word, size_t& i, const std
         if (fword->compiledFunc)
         {
             if (logging) printf("Calling word: %s\n", word.c_str());
+            // words compiled in a batch only have their real address once it is flushed
+            JitGenerator::flushBatch();
             exec(fword->compiledFunc);
         }
         else if (fword->terpFunc)
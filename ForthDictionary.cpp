@@ -18,10 +18,46 @@ ForthDictionary& ForthDictionary::getInstance(size_t size)
 }
 
 // Private constructor to prevent instantiation
-ForthDictionary::ForthDictionary(size_t size) : memory(size), currentPos(0), latestWord(nullptr)
+ForthDictionary::ForthDictionary(size_t size) : memory(size), currentPos(0), latestWord(nullptr),
+                                                 hashBuckets(HASH_BUCKETS, nullptr)
 {
 }
 
+// FNV-1a over the lower case name, no allocation
+size_t ForthDictionary::hashName(const char* name)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char* p = name; *p != '\0'; ++p)
+    {
+        hash ^= static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(*p)));
+        hash *= 1099511628211ULL;
+    }
+    return hash & (HASH_BUCKETS - 1);
+}
+
+// Link a word in at the head of its bucket
+void ForthDictionary::linkHash(ForthWord* word)
+{
+    auto& head = hashBuckets[hashName(word->name)];
+    word->hashLink = head;
+    head = word;
+}
+
+// Unlink a word from its bucket
+void ForthDictionary::unlinkHash(const ForthWord* word)
+{
+    ForthWord** entry = &hashBuckets[hashName(word->name)];
+    while (*entry != nullptr)
+    {
+        if (*entry == word)
+        {
+            *entry = word->hashLink;
+            return;
+        }
+        entry = &(*entry)->hashLink;
+    }
+}
+
 // Add a new word to the dictionary
 void ForthDictionary::addWord(const char* name,
                               ForthFunction generatorFunc,
@@ -47,6 +83,7 @@ void ForthDictionary::addWord(const char* name,
 
     // Correctly set the latest word to the new word
     latestWord = newWord;
+    linkHash(newWord);
 
     // Store the source code in the map
     sourceCodeMap[lower_name] = sourceCode;
@@ -98,17 +135,25 @@ void ForthDictionary::addInterpretOnlyImmediate(const char* name,
 
 
 // Find a word in the dictionary
+// names are stored in lower case, so compare the query a character at a time
+// rather than building a lower case copy of it.
 ForthWord* ForthDictionary::findWord(const char* name) const
 {
-    std::string lower_name = to_lower(name);
-    ForthWord* word = latestWord;
+    ForthWord* word = hashBuckets[hashName(name)];
     while (word != nullptr)
     {
-        if (std::strcmp(word->name, lower_name.c_str()) == 0)
+        const char* p = name;
+        const char* q = word->name;
+        while (*q != '\0' && std::tolower(static_cast<unsigned char>(*p)) == *q)
+        {
+            ++p;
+            ++q;
+        }
+        if (*p == '\0' && *q == '\0')
         {
             return word;
         }
-        word = word->link;
+        word = word->hashLink;
     }
     return nullptr;
 }
@@ -168,6 +213,10 @@ void ForthDictionary::forgetLastWord()
     // Remove source code entry
     sourceCodeMap.erase(latestWord->name);
 
+    // Remove it from the hash index, older words of the same name become visible again
+    unlinkHash(latestWord);
+    inlineBodies.erase(latestWord);
+
     // Size of the word (this depends on your actual implementation details. Adjust as needed).
     size_t wordSize = sizeof(ForthWord) + 16; // include the extra allotted space
     currentPos -= wordSize;
@@ -244,8 +293,11 @@ ForthWordState ForthDictionary::getState() const
 
 void ForthDictionary::setName(std::string name)
 {
+    // the bucket depends on the name
+    unlinkHash(latestWord);
     std::strncpy(latestWord->name, name.c_str(), sizeof(latestWord->name));
     latestWord->name[sizeof(latestWord->name) - 1] = '\0'; // Ensure null-termination
+    linkHash(latestWord);
 }
 
 void ForthDictionary::setData(uint64_t d)
@@ -281,6 +333,95 @@ void* ForthDictionary::getDataAsPointer() const
 }
 
 
+// inlining support
+void ForthDictionary::setInlineMode(const ForthInlineMode mode) const
+{
+    if (latestWord == nullptr)
+    {
+        throw std::runtime_error("No latest word available to set inline mode");
+    }
+    latestWord->inlineMode = mode;
+}
+
+// ( in -- out ) of the latest word
+void ForthDictionary::setStackEffect(const int in, const int out) const
+{
+    if (latestWord == nullptr)
+    {
+        throw std::runtime_error("No latest word available to set stack effect");
+    }
+    latestWord->stackIn = static_cast<int8_t>(in);
+    latestWord->stackOut = static_cast<int8_t>(out);
+}
+
+void ForthDictionary::setInlineBody(InlineBody body)
+{
+    if (latestWord == nullptr)
+    {
+        throw std::runtime_error("No latest word available to set inline body");
+    }
+    inlineBodies[latestWord] = std::move(body);
+}
+
+const InlineBody* ForthDictionary::getInlineBody(const ForthWord* word) const
+{
+    const auto it = inlineBodies.find(word);
+    return it == inlineBodies.end() ? nullptr : &it->second;
+}
+
+std::string ForthDictionary::getSourceCode(const ForthWord* word) const
+{
+    const auto it = sourceCodeMap.find(word->name);
+    return it == sourceCodeMap.end() ? "" : it->second;
+}
+
+// Take the words defined after word out of the hash index, newest first
+std::vector<ForthWord*> ForthDictionary::hideWordsAfter(const ForthWord* word)
+{
+    std::vector<ForthWord*> hidden;
+    for (ForthWord* newer = latestWord; newer != nullptr && newer != word; newer = newer->link)
+    {
+        unlinkHash(newer);
+        hidden.push_back(newer);
+    }
+    return hidden;
+}
+
+// Put hidden words back, oldest first, so each bucket ends up in its original order
+void ForthDictionary::showWords(const std::vector<ForthWord*>& words)
+{
+    for (auto it = words.rbegin(); it != words.rend(); ++it)
+    {
+        linkHash(*it);
+    }
+}
+
+// Give word the code of the latest word, a fresh compile of it, and drop the latest word
+void ForthDictionary::adoptLatestWord(ForthWord* word)
+{
+    ForthWord* latest = latestWord;
+    if (latest == nullptr || latest == word)
+    {
+        throw std::runtime_error("No compiled word to adopt");
+    }
+
+    word->compiledFunc = latest->compiledFunc;
+    word->generatorFunc = latest->generatorFunc;
+    word->immediateFunc = latest->immediateFunc;
+    word->terpFunc = latest->terpFunc;
+    word->type = latest->type;
+    word->data = latest->data;
+    word->stackIn = latest->stackIn;
+    word->stackOut = latest->stackOut;
+
+    // the source code entry is shared, both words have the same name
+    unlinkHash(latest);
+    inlineBodies.erase(latest);
+    currentPos = reinterpret_cast<char*>(latest) - memory.data();
+    latestWord = latest->link;
+}
+
+
 // get and set type
 ForthWordType ForthDictionary::getType() const
 {
@@ -373,6 +514,11 @@ void ForthDictionary::displayWord(std::string name)
     std::cout << "Interp    : " << std::hex << reinterpret_cast<uintptr_t>(word->terpFunc) << std::endl;
     std::cout << "State: " << ForthWordStateToString(word->state) << std::endl;
     std::cout << "Type: " << ForthWordTypeToString(word->type) << std::endl;
+    if (word->stackIn >= 0)
+    {
+        std::cout << "Stack effect: ( " << std::dec << static_cast<int>(word->stackIn) << " -- "
+            << static_cast<int>(word->stackOut) << " )" << std::endl;
+    }
     if (std::holds_alternative<uint64_t>(word->data)) {
         std::cout << "Data contains uint64_t: " << std::get<uint64_t>(word->data) << std::endl;
     } else if (std::holds_alternative<double>(word->data)) {
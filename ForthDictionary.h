@@ -58,6 +58,14 @@ enum ForthWordState
     INTERPRET_ONLY_IMMEDIATE = INTERPRET_ONLY | IMMEDIATE,
 };
 
+// Inlining pragma of a colon definition, set by INLINE and NOINLINE
+enum ForthInlineMode : uint8_t
+{
+    INLINE_AUTO = 0, // inline if the body is small
+    INLINE_ALWAYS = 1,
+    INLINE_NEVER = 2
+};
+
 // Convert ForthWordState to a string for debugging
 inline std::string ForthWordStateToString(const ForthWordState state)
 {
@@ -176,8 +184,11 @@ struct ForthWord
     ForthFunction immediateFunc; // Immediate function pointer
     ForthFunction terpFunc; // Function pointer for the interpreter
     ForthWord* link; // Pointer to the previous word in the dictionary
+    ForthWord* hashLink; // Pointer to the previous word in the same hash bucket
     ForthWordState state; // State of the word
-    uint8_t reserved; // Reserved for future use
+    uint8_t inlineMode; // ForthInlineMode
+    int8_t stackIn; // cells the word takes from the data stack, -1 if not known
+    int8_t stackOut; // cells it leaves there, -1 if not known
     ForthWordType type; // Type of the word
     DataVariant data; // Holds uint64_t, double or void*
 
@@ -190,7 +201,8 @@ struct ForthWord
               ForthWord* prev = nullptr)
         : generatorFunc(genny), compiledFunc(func),
           immediateFunc(immFunc), terpFunc(terpFunc),
-          link(prev), state(ForthWordState::NORMAL), data(uint64_t(0)) // Default initialize to uint64_t(0)
+          link(prev), hashLink(nullptr), state(ForthWordState::NORMAL), inlineMode(INLINE_AUTO),
+          stackIn(-1), stackOut(-1), data(uint64_t(0)) // Default initialize to uint64_t(0)
     {
         std::strncpy(name, wordName, sizeof(name));
         name[sizeof(name) - 1] = '\0'; // Ensure null-termination
@@ -231,6 +243,13 @@ struct ForthWord
 };
 
 
+// Token form of a colon definition, replayed by the compiler to inline the word
+struct InlineBody
+{
+    std::vector<std::string> tokens;
+    std::vector<const ForthWord*> bindings; // what each token named when the word was defined
+    bool inlinable = true; // false if the body can not be replayed inside another word
+};
 
 // Class to manage the Forth dictionary
 class ForthDictionary
@@ -293,20 +312,44 @@ public:
     void* get_data_ptr() const;
     void displayWord(std::string name);
     void SetState(uint8_t i);
+    void setInlineMode(ForthInlineMode mode) const;
+    void setStackEffect(int in, int out) const;
+    void setInlineBody(InlineBody body);
+    [[nodiscard]] const InlineBody* getInlineBody(const ForthWord* word) const;
+    [[nodiscard]] std::string getSourceCode(const ForthWord* word) const;
+
+    // compiling a lazy word, which must see the dictionary as it was when the word was defined
+    std::vector<ForthWord*> hideWordsAfter(const ForthWord* word);
+    void showWords(const std::vector<ForthWord*>& words);
+    void adoptLatestWord(ForthWord* word);
 
     // List all words in the dictionary
     void list_words() const;
 
 private:
+    // images save and restore the dictionary memory and the tables that point into it
+    friend class JitImage;
+
     // Private constructor to prevent instantiation
     explicit ForthDictionary(size_t size);
 
+    // Hash index over the word names, each bucket is a chain through ForthWord::hashLink
+    // with the newest word first, so redefinitions shadow older words as they do on the link chain.
+    static constexpr size_t HASH_BUCKETS = 4096;
+    static size_t hashName(const char* name);
+    void linkHash(ForthWord* word);
+    void unlinkHash(const ForthWord* word);
+
     std::vector<char> memory; // Memory buffer for the dictionary
     size_t currentPos; // Current position in the memory buffer
     ForthWord* latestWord; // Pointer to the latest added word
+    std::vector<ForthWord*> hashBuckets; // Newest word in each hash bucket
 
     // Map to store the source code associated with each word
     std::unordered_map<std::string, std::string> sourceCodeMap;
+
+    // Token bodies of colon definitions, used for inlining
+    std::unordered_map<const ForthWord*, InlineBody> inlineBodies;
 };
 
 #endif // FORTH_DICTIONARY_H
\ No newline at end of file
@@ -0,0 +1,217 @@
+#ifndef JITARENA_H
+#define JITARENA_H
+
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "include/asmjit/asmjit.h"
+
+// Code arena.
+// One contiguous executable region, reserved the first time a word is compiled.
+// Words are placed in it one after another, in the order they are compiled, so
+// - every word can reach every other word with a direct call rel32 or jmp rel32
+// - a word usually sits next to the words it calls, which were defined just before it
+//
+// This replaces JitRuntime::add, which allocates each word separately.
+// Memory is not given back when a word is forgotten, the same as with the runtime.
+//
+// The arena is never writable and executable at once. It is reserved read/write, and the
+// pages holding code are switched to read/execute as soon as the code is copied in. Code
+// that patches a word afterwards (a lazy stub, a retargeted call, a loaded image) opens a
+// JitArena::Writable scope over the bytes it changes.
+
+class JitArena
+{
+public:
+    static JitArena& getInstance()
+    {
+        static JitArena instance;
+        return instance;
+    }
+
+    JitArena(const JitArena&) = delete;
+    JitArena& operator=(const JitArena&) = delete;
+
+    // well inside the 2GB reach of a rel32 displacement
+    static constexpr size_t ARENA_SIZE = 64 * 1024 * 1024;
+    static constexpr size_t CODE_ALIGNMENT = 16;
+
+    // Makes the arena pages holding [p, p + size) writable while it lasts, then executable
+    // again. The pages are not executable in between, so nothing may run from them.
+    class Writable
+    {
+    public:
+        Writable(void* p, const size_t size)
+        {
+            const uintptr_t pageSize = asmjit::VirtMem::info().pageSize;
+            const auto first = reinterpret_cast<uintptr_t>(p) & ~(pageSize - 1);
+            const auto last = (reinterpret_cast<uintptr_t>(p) + size + pageSize - 1) & ~(pageSize - 1);
+            pages = reinterpret_cast<uint8_t*>(first);
+            length = last - first;
+            start = static_cast<uint8_t*>(p);
+            bytes = size;
+            setAccess(asmjit::VirtMem::MemoryFlags::kAccessRW);
+        }
+
+        ~Writable()
+        {
+            if (bytes == 0) return;
+            if (asmjit::VirtMem::protect(pages, length, asmjit::VirtMem::MemoryFlags::kAccessRX) != asmjit::kErrorOk)
+            {
+                std::cerr << "JitArena: cannot make the code executable again" << std::endl;
+            }
+            asmjit::VirtMem::flushInstructionCache(start, bytes);
+        }
+
+        Writable(const Writable&) = delete;
+        Writable& operator=(const Writable&) = delete;
+
+    private:
+        void setAccess(const asmjit::VirtMem::MemoryFlags flags)
+        {
+            if (bytes == 0) return;
+            if (const asmjit::Error err = asmjit::VirtMem::protect(pages, length, flags))
+            {
+                bytes = 0;
+                throw std::runtime_error(std::string("JitArena: cannot change the protection of the code arena: ")
+                    + asmjit::DebugUtils::errorAsString(err));
+            }
+        }
+
+        uint8_t* pages = nullptr;
+        size_t length = 0;
+        uint8_t* start = nullptr;
+        size_t bytes = 0;
+    };
+
+    // copy the finished code into the arena and return its address
+    void* add(asmjit::CodeHolder& code)
+    {
+        reserve();
+
+        code.flatten();
+        code.resolveUnresolvedLinks();
+
+        // the estimate includes room for an address table, relocation may need less
+        const size_t estimatedSize = code.codeSize();
+        const size_t start = (used + CODE_ALIGNMENT - 1) & ~(CODE_ALIGNMENT - 1);
+        if (estimatedSize == 0 || start + estimatedSize > ARENA_SIZE)
+        {
+            throw std::runtime_error("JitArena: code arena is full");
+        }
+
+        uint8_t* p = base + start;
+        if (const asmjit::Error err = code.relocateToBase(reinterpret_cast<uint64_t>(p)))
+        {
+            throw std::runtime_error(asmjit::DebugUtils::errorAsString(err));
+        }
+
+        const size_t size = code.codeSize();
+        {
+            Writable writable(p, size);
+            code.copyFlattenedData(p, size, asmjit::CopySectionFlags::kPadTargetBufferWithZeroes);
+        }
+
+        used = start + size;
+        ++blocks;
+        return p;
+    }
+
+    // copy code that has already been relocated for this arena, used to load images
+    uint8_t* addBytes(const uint8_t* bytes, size_t size)
+    {
+        reserve();
+        const size_t start = (used + CODE_ALIGNMENT - 1) & ~(CODE_ALIGNMENT - 1);
+        if (start + size > ARENA_SIZE)
+        {
+            throw std::runtime_error("JitArena: code arena is full");
+        }
+
+        uint8_t* p = base + start;
+        {
+            Writable writable(p, size);
+            std::memcpy(p, bytes, size);
+        }
+
+        used = start + size;
+        ++blocks;
+        return p;
+    }
+
+    [[nodiscard]] uint8_t* baseAddress() const
+    {
+        return base;
+    }
+
+    [[nodiscard]] bool contains(const void* p) const
+    {
+        const auto* q = static_cast<const uint8_t*>(p);
+        return base != nullptr && q >= base && q < base + used;
+    }
+
+    [[nodiscard]] size_t capacity() const
+    {
+        return ARENA_SIZE;
+    }
+
+    [[nodiscard]] size_t usedBytes() const
+    {
+        return used;
+    }
+
+    [[nodiscard]] size_t freeBytes() const
+    {
+        return ARENA_SIZE - used;
+    }
+
+    // a word, or a batch of words, added in one go
+    [[nodiscard]] size_t blockCount() const
+    {
+        return blocks;
+    }
+
+    void report() const
+    {
+        std::cout << "Code arena" << std::endl;
+        std::cout << "  Base address   : " << static_cast<const void*>(base) << std::endl;
+        std::cout << "  Capacity       : " << capacity() << " bytes" << std::endl;
+        std::ostringstream percent;
+        percent << std::fixed << std::setprecision(2) << 100.0 * static_cast<double>(used) / ARENA_SIZE;
+        std::cout << "  Used           : " << usedBytes() << " bytes (" << percent.str() << "%)" << std::endl;
+        std::cout << "  Free           : " << freeBytes() << " bytes" << std::endl;
+        std::cout << "  Code blocks    : " << blockCount() << std::endl;
+    }
+
+private:
+    JitArena() = default;
+
+    ~JitArena()
+    {
+        if (base != nullptr)
+        {
+            asmjit::VirtMem::release(base, ARENA_SIZE);
+        }
+    }
+
+    void reserve()
+    {
+        if (base != nullptr) return;
+        void* p = nullptr;
+        if (const asmjit::Error err = asmjit::VirtMem::alloc(&p, ARENA_SIZE, asmjit::VirtMem::MemoryFlags::kAccessRW))
+        {
+            throw std::runtime_error(std::string("JitArena: cannot reserve the code arena: ")
+                + asmjit::DebugUtils::errorAsString(err));
+        }
+        base = static_cast<uint8_t*>(p);
+    }
+
+    uint8_t* base = nullptr;
+    size_t used = 0;
+    size_t blocks = 0;
+};
+
+#endif //JITARENA_H
@@ -5,16 +5,24 @@
 #include <iostream>
 #include <stdexcept>
 #include "include/asmjit/asmjit.h"
-#include "JitContext.h"
+#include "jitContext.h"
 #include "ForthDictionary.h"
 #include <stack>
 #include "StackManager.h"
 #include <variant>
 #include "StringInterner.h"
-#include "Quit.h"
+#include "quit.h"
 #include "UtilitySDL.h"
 #include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <bit>
+#include <cstring>
+#include <fstream>
 #include "jitLabels.h"
+#include "JitPeephole.h"
+#include "JitArena.h"
+#include "JitImage.h"
 
 const int INVALID_OFFSET = -9999;
 
@@ -37,10 +45,45 @@ static std::unordered_map<int, std::string> argumentsByOffset;
 static std::unordered_map<int, std::string> localsByOffset;
 static std::unordered_map<int, std::string> returnValuesByOffset;
 
+// batch compilation, the entry label of each word waiting for flushBatch.
+// the key is the placeholder the word holds as its compiled function until then,
+// placeholder n is the address n, which is never a real function and must never be run,
+// see JitGenerator::runnable.
+static std::unordered_map<ForthFunction, asmjit::Label> batchLabels;
+
+// compiles a word again from the tokens kept for it, see CompilerUtility.h
+using WordCompiler = ForthFunction (*)(ForthWord* word);
+
+// lazy compilation, the stubs of words that have not been called yet and what compiles them.
+static std::unordered_map<ForthFunction, WordCompiler> lazyStubs;
+
+// tiered compilation, a baseline word counts its calls and loop back edges down from jc.tierThreshold.
+// The counter is allotted in the dictionary, so images relocate the code that uses it,
+// and it finds its word by offset for the same reason.
+struct TierCounter
+{
+    int64_t count;
+    int64_t wordOffset; // from the counter to its word, 0 until the word is in the dictionary
+};
+
+// the counter of the word being generated, and what recompiles it once it is hot
+static TierCounter* tierCounter = nullptr;
+static WordCompiler tierCompiler = nullptr;
+static bool tierCountNext = false;
+
+// word frames, the nodes genAlignFrame and genRestoreFrame emitted for the word being generated.
+// endGeneration removes them again when the word made no call through genCCall.
+static std::vector<asmjit::BaseNode*> frameNodes;
+static bool framingWord = false;
+static bool wordCallsC = false;
+// the last call genCCall emitted, genTailCall never turns it into a jmp
+static asmjit::BaseNode* lastCCall = nullptr;
+
 
 inline JitContext& jc = JitContext::getInstance();
 inline ForthDictionary& d = ForthDictionary::getInstance();
 inline StackManager& sm = StackManager::getInstance();
+inline JitArena& arena = JitArena::getInstance();
 
 inline extern void prim_emit(const uint64_t a)
 {
@@ -117,6 +160,162 @@ public:
     }
 
 
+    // Addresses in generated code
+    // An instruction whose immediate is the address of something, data in the dictionary, a
+    // string or a function, is tagged as it is emitted so that SAVE-IMAGE relocates it. Other
+    // immediates are left alone however much they look like an address.
+    template <typename T>
+    static void movAddress(asmjit::x86::Builder& a, const asmjit::x86::Gp& reg, T address)
+    {
+        a.mov(reg, asmjit::imm(address));
+        JitImage::tagAddress(a);
+    }
+
+    template <typename F>
+    static void callAddress(asmjit::x86::Builder& a, F* fn)
+    {
+        a.call(asmjit::imm(reinterpret_cast<void*>(fn)));
+        JitImage::tagAddress(a);
+    }
+
+    // C calls
+    // Generated code calls C and C++ functions with the calling convention of the platform
+    // the program is built for. The caller loads integer arguments into rcx, rdx, r8 and r9
+    // in that order, and a double argument into xmm0, then genCCall puts them where the
+    // platform expects them:
+    //   Win64     rcx rdx r8 r9, with 32 bytes of shadow space above the return address
+    //   System V  rdi rsi rdx rcx r8 r9, no shadow space, rsi and rdi are not preserved
+    // genPrologue aligns rsp to 16 bytes, so the call moves rsp by the shadow space and by
+    // what the caller has pushed since, 0 or 8, to be aligned.
+#ifdef _WIN32
+    static constexpr int cShadowSpace = 32;
+#else
+    static constexpr int cShadowSpace = 0;
+#endif
+
+    // the register C argument n is passed in, n from 0 to 3
+    static asmjit::x86::Gp cArg(const int n)
+    {
+#ifdef _WIN32
+        static const asmjit::x86::Gp regs[] = {asmjit::x86::rcx, asmjit::x86::rdx, asmjit::x86::r8, asmjit::x86::r9};
+#else
+        static const asmjit::x86::Gp regs[] = {asmjit::x86::rdi, asmjit::x86::rsi, asmjit::x86::rdx, asmjit::x86::rcx};
+#endif
+        return regs[n];
+    }
+
+    template <typename F>
+    static void genCCall(F* fn, const int args = 0, const int pushed = 0)
+    {
+        using namespace asmjit::x86;
+        auto& a = *jc.assembler;
+        const int frame = cShadowSpace + pushed % 16;
+        // the word needs its aligned frame
+        wordCallsC = true;
+#ifdef _WIN32
+        (void)args;
+        a.sub(rsp, frame);
+        callAddress(a, fn);
+        lastCCall = a.cursor();
+        a.add(rsp, frame);
+#else
+        // a register loop is the only thing that keeps a value in rsi or rdi
+        const bool saveLoop = registerLoopDepth > 0;
+        if (saveLoop)
+        {
+            a.push(rsi);
+            a.push(rdi);
+        }
+        // in this order each register is read before it is written
+        static const Gp from[] = {rcx, rdx, r8, r9};
+        for (int n = 0; n < args; ++n) a.mov(cArg(n), from[n]);
+        if (frame != 0) a.sub(rsp, frame);
+        callAddress(a, fn);
+        lastCCall = a.cursor();
+        if (frame != 0) a.add(rsp, frame);
+        if (saveLoop)
+        {
+            a.pop(rdi);
+            a.pop(rsi);
+        }
+#endif
+    }
+
+    // Word frames
+    // A word can be called from C, with rsp 8 below a 16 byte boundary, or from another word,
+    // which leaves it anywhere. A word that calls C keeps the callers rsp in rbp and aligns rsp
+    // on entry, and puts it back before every ret and every tail jump.  Every word is generated
+    // with the frame, and endGeneration takes it out of the words that make no C call.
+    static void genAlignFrame(asmjit::x86::Builder& a)
+    {
+        asmjit::BaseNode* before = a.cursor();
+        a.push(asmjit::x86::rbp);
+        a.mov(asmjit::x86::rbp, asmjit::x86::rsp);
+        a.and_(asmjit::x86::rsp, -16);
+        recordFrame(a, before);
+    }
+
+    static void genRestoreFrame(asmjit::x86::Builder& a)
+    {
+        asmjit::BaseNode* before = a.cursor();
+        a.mov(asmjit::x86::rsp, asmjit::x86::rbp);
+        a.pop(asmjit::x86::rbp);
+        recordFrame(a, before);
+    }
+
+    // note the frame instructions emitted after before, when generating a word
+    static void recordFrame(const asmjit::x86::Builder& a, asmjit::BaseNode* before)
+    {
+        if (!framingWord) return;
+        for (asmjit::BaseNode* node = before != nullptr ? before->next() : a.firstNode(); node != nullptr;
+             node = node->next())
+        {
+            frameNodes.push_back(node);
+            if (node == a.cursor()) break;
+        }
+    }
+
+    // a word that made no C call does not need its frame
+    static void removeUnusedFrame(asmjit::x86::Builder& a)
+    {
+        if (framingWord && !wordCallsC)
+        {
+            for (asmjit::BaseNode* node : frameNodes) a.removeNode(node);
+        }
+        frameNodes.clear();
+        framingWord = false;
+    }
+
+    // Instructions from the optimization passes
+    // CompilerUtility.h tags the instructions its passes add to a definition.  Each is compiled
+    // by an immediate registered under the name here, which starts with a control character,
+    // and the immediate checks the tag of its token, so the name typed into a definition
+    // raises an error instead.
+    static const char* tagName(const TokenTag tag)
+    {
+        switch (tag)
+        {
+        case TokenTag::REGBLOCK: return "\001REGBLOCK";
+        case TokenTag::FPBLOCK: return "\001FPBLOCK";
+        case TokenTag::MOVE: return "\001MOVE";
+        case TokenTag::ERASE: return "\001ERASE";
+        case TokenTag::FILL: return "\001FILL";
+        case TokenTag::DISP: return "\001DISP";
+        case TokenTag::INDEX: return "\001INDEX";
+        default: return "";
+        }
+    }
+
+    // the token the immediate runs for has to be the instruction tag
+    static void expectTag(const TokenTag tag)
+    {
+        const size_t pos = jc.pos_next_word;
+        if (jc.wordTags == nullptr || pos >= jc.wordTags->size() || (*jc.wordTags)[pos] != tag)
+        {
+            throw std::runtime_error(std::string(tagName(tag) + 1) + " is only generated by the compiler");
+        }
+    }
+
     // preserve stack pointers
     static void preserveStackPointers()
     {
@@ -130,6 +329,49 @@ public:
 
     // AsmJit related functions
 
+    // top of stack caching (*TOSCACHE ON)
+    // the top data stack item is kept in r10 instead of at [r15].
+    // jc.tosCached is true while r10 holds the item at code generation time.
+    // The cache must be spilled before calls, jumps, labels and the return,
+    // so that the in-memory stack is always correct at those points.
+
+    static void spillTOS()
+    {
+        if (!jc.tosCached)
+        {
+            return;
+        }
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("spillTOS: Assembler not initialized");
+        }
+
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- spillTOS");
+        a.sub(asmjit::x86::r15, 8);
+        a.mov(asmjit::x86::qword_ptr(asmjit::x86::r15), asmjit::x86::r10);
+        jc.tosCached = false;
+    }
+
+    // make sure the top of stack is in r10, when caching.
+    static void fillTOS()
+    {
+        if (!jc.optTosCache || jc.tosCached)
+        {
+            return;
+        }
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("fillTOS: Assembler not initialized");
+        }
+
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- fillTOS");
+        a.mov(asmjit::x86::r10, asmjit::x86::qword_ptr(asmjit::x86::r15));
+        a.add(asmjit::x86::r15, 8);
+        jc.tosCached = true;
+    }
+
     static void pushDS(asmjit::x86::Gp reg)
     {
         if (!jc.assembler)
@@ -138,6 +380,14 @@ public:
         }
 
         auto& a = *jc.assembler;
+        if (jc.optTosCache)
+        {
+            spillTOS();
+            a.comment(" ; ----- pushDS (cached in r10)");
+            a.mov(asmjit::x86::r10, reg.r64());
+            jc.tosCached = true;
+            return;
+        }
         a.comment(" ; ----- pushDS");
         a.comment(" ; save value to the data stack (r15)");
         a.sub(asmjit::x86::r15, 8);
@@ -152,6 +402,13 @@ public:
         }
 
         auto& a = *jc.assembler;
+        if (jc.tosCached)
+        {
+            a.comment(" ; ----- popDS (cached in r10)");
+            a.mov(reg.r64(), asmjit::x86::r10);
+            jc.tosCached = false;
+            return;
+        }
         a.comment(" ; ----- popDS");
         a.comment(" ; fetch value from the data stack (r15)");
         a.nop();
@@ -171,7 +428,7 @@ public:
         // Load the address into rax
         a.comment(" ; ----- loadDS");
         a.comment(" ; ----- Dereference the address provided to get the value");
-        a.mov(asmjit::x86::rax, dataAddress);
+        movAddress(a, asmjit::x86::rax, dataAddress);
         // Dereference the address to get the value and store it into rax
         a.mov(asmjit::x86::rax, asmjit::x86::ptr(asmjit::x86::rax));
         // Push the value onto the data stack
@@ -215,7 +472,7 @@ public:
         popDS(asmjit::x86::rax);
 
         // Load the address into rcx
-        a.mov(asmjit::x86::rcx, dataAddress);
+        movAddress(a, asmjit::x86::rcx, dataAddress);
         // Store the value from rax into the address pointed to by rcx
         a.mov(asmjit::x86::qword_ptr(asmjit::x86::rcx), asmjit::x86::rax);
     }
@@ -286,37 +543,87 @@ public:
     }
 
 
-    static void prim_inc_ss()
+    // String reference counts.
+    // The count is the first qword of a string's header in the interner, so generated code
+    // updates it with lock inc and lock dec. Only a count that reaches zero calls C++, which
+    // removes the string.
+
+    // rax = the header of the string whose index is in rcx, uses rdx and r11
+    // jumps to outOfRange for an index the interner has not given out, as decrementRef ignores it
+    // the index table is in segments of FIRST_SEGMENT << k, with offset + FIRST_SEGMENT below
+    // the segment's top bit, so index + FIRST_SEGMENT gives both the segment and the offset
+    static void genStringEntry(const asmjit::Label& outOfRange)
     {
-        sm.incSS();
+        using namespace asmjit::x86;
+        auto& a = *jc.assembler;
+        constexpr auto shift = static_cast<int>(StringInterner::SEGMENT_SHIFT);
+        a.comment(" ; string header from index");
+        movAddress(a, rax, strIntern.countAddress());
+        a.cmp(rcx, qword_ptr(rax));
+        a.jae(outOfRange);
+        a.lea(rdx, ptr(rcx, 1 << shift));
+        a.mov(r11, rdx);
+        a.shr(r11, shift);
+        a.bsr(r11, r11); // segment
+        movAddress(a, rax, strIntern.segmentTable());
+        a.mov(rax, qword_ptr(rax, r11, 3));
+        a.add(r11, shift);
+        a.btr(rdx, r11); // offset in the segment
+        a.mov(rax, qword_ptr(rax, rdx, 3));
     }
 
-    static void pushSSAndBumpRef(asmjit::x86::Gp reg)
+    // take a reference to the string whose index is in rcx
+    static void genIncStringRef()
     {
-        if (!jc.assembler)
-        {
-            throw std::runtime_error("gen_prologue: Assembler not initialized");
-        }
-
+        using namespace asmjit::x86;
         auto& a = *jc.assembler;
+        a.comment(" ; ----- string ref + 1");
+        const asmjit::Label skip = a.newLabel();
+        genStringEntry(skip);
+        a.lock().inc(qword_ptr(rax));
+        a.bind(skip);
+    }
 
-        a.comment("; pushSSAndBumpRef (arg provided)");
-        a.comment("; Decrement string reference");
-
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(prim_dec_ss);
-        a.add(asmjit::x86::rsp, 40);
+    static uint64_t prim_retain_string(const uint64_t value)
+    {
+        return strIntern.retain(value);
+    }
 
-        a.comment(" ; ----- pushSS");
-        a.comment(" ; save value to the string stack (r12)");
-        a.sub(asmjit::x86::r12, 8);
-        a.mov(asmjit::x86::qword_ptr(asmjit::x86::r12), reg);
+    // keep the string or slice in rcx, taken off the string stack, leaving the index in rcx
+    // an index brings its reference with it, a slice is interned as a string of its own
+    static void genRetainString()
+    {
+        using namespace asmjit::x86;
+        auto& a = *jc.assembler;
+        const asmjit::Label done = a.newLabel();
+        a.test(rcx, rcx);
+        a.jns(done);
+        a.push(r10);
+        genCCall(prim_retain_string, 1, 8);
+        a.pop(r10);
+        a.mov(rcx, rax);
+        a.bind(done);
     }
 
+    static void prim_remove_string(const uint64_t index)
+    {
+        strIntern.removeIfUnused(index);
+    }
 
-    static void prim_dec_ss()
+    // drop a reference to the string whose index is in rcx, one that reaches zero is removed
+    static void genDecStringRef()
     {
-        sm.decSS();
+        using namespace asmjit::x86;
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- string ref - 1");
+        const asmjit::Label skip = a.newLabel();
+        genStringEntry(skip);
+        a.lock().dec(qword_ptr(rax));
+        a.jnz(skip);
+        a.push(r10);
+        genCCall(prim_remove_string, 1, 8);
+        a.pop(r10);
+        a.bind(skip);
     }
 
     static void popSS(asmjit::x86::Gp reg)
@@ -348,13 +655,14 @@ public:
 
         auto& a = *jc.assembler;
         // Load the address into rax
-        a.mov(asmjit::x86::rax, dataAddress);
+        movAddress(a, asmjit::x86::rax, dataAddress);
 
-        // Dereference the address to get the value and store it into rax
-        a.mov(asmjit::x86::rax, asmjit::x86::ptr(asmjit::x86::rax));
+        // Dereference the address to get the value and store it into rcx
+        a.mov(asmjit::x86::rcx, asmjit::x86::ptr(asmjit::x86::rax));
 
-        // Push the value onto the string stack
-        pushSS(asmjit::x86::rax);
+        // Push the value onto the string stack, which holds a reference of its own
+        genIncStringRef();
+        pushSS(asmjit::x86::rcx);
     }
 
 
@@ -386,7 +694,7 @@ public:
         popSS(asmjit::x86::rax);
 
         // Load the address into rcx
-        a.mov(asmjit::x86::rcx, dataAddress);
+        movAddress(a, asmjit::x86::rcx, dataAddress);
         // Store the value from rax into the address pointed to by rcx
         a.mov(asmjit::x86::qword_ptr(asmjit::x86::rcx), asmjit::x86::rax);
     }
@@ -673,8 +981,8 @@ public:
         }
         auto& a = *jc.assembler;
         asmjit::x86::Gp addr = asmjit::x86::rax; // General purpose register for address
-        asmjit::x86::Gp value = asmjit::x86::rdi; // General purpose register for the value
-        a.mov(addr, address); // Move the address into the register.
+        asmjit::x86::Gp value = asmjit::x86::rcx; // General purpose register for the value
+        movAddress(a, addr, address); // Move the address into the register.
         a.mov(value, asmjit::x86::ptr(addr));
         pushDS(value); // Push the value onto the stack.
     }
@@ -736,7 +1044,7 @@ public:
                 auto data_address = d.get_data_ptr();
                 if (logging) printf("data_address: %p\n", data_address);
                 // Load the address of the word's data
-                a.mov(asmjit::x86::rax, data_address);
+                movAddress(a, asmjit::x86::rax, data_address);
 
                 // Pop the value from the data stack into rcx
                 popDS(asmjit::x86::rcx);
@@ -754,7 +1062,7 @@ public:
             {
                 commentWithWord("; TO ----- pop stack into VARIABLE: ", w);
                 auto data_address = d.get_data_ptr();
-                a.mov(asmjit::x86::rax, data_address);
+                movAddress(a, asmjit::x86::rax, data_address);
 
                 // Pop the value from the data stack into rcx
                 popDS(asmjit::x86::rcx);
@@ -782,7 +1090,7 @@ public:
 
                 // Calculate address for the array element
                 const auto base_address = reinterpret_cast<uint64_t>(&fword->data);
-                a.mov(asmjit::x86::rax, base_address);
+                movAddress(a, asmjit::x86::rax, base_address);
                 a.add(asmjit::x86::rax, 8);
                 a.lea(asmjit::x86::rax, asmjit::x86::qword_ptr(asmjit::x86::rax, asmjit::x86::rdx, 3));
                 // Store the value
@@ -793,9 +1101,7 @@ public:
                 a.comment("; throw error");
                 a.bind(throw_error);
 
-                a.sub(asmjit::x86::rsp, 40);
-                a.call(throw_array_index_error);
-                a.add(asmjit::x86::rsp, 40);
+                genCCall(throw_array_index_error);
 
                 a.comment("; continue as normal");
                 a.bind(normal_continue);
@@ -814,13 +1120,14 @@ public:
                     throw std::runtime_error("Failed to get string address for word: " + w);
                 }
 
-                a.mov(asmjit::x86::rax, variable_address);
-
-                // Pop the value from the data stack into rcx
+                // Pop the new string from the string stack into rcx
                 popSS(asmjit::x86::rcx);
 
-                // Store the value into the address
-                a.mov(asmjit::x86::qword_ptr(asmjit::x86::rax), asmjit::x86::rcx);
+                // the variable holds a reference to its string, a slice is interned first
+                genRetainString();
+                movAddress(a, asmjit::x86::rax, variable_address);
+                a.xchg(asmjit::x86::qword_ptr(asmjit::x86::rax), asmjit::x86::rcx);
+                genDecStringRef();
             }
             jc.pos_last_word = pos;
         }
@@ -897,8 +1204,8 @@ public:
             {
                 // update a string variable from the string stack.
                 auto variable_address = d.get_data_ptr();
-                size_t string_address = sm.popSS();
-                strIntern.incrementRef(string_address);
+                size_t string_address = strIntern.retain(sm.popSS());
+                strIntern.decrementRef(std::get<uint64_t>(fword->data));
                 fword->data = string_address; // update the data pointer to point to the string
             }
             jc.pos_last_word = pos;
@@ -999,20 +1306,64 @@ public:
         a.cmp(index, arraySize);
         a.jae(index_error);
 
-        a.mov(base, dataAddress+8); // first element is size of array
+        movAddress(a, base, static_cast<char*>(dataAddress) + 8); // first element is size of array
         a.shl(index, 3); // always * 8
         a.add(base, index);
         // load result with contents of base
         a.mov(result, asmjit::x86::ptr(base));
         pushDS(result);
+        spillTOS();
         a.ret();
 
         a.comment("; throw error - if array index out of bounds");
         a.bind(index_error);
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(throw_array_index_error);
-        a.add(asmjit::x86::rsp, 40);
+        genAlignFrame(a);
+        genCCall(throw_array_index_error);
+        genRestoreFrame(a);
+        a.ret();
+
+        ForthFunction compiledFunc = endGeneration();
+        d.setCompiledFunction(compiledFunc);
+        jc.pos_last_word = pos;
+    }
+
+
+    // 1000 FARRAY samples
+    // a float array for the vector words, its elements are contiguous and 32 byte aligned.
+    // samples returns the address of the first element, the count is in the cell before it.
+    static void genImmediateFloatArray()
+    {
+        const auto& words = *jc.words;
+        size_t pos = jc.pos_next_word + 1;
+        std::string word = words[pos];
+        jc.word = word;
+
+        const auto arraySize = sm.popDS();
+        jc.resetContext();
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genImmediateFloatArray: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        commentWithWord(" ; ----- immediate float array: ", word);
 
+        d.addWord(word.c_str(), nullptr, nullptr, nullptr, nullptr);
+        d.setData(arraySize);
+        d.setType(ForthWordType::FLOATARRAY);
+
+        // pad so that the elements, after the count, start on a vector boundary
+        const uint64_t here = d.getCurrentLocation();
+        d.allot((vectorAlignment - (here + 8) % vectorAlignment) % vectorAlignment);
+        auto* count = reinterpret_cast<uint64_t*>(d.getCurrentLocation());
+        d.allot(8 + arraySize * 8);
+        *count = arraySize;
+        double* elements = reinterpret_cast<double*>(count + 1);
+        std::fill(elements, elements + arraySize, 0.0);
+
+        a.comment(" ; ----- push the address of the first element");
+        movAddress(a, asmjit::x86::rax, elements);
+        pushDS(asmjit::x86::rax);
+        spillTOS();
         a.ret();
 
         ForthFunction compiledFunc = endGeneration();
@@ -1050,6 +1401,7 @@ public:
 
         a.comment(" ; ----- fetch value");
         loadDS(dataAddress);
+        spillTOS();
         a.ret();
 
         ForthFunction compiledFunc = endGeneration();
@@ -1088,7 +1440,7 @@ public:
 
         a.comment(" ; ----- fetch value");
         loadDS(dataAddress); // DS is also used for floats
-
+        spillTOS();
         a.ret();
 
         ForthFunction compiledFunc = endGeneration();
@@ -1124,6 +1476,7 @@ public:
 
         a.comment(" ; ----- fetch value");
         loadDS(dataAddress);
+        spillTOS();
         a.ret();
 
         ForthFunction compiledFunc = endGeneration();
@@ -1171,6 +1524,7 @@ public:
 
         a.comment(" ; ----- fetch value");
         loadDS(dataAddress);
+        spillTOS();
         a.ret();
 
         ForthFunction compiledFunc = endGeneration();
@@ -1191,8 +1545,7 @@ public:
 
 
         // Pop the initial value from the data stack
-        auto initialValue = sm.popSS();
-        strIntern.incrementRef(initialValue);
+        auto initialValue = strIntern.retain(sm.popSS());
         printf("initialValue: %llu\n", initialValue);
         jc.resetContext();
         if (!jc.assembler)
@@ -1243,8 +1596,9 @@ public:
         //printf("dataAddress: %llu\n", dataAddress);
         // use the data address to fetch the value
         a.comment(" ; ----- fetch variable address ");
-        a.mov(asmjit::x86::rax, dataAddress);
+        movAddress(a, asmjit::x86::rax, dataAddress);
         pushDS(asmjit::x86::rax);
+        spillTOS();
         a.ret();
         ForthFunction compiledFunc = endGeneration();
         d.setCompiledFunction(compiledFunc);
@@ -1257,8 +1611,10 @@ public:
     {
         const size_t s1 = sm.popSS();
         const size_t s2 = sm.popSS();
+        // the reference StringCat takes is the one the string stack holds
         const size_t s3 = strIntern.StringCat(s2, s1);
-        strIntern.incrementRef(s3);
+        strIntern.drop(s1);
+        strIntern.drop(s2);
         sm.pushSS(s3);
     }
 
@@ -1271,9 +1627,8 @@ public:
         }
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- .s+ calls strcat ");
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(prim_string_cat);
-        a.add(asmjit::x86::rsp, 40);
+        spillTOS();
+        genCCall(prim_string_cat);
     }
 
     static void prim_str_pos()
@@ -1281,6 +1636,8 @@ public:
         const size_t s1 = sm.popSS();
         const size_t s2 = sm.popSS();
         const int pos = strIntern.StrPos(s1, s2);
+        strIntern.drop(s1);
+        strIntern.drop(s2);
         sm.pushDS(static_cast<size_t>(pos));
     }
 
@@ -1292,9 +1649,8 @@ public:
         }
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- .pos calls strpos ");
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(prim_str_pos);
-        a.add(asmjit::x86::rsp, 40);
+        spillTOS();
+        genCCall(prim_str_pos);
     }
 
     static void prim_string_field()
@@ -1302,8 +1658,10 @@ public:
         const size_t s1 = sm.popSS();
         const size_t delimiter = sm.popSS();
         const size_t position = sm.popDS();
-        const size_t result = strIntern.StringSplit(delimiter, s1, position);
-        strIntern.incrementRef(result);
+        // a slice of the string, nothing is copied
+        const uint64_t result = strIntern.StringSplit(delimiter, s1, position);
+        strIntern.drop(s1);
+        strIntern.drop(delimiter);
         sm.pushSS(result);
     }
 
@@ -1316,9 +1674,103 @@ public:
         }
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- .split calls string split ");
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(prim_string_field);
-        a.add(asmjit::x86::rsp, 40);
+        spillTOS();
+        genCCall(prim_string_field);
+    }
+
+    // ( S: str delim -- rest field ) ( -- true ), or ( S: str delim -- ) ( -- false ) at the end
+    static void prim_next_field()
+    {
+        const uint64_t delimiter = sm.popSS();
+        const uint64_t str = sm.popSS();
+        uint64_t field = 0;
+        uint64_t rest = 0;
+        // the field and the rest take references of their own
+        const bool found = strIntern.NextField(str, delimiter, field, rest);
+        strIntern.drop(str);
+        strIntern.drop(delimiter);
+        if (!found)
+        {
+            sm.pushDS(0);
+            return;
+        }
+        sm.pushSS(rest);
+        sm.pushSS(field);
+        sm.pushDS(-1);
+    }
+
+    // walk the fields of a string in one pass
+    // s" a,b,c" BEGIN s" ," strNextField WHILE s. REPEAT
+    static void genNextField()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genNextField: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        commentWithWord(" ; ----- strNextField calls next field ");
+        spillTOS();
+        genCCall(prim_next_field);
+    }
+
+    // strFieldOffsets <array> ( S: str delim -- ) ( -- n ), the offset of each field in one pass
+    // the array is named after the word, so its type and size are checked when it is compiled
+    static void prim_field_offsets(uint64_t* offsets, const uint64_t capacity)
+    {
+        const uint64_t delimiter = sm.popSS();
+        const uint64_t str = sm.popSS();
+        const size_t count = strIntern.FieldOffsets(str, delimiter, offsets, capacity);
+        strIntern.drop(str);
+        strIntern.drop(delimiter);
+        sm.pushDS(count);
+    }
+
+    // the ARRAY named after strFieldOffsets, an integer array holds its size then its elements
+    static ForthWord* fieldOffsetsArray(const std::string& w)
+    {
+        ForthWord* fword = d.findWord(w.c_str());
+        if (fword == nullptr || fword->type != ForthWordType::ARRAY)
+        {
+            throw std::runtime_error("strFieldOffsets needs an ARRAY: " + w);
+        }
+        return fword;
+    }
+
+    static uint64_t* arrayElements(ForthWord* fword)
+    {
+        return reinterpret_cast<uint64_t*>(reinterpret_cast<char*>(&fword->data) + 8);
+    }
+
+    static void genFieldOffsets()
+    {
+        const auto& words = *jc.words;
+        const size_t pos = jc.pos_next_word + 1;
+        const std::string w = words[pos];
+        jc.word = w;
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genFieldOffsets: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        ForthWord* fword = fieldOffsetsArray(w);
+        commentWithWord(" ; ----- strFieldOffsets calls field offsets ", w);
+        spillTOS();
+        movAddress(a, asmjit::x86::rcx, arrayElements(fword));
+        a.mov(asmjit::x86::rdx, fword->getUint64());
+        genCCall(prim_field_offsets, 2);
+        jc.pos_last_word = pos;
+    }
+
+    // in interpret mode only.
+    static void execFieldOffsets()
+    {
+        const auto& words = *jc.words;
+        const size_t pos = jc.pos_next_word + 1;
+        const std::string w = words[pos];
+        jc.word = w;
+        ForthWord* fword = fieldOffsetsArray(w);
+        prim_field_offsets(arrayElements(fword), fword->getUint64());
+        jc.pos_last_word = pos;
     }
 
     static void prim_count_fields()
@@ -1326,6 +1778,8 @@ public:
         const size_t s1 = sm.popSS();
         const size_t s2 = sm.popSS();
         const size_t count = strIntern.CountFields(s2, s1);
+        strIntern.drop(s1);
+        strIntern.drop(s2);
         sm.pushDS(count);
     }
 
@@ -1337,9 +1791,8 @@ public:
         }
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- .count calls count fields ");
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(prim_count_fields);
-        a.add(asmjit::x86::rsp, 40);
+        spillTOS();
+        genCCall(prim_count_fields);
     }
 
 
@@ -1383,16 +1836,12 @@ public:
 
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- .\" displaying text ");
+        spillTOS();
 
         // put parameter in argument
 
-        a.mov(asmjit::x86::rcx, address);
-        // Allocate space for the shadow space
-        a.sub(asmjit::x86::rsp, 40);
-        // call puts
-        a.call(prints);
-        // restore shadow space
-        a.add(asmjit::x86::rsp, 40);
+        movAddress(a, asmjit::x86::rcx, address);
+        genCCall(prints, 1);
 
 
         jc.pos_last_word = pos;
@@ -1416,6 +1865,7 @@ public:
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- s\" stacking text ");
         a.mov(asmjit::x86::rcx, address);
+        genIncStringRef();
         pushSS(asmjit::x86::rcx);
 
         jc.pos_last_word = pos;
@@ -1431,15 +1881,16 @@ public:
         }
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- sprint prints string ");
+        spillTOS();
         popSS(asmjit::x86::rcx);
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(prim_sindex);
-        a.add(asmjit::x86::rsp, 40);
+        genCCall(prim_print_string, 1);
+    }
 
-        a.mov(asmjit::x86::rcx, asmjit::x86::rax);
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(prints);
-        a.add(asmjit::x86::rsp, 40);
+    // a slice is printed in place
+    static void prim_print_string(const uint64_t index)
+    {
+        std::cout << strIntern.view(index);
+        strIntern.drop(index);
     }
 
 
@@ -1452,6 +1903,7 @@ public:
         jc.word = word;
 
         auto address = stripIndex(word);
+        strIntern.incrementRef(address);
         sm.pushSS(reinterpret_cast<uint64_t>(address));
         jc.pos_last_word = pos;
     }
@@ -1497,6 +1949,12 @@ public:
         }
 
         auto& a = *jc.assembler;
+        jc.tosCached = false;
+        registerLoopDepth = 0;
+        frameNodes.clear();
+        framingWord = true;
+        wordCallsC = false;
+        lastCCall = nullptr;
         a.comment(" ; ----- function prologue -------------------------");
         a.nop();
         entryFunction();
@@ -1507,6 +1965,14 @@ public:
         funcLabels.entryLabel = a.newLabel();
         funcLabels.exitLabel = a.newLabel();
         a.bind(funcLabels.entryLabel);
+        // RECURSE comes back to the entry label, so each call builds its own frame, if it has one
+        genAlignFrame(a);
+
+        if (tierCountNext)
+        {
+            startTierCounter();
+        }
+        genTierCount(a);
 
 
         // Save on loopStack
@@ -1526,6 +1992,7 @@ public:
         }
 
         auto& a = *jc.assembler;
+        spillTOS();
         jc.epilogueLabel = a.newLabel();
         a.bind(jc.epilogueLabel);
 
@@ -1552,6 +2019,12 @@ public:
 
         // locals copy return values to stack.
         const int totalLocalsCount = arguments_to_local_count + locals_count + returned_arguments_count;
+
+        // a call as the last word can jump instead, unless return values are copied after it
+        if (returned_arguments_count == 0)
+        {
+            genTailCall(0, totalLocalsCount * 8);
+        }
         if (totalLocalsCount > 0)
         {
             a.comment(" ; ----- LOCALS in use");
@@ -1581,13 +2054,16 @@ public:
         }
 
         exitFunction();
-        // Free the total stack space on the return stack pointer.
+        // return values may have been left in the TOS cache
+        spillTOS();
+        genRestoreFrame(a);
         a.ret();
     }
 
 
     // exit jump off the word.
-    // needs to pop values from the return stack.
+    // needs to pop the loop counters and case selectors from the return stack.
+    // with locals the exit goes through the epilogue, which frees them.
 
     static void genExit()
     {
@@ -1598,15 +2074,65 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_exit");
-        // Create a temporary stack to hold the popped labels
-        std::stack<LoopLabel> tempStack;
-        bool found = false;
-        auto drop_bytes = 8 * doLoopDepth;
-        a.add(asmjit::x86::r14, drop_bytes);
+        spillTOS();
+        const int rsBytes = returnStackBytesInUse();
+        const int totalLocalsCount = arguments_to_local_count + locals_count + returned_arguments_count;
+        if (returned_arguments_count == 0)
+        {
+            genTailCall(rsBytes, totalLocalsCount * 8);
+        }
+        if (rsBytes > 0)
+        {
+            a.add(asmjit::x86::r14, rsBytes);
+        }
+        if (totalLocalsCount > 0)
+        {
+            a.jmp(functionLabels().exitLabel);
+            return;
+        }
+        genRestoreFrame(a);
         a.ret(); // return early from function.
     }
 
 
+    // tail calls
+    // If the last instruction generated is a call, the return after it can be folded in:
+    // the call becomes a jmp and the callee returns straight to our caller.
+    // rsBytes and lsBytes are dropped from the return and locals stacks before the jump,
+    // as nothing after the call will run on that path, and the frame is taken down.
+    // A call to C stays a call: once the frame is down rsp is aligned as our caller left it,
+    // which is not what C expects.
+    // The normal return sequence is still generated after it, for any labels bound in between.
+    static void genTailCall(const int rsBytes, const int lsBytes)
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genTailCall: Assembler not initialized");
+        }
+
+        auto& a = *jc.assembler;
+        if (!jc.optTailCall) return;
+
+        asmjit::BaseNode* node = a.cursor();
+        while (node != nullptr && (node->type() == asmjit::NodeType::kComment || node->isLabel() ||
+            (node->isInst() && node->as<asmjit::InstNode>()->id() == asmjit::x86::Inst::kIdNop)))
+        {
+            node = node->prev();
+        }
+        if (node == nullptr || !node->isInst()) return;
+
+        auto* call = node->as<asmjit::InstNode>();
+        if (call->id() != asmjit::x86::Inst::kIdCall || node == lastCCall) return;
+
+        asmjit::BaseNode* saved = a.setCursor(call->prev());
+        if (rsBytes > 0) a.add(asmjit::x86::r14, rsBytes);
+        if (lsBytes > 0) a.add(asmjit::x86::r13, lsBytes);
+        genRestoreFrame(a);
+        a.setCursor(saved);
+        call->setId(asmjit::x86::Inst::kIdJmp);
+    }
+
+
     // spit out a charachter
     static void genEmit()
     {
@@ -1619,10 +2145,7 @@ public:
         a.comment(" ; ----- gen_emit");
         popDS(asmjit::x86::rcx);
         preserveStackPointers();
-        // Allocate space for the shadow space
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(asmjit::imm(reinterpret_cast<void*>(prim_emit)));
-        a.add(asmjit::x86::rsp, 40);
+        genCCall(prim_emit, 1);
         restoreStackPointers();
     }
 
@@ -1636,16 +2159,21 @@ public:
         d.list_words();
     }
 
-    static void prim_forget()
+    // : sq dup * ; INLINE
+    static void markInline()
     {
-        d.forgetLastWord();
+        d.setInlineMode(INLINE_ALWAYS);
     }
 
-    static void* prim_sindex(size_t index)
+    // : big ... ; NOINLINE
+    static void markNoInline()
     {
-        auto address = strIntern.getStringAddress(index);
-        // printf("address: %p\n", address);
-        return address;
+        d.setInlineMode(INLINE_NEVER);
+    }
+
+    static void prim_forget()
+    {
+        d.forgetLastWord();
     }
 
 
@@ -1658,13 +2186,10 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_emit");
+        spillTOS();
 
         preserveStackPointers();
-        // Allocate space for the shadow space (32 bytes).
-        a.sub(asmjit::x86::rsp, 32);
-        a.call(asmjit::imm(reinterpret_cast<void*>(prim_forget)));
-        // Restore stack.
-        a.add(asmjit::x86::rsp, 32);
+        genCCall(prim_forget);
         restoreStackPointers();
     }
 
@@ -1689,11 +2214,7 @@ public:
         a.comment(" ; ----- gen_dot");
         popDS(asmjit::x86::rcx);
         preserveStackPointers();
-        // Allocate space for the shadow space (32 bytes).
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(asmjit::imm(reinterpret_cast<void*>(printDecimal)));
-        // Restore stack.
-        a.add(asmjit::x86::rsp, 40);
+        genCCall(printDecimal, 1);
         restoreStackPointers();
     }
 
@@ -1708,11 +2229,7 @@ public:
         a.comment(" ; ----- gen_dot");
         popDS(asmjit::x86::rcx);
         preserveStackPointers();
-        // Allocate space for the shadow space (32 bytes).
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(asmjit::imm(reinterpret_cast<void*>(printUnsignedHex)));
-        // Restore stack.
-        a.add(asmjit::x86::rsp, 40);
+        genCCall(printUnsignedHex, 1);
         restoreStackPointers();
     }
 
@@ -1739,13 +2256,10 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_emit");
+        spillTOS();
 
         preserveStackPointers();
-        // Allocate space for the shadow space (32 bytes).
-        a.sub(asmjit::x86::rsp, 32);
-        a.call(asmjit::imm(reinterpret_cast<void*>(prim_depth)));
-        // Restore stack.
-        a.add(asmjit::x86::rsp, 32);
+        genCCall(prim_depth);
         restoreStackPointers();
     }
 
@@ -1759,13 +2273,10 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_emit");
+        spillTOS();
 
         preserveStackPointers();
-        // Allocate space for the shadow space (32 bytes).
-        a.sub(asmjit::x86::rsp, 32);
-        a.call(asmjit::imm(reinterpret_cast<void*>(prim_depth2)));
-        // Restore stack.
-        a.add(asmjit::x86::rsp, 32);
+        genCCall(prim_depth2);
         restoreStackPointers();
     }
 
@@ -1847,56 +2358,343 @@ public:
         {
             throw std::runtime_error("end: Assembler not initialized");
         }
-        // Finalize the function
-        ForthFunction func;
-        if (const asmjit::Error err = jc.rt.add(&func, &jc.code))
+
+        auto& a = *jc.assembler;
+        removeUnusedFrame(a);
+        if (jc.optPeephole)
         {
-            throw std::runtime_error(asmjit::DebugUtils::errorAsString(err));
+            const int removed = JitPeephole::optimize(a, jc.batchOpen ? jc.batchWordStart : nullptr);
+            if (logging) std::cout << "; peephole removed " << removed << " instructions\n";
         }
 
-        return func;
-    }
-
-    // return a function after building a function around its generator fn
-    static ForthFunction build_forth(const ForthFunction fn)
-    {
-        if (logging) std::cout << "; building forth function ... \n";
-        if (!jc.assembler)
+        if (jc.batchOpen)
         {
-            throw std::runtime_error("build: Assembler not initialized");
+            // the word stays in the code holder until flushBatch
+            jc.batchWordOpen = false;
+            const auto placeholder = reinterpret_cast<ForthFunction>(batchLabels.size() + 1);
+            batchLabels.emplace(placeholder, jc.batchEntry);
+            return placeholder;
         }
-        genPrologue();
-        fn();
-        genEpilogue();
-        const ForthFunction new_func = endGeneration();
-        return new_func;
+
+        // Finalize the function
+        return reinterpret_cast<ForthFunction>(finishCode());
     }
 
-    static void genCall2(ForthFunction fn)
+    // serialize the nodes and place the code, noting any addresses in it for SAVE-IMAGE
+    static void* finishCode()
     {
-        if (!jc.assembler)
+        auto& a = *jc.assembler;
+        const auto marks = JitImage::markAddresses(a);
+
+        // Serialize the nodes into machine code
+        if (const asmjit::Error err = a.finalize())
         {
-            throw std::runtime_error("gen_call: Assembler not initialized");
+            throw std::runtime_error(asmjit::DebugUtils::errorAsString(err));
         }
-        auto& a = *jc.assembler;
 
-        a.comment(" ; ----- gen_call");
-        a.mov(asmjit::x86::rax, fn);
-        a.call(asmjit::x86::rax);
+        void* code = addCode();
+        if (jc.optArena)
+        {
+            JitImage::recordAddresses(jc.code, static_cast<uint8_t*>(code), jc.code.codeSize(), marks);
+        }
+        return code;
     }
 
-
-    static void genCall(ForthFunction fn)
+    // place the finished code, in the code arena unless it is switched off
+    static void* addCode()
     {
-        if (!jc.assembler)
+        if (jc.optArena)
         {
-            throw std::runtime_error("gen_call: Assembler not initialized");
+            return arena.add(jc.code);
         }
-        auto& a = *jc.assembler;
+
+        void* func;
+        if (const asmjit::Error err = jc.rt.add(&func, &jc.code))
+        {
+            throw std::runtime_error(asmjit::DebugUtils::errorAsString(err));
+        }
+        return func;
+    }
+
+    // batch compilation
+    // between beginBatch and endBatch every word is generated into the same code holder.
+    // flushBatch finalizes them with a single JitRuntime::add and replaces the placeholders
+    // in the dictionary with the real entry points, it must run before any of them is executed.
+    static void beginBatch()
+    {
+        flushBatch();
+        jc.batchMode = true;
+    }
+
+    static void endBatch()
+    {
+        flushBatch();
+        jc.batchMode = false;
+    }
+
+    // the function to run for fn, a word still waiting in the batch has only a placeholder
+    // so the batch is flushed first; fn must then be looked up again, which is an error here
+    static ForthFunction runnable(const ForthFunction fn)
+    {
+        if (batchLabels.contains(fn))
+        {
+            flushBatch();
+            throw std::runtime_error("a word was run before its batch was compiled");
+        }
+        return fn;
+    }
+
+    static void flushBatch()
+    {
+        if (!jc.batchOpen)
+        {
+            return;
+        }
+        // the next word starts a new code holder
+        jc.discardBatchWord();
+        jc.batchOpen = false;
+        if (batchLabels.empty())
+        {
+            return;
+        }
+
+        void* base;
+        try
+        {
+            base = finishCode();
+        }
+        catch (const std::exception&)
+        {
+            batchLabels.clear();
+            throw;
+        }
+        if (logging) std::cout << "; batch of " << batchLabels.size() << " words, " << jc.code.codeSize() << " bytes\n";
+
+        std::unordered_map<ForthFunction, ForthFunction> entries;
+        for (const auto& [placeholder, label] : batchLabels)
+        {
+            entries.emplace(placeholder, reinterpret_cast<ForthFunction>(
+                static_cast<char*>(base) + jc.code.labelOffsetFromBase(label)));
+        }
+        batchLabels.clear();
+
+        // the batch holds the newest words, stop once they have all been found
+        size_t remaining = entries.size();
+        for (ForthWord* word = d.getLatestWord(); word != nullptr && remaining > 0; word = word->link)
+        {
+            if (const auto it = entries.find(word->compiledFunc); it != entries.end())
+            {
+                word->compiledFunc = it->second;
+                --remaining;
+            }
+        }
+    }
+
+    // SAVE-IMAGE app.img
+    static void genSaveImage()
+    {
+        const auto& words = *jc.words;
+        const size_t pos = jc.pos_next_word + 1;
+        if (pos >= words.size())
+        {
+            throw std::runtime_error("SAVE-IMAGE: expected a file name");
+        }
+        flushBatch();
+        compileLazyWords();
+        JitImage::save(words[pos]);
+        jc.pos_last_word = pos;
+    }
+
+    // LOAD-IMAGE app.img, replaces the dictionary, the strings and the words
+    static void genLoadImage()
+    {
+        const auto& words = *jc.words;
+        const size_t pos = jc.pos_next_word + 1;
+        if (pos >= words.size())
+        {
+            throw std::runtime_error("LOAD-IMAGE: expected a file name");
+        }
+        flushBatch();
+        JitImage::load(words[pos]);
+        jc.pos_last_word = pos;
+    }
+
+    // an image named on the command line replaces the built in words and start.f
+    static bool loadStartupImage(const std::string& fileName)
+    {
+        try
+        {
+            JitImage::load(fileName);
+            jc.imageLoaded = true;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+        return jc.imageLoaded;
+    }
+
+    // lazy compilation (*LAZY ON)
+    // a colon definition in a loaded file is not compiled at ';', the word is given a stub.
+    // The first call to the stub compiles the word, points the dictionary and every caller
+    // at the new code, turns the stub into a jmp to it, and carries on into the word.
+    static ForthFunction genLazyStub(ForthWord* word, const WordCompiler compile)
+    {
+        asmjit::CodeHolder code;
+        code.init(jc.rt.environment());
+        asmjit::x86::Assembler a(&code);
+
+        const asmjit::Label entry = a.newLabel();
+        a.bind(entry);
+        // the first 5 bytes are overwritten with the jmp once the word is compiled
+        a.push(asmjit::x86::rbp);
+        a.mov(asmjit::x86::rbp, asmjit::x86::rsp);
+        // the register loop index and limit
+        a.push(asmjit::x86::rsi);
+        a.push(asmjit::x86::rdi);
+        a.and_(asmjit::x86::rsp, -16);
+        if (cShadowSpace != 0) a.sub(asmjit::x86::rsp, cShadowSpace);
+        a.mov(cArg(0), asmjit::imm(word));
+        a.lea(cArg(1), asmjit::x86::ptr(entry));
+        a.mov(asmjit::x86::rax, asmjit::imm(reinterpret_cast<void*>(lazyEntry)));
+        a.call(asmjit::x86::rax);
+        a.lea(asmjit::x86::rsp, asmjit::x86::ptr(asmjit::x86::rbp, -16));
+        a.pop(asmjit::x86::rdi);
+        a.pop(asmjit::x86::rsi);
+        a.pop(asmjit::x86::rbp);
+        a.jmp(asmjit::x86::rax);
+
+        // the stub is patched in place once the word is compiled, so it goes in the arena
+        const auto stub = reinterpret_cast<ForthFunction>(arena.add(code));
+        lazyStubs.emplace(stub, compile);
+        return stub;
+    }
+
+    // called by the stub, which has its own frame and can not be thrown through, so a failure
+    // is passed on to compileFailed, which the stub jumps to in place of the word
+    static ForthFunction lazyEntry(ForthWord* word, uint8_t* stub)
+    {
+        try
+        {
+            return compileLazyWord(word, stub);
+        }
+        catch (const std::exception& e)
+        {
+            compileError = "Lazy compile of " + std::string(word->name) + " failed: " + e.what();
+            return compileFailed;
+        }
+    }
+
+    // runs in place of a word that failed to compile, lazily or when it tiered up, and throws
+    // back to the interpreter as a primitive would; the next call tries again
+    static void compileFailed()
+    {
+        throw std::runtime_error(compileError);
+    }
+
+    static inline std::string compileError;
+
+    static ForthFunction compileLazyWord(ForthWord* word, uint8_t* stub)
+    {
+        const auto stubFunc = reinterpret_cast<ForthFunction>(stub);
+        const auto it = lazyStubs.find(stubFunc);
+        if (it == lazyStubs.end() || word->compiledFunc != stubFunc)
+        {
+            throw std::runtime_error("the word has been forgotten");
+        }
+
+        const ForthFunction fn = it->second(word);
+        lazyStubs.erase(it);
+        word->compiledFunc = fn;
+
+        // callers compiled since the stub was made call the word directly from now on
+        JitImage::retarget(reinterpret_cast<uint64_t>(stub), reinterpret_cast<uint64_t>(fn));
+
+        // anything else, such as an execution token, goes through the stub to the word
+        const int64_t displacement = reinterpret_cast<int64_t>(fn) - reinterpret_cast<int64_t>(stub + 5);
+        if (displacement >= INT32_MIN && displacement <= INT32_MAX)
+        {
+            const auto rel = static_cast<int32_t>(displacement);
+            JitArena::Writable writable(stub, 5);
+            stub[0] = 0xE9;
+            std::memcpy(stub + 1, &rel, 4);
+        }
+        return fn;
+    }
+
+    // compile every word still waiting for its first call, images only hold compiled code
+    static void compileLazyWords()
+    {
+        for (ForthWord* word = d.getLatestWord(); word != nullptr && !lazyStubs.empty(); word = word->link)
+        {
+            if (lazyStubs.contains(word->compiledFunc))
+            {
+                compileLazyWord(word, reinterpret_cast<uint8_t*>(word->compiledFunc));
+            }
+        }
+        // the stubs of forgotten words
+        lazyStubs.clear();
+    }
+
+    // return a function after building a function around its generator fn
+    static ForthFunction build_forth(const ForthFunction fn)
+    {
+        if (logging) std::cout << "; building forth function ... \n";
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("build: Assembler not initialized");
+        }
+        genPrologue();
+        fn();
+        genEpilogue();
+        const ForthFunction new_func = endGeneration();
+        return new_func;
+    }
+
+    static void genCall2(ForthFunction fn)
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("gen_call: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
 
         a.comment(" ; ----- gen_call");
+        spillTOS();
+        if (const auto it = batchLabels.find(fn); it != batchLabels.end())
+        {
+            a.call(it->second);
+            return;
+        }
+        // words in the code arena are always in reach of a direct call
+        if (arena.contains(reinterpret_cast<const void*>(fn)))
+        {
+            callAddress(a, fn);
+            return;
+        }
+        movAddress(a, asmjit::x86::rax, reinterpret_cast<void*>(fn));
+        a.call(asmjit::x86::rax);
+    }
+
+
+    static void genCall(ForthFunction fn)
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("gen_call: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
 
-        a.call(asmjit::imm(fn));
+        a.comment(" ; ----- gen_call");
+        spillTOS();
+
+        // a word from the same batch is called through its entry label
+        if (const auto it = batchLabels.find(fn); it != batchLabels.end())
+        {
+            a.call(it->second);
+            return;
+        }
+        callAddress(a, fn);
     }
 
     // Executable function pointer
@@ -1952,6 +2750,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_toR");
+        spillTOS();
 
         asmjit::x86::Gp value = asmjit::x86::r8; // Temporary register for value
 
@@ -1975,6 +2774,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_rFrom");
+        spillTOS();
 
         asmjit::x86::Gp value = asmjit::x86::r8; // Temporary register for value
 
@@ -1999,6 +2799,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_rFetch");
+        spillTOS();
 
         asmjit::x86::Gp value = asmjit::x86::r8; // Temporary register for value
 
@@ -2022,6 +2823,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_rpFetch");
+        spillTOS();
 
         asmjit::x86::Gp rsPointer = asmjit::x86::r8; // Temporary register for RS pointer
 
@@ -2042,6 +2844,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_spFetch");
+        spillTOS();
 
         asmjit::x86::Gp dsPointer = asmjit::x86::r8; // Temporary register for DS pointer
 
@@ -2062,6 +2865,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_spStore");
+        spillTOS();
 
         asmjit::x86::Gp newDsPointer = asmjit::x86::r8; // Temporary register for new DS pointer
 
@@ -2085,6 +2889,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_rpStore");
+        spillTOS();
 
         asmjit::x86::Gp newRsPointer = asmjit::x86::r8; // Temporary register for new RS pointer
 
@@ -2124,6 +2929,539 @@ public:
         storeFromDS();
     }
 
+    // bulk memory
+    // MOVE ( src dst u -- )        copies u bytes, the areas may overlap
+    // CMOVE ( src dst u -- )       copies u bytes one at a time from the lowest address up
+    // FILL ( addr u char -- )      sets u bytes to char
+    // ERASE ( addr u -- )          sets u bytes to zero
+    // COMPARE ( a1 u1 a2 u2 -- n ) -1, 0 or 1 as the first string is below, equal to or above the second
+    //
+    // When the length is a literal, knownLengths rewrites `64 MOVE` as `[MOVE] 64`, and the
+    // copy or fill is generated in line for that length.  Otherwise MOVE and COMPARE call a
+    // routine, and CMOVE, FILL and ERASE use rep movsb and rep stosb.
+
+    // the longest FILL generated in line, a MOVE is generated in line if it fits in four vectors
+    static constexpr uint64_t inlineFillMax = 256;
+
+    static uint64_t inlineMoveMax()
+    {
+        return jc.simdAVX2 ? 128 : 64;
+    }
+
+    static void prim_move(const uint8_t* src, uint8_t* dst, const uint64_t u)
+    {
+        std::memmove(dst, src, u);
+    }
+
+    static int64_t prim_compare(const uint8_t* a1, const uint64_t u1, const uint8_t* a2, const uint64_t u2)
+    {
+        const int r = std::memcmp(a1, a2, std::min(u1, u2));
+        if (r != 0) return r < 0 ? -1 : 1;
+        if (u1 == u2) return 0;
+        return u1 < u2 ? -1 : 1;
+    }
+
+    // the pieces that cover u bytes with loads or stores of width bytes, the last one may overlap
+    static std::vector<int32_t> bulkPieces(const uint64_t u, const uint64_t width)
+    {
+        std::vector<int32_t> offsets;
+        for (uint64_t offset = 0; offset + width <= u; offset += width)
+        {
+            offsets.push_back(static_cast<int32_t>(offset));
+        }
+        if (offsets.empty() || static_cast<uint64_t>(offsets.back()) + width < u)
+        {
+            offsets.push_back(static_cast<int32_t>(u - width));
+        }
+        return offsets;
+    }
+
+    // the widest piece, up to a vector, that is not longer than u
+    static uint64_t bulkWidth(const uint64_t u)
+    {
+        const uint64_t vector = jc.simdAVX2 ? 32 : 16;
+        uint64_t width = vector;
+        while (width > u) width /= 2;
+        return width;
+    }
+
+    // copy u bytes from [src] to [dst], every load comes before the first store so overlap is safe
+    static void genSmallMove(const asmjit::x86::Gp& src, const asmjit::x86::Gp& dst, const uint64_t u)
+    {
+        using namespace asmjit::x86;
+        auto& a = *jc.assembler;
+        if (u == 0) return;
+
+        const uint64_t width = bulkWidth(u);
+        const std::vector<int32_t> offsets = bulkPieces(u, width);
+        static const Gp gps[] = {r8, r9, r11, rax};
+        for (size_t i = 0; i < offsets.size(); ++i)
+        {
+            const int32_t offset = offsets[i];
+            if (width == 32) a.vmovdqu(ymm(static_cast<uint32_t>(i)), ymmword_ptr(src, offset));
+            else if (width == 16) a.movdqu(xmm(static_cast<uint32_t>(i)), xmmword_ptr(src, offset));
+            else if (width == 8) a.mov(gps[i], qword_ptr(src, offset));
+            else if (width == 4) a.mov(gps[i].r32(), dword_ptr(src, offset));
+            else if (width == 2) a.movzx(gps[i].r32(), word_ptr(src, offset));
+            else a.movzx(gps[i].r32(), byte_ptr(src, offset));
+        }
+        for (size_t i = 0; i < offsets.size(); ++i)
+        {
+            const int32_t offset = offsets[i];
+            if (width == 32) a.vmovdqu(ymmword_ptr(dst, offset), ymm(static_cast<uint32_t>(i)));
+            else if (width == 16) a.movdqu(xmmword_ptr(dst, offset), xmm(static_cast<uint32_t>(i)));
+            else if (width == 8) a.mov(qword_ptr(dst, offset), gps[i]);
+            else if (width == 4) a.mov(dword_ptr(dst, offset), gps[i].r32());
+            else if (width == 2) a.mov(word_ptr(dst, offset), gps[i].r16());
+            else a.mov(byte_ptr(dst, offset), gps[i].r8());
+        }
+        if (width == 32) a.vzeroupper();
+    }
+
+    // set u bytes at [dst] to c
+    static void genSmallFill(const asmjit::x86::Gp& dst, const uint64_t u, const uint8_t c)
+    {
+        using namespace asmjit::x86;
+        auto& a = *jc.assembler;
+        if (u == 0) return;
+
+        const uint64_t width = bulkWidth(u);
+        a.mov(rax, 0x0101010101010101ull * c);
+        if (width == 32)
+        {
+            a.movq(xmm0, rax);
+            a.vpbroadcastq(ymm0, xmm0);
+        }
+        else if (width == 16)
+        {
+            a.movq(xmm0, rax);
+            a.punpcklqdq(xmm0, xmm0);
+        }
+        for (const int32_t offset : bulkPieces(u, width))
+        {
+            if (width == 32) a.vmovdqu(ymmword_ptr(dst, offset), ymm0);
+            else if (width == 16) a.movdqu(xmmword_ptr(dst, offset), xmm0);
+            else if (width == 8) a.mov(qword_ptr(dst, offset), rax);
+            else if (width == 4) a.mov(dword_ptr(dst, offset), eax);
+            else if (width == 2) a.mov(word_ptr(dst, offset), ax);
+            else a.mov(byte_ptr(dst, offset), al);
+        }
+        if (width == 32) a.vzeroupper();
+    }
+
+    // rep movsb or rep stosb, rsi and rdi may hold a register loop so they are saved
+    static void genRepString(const bool store)
+    {
+        using namespace asmjit::x86;
+        auto& a = *jc.assembler;
+        a.push(rsi);
+        a.push(rdi);
+        a.mov(rdi, rdx);
+        if (store)
+        {
+            a.rep(rcx).stosb();
+        }
+        else
+        {
+            a.mov(rsi, r9);
+            a.rep(rcx).movsb();
+        }
+        a.pop(rdi);
+        a.pop(rsi);
+    }
+
+    // call prim_move with rcx = src, rdx = dst, r8 = u
+    static void genCallMove()
+    {
+        auto& a = *jc.assembler;
+        genCCall(prim_move, 3);
+    }
+
+    static void genMove()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genMove: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- genMove");
+        popDS(asmjit::x86::r8);
+        popDS(asmjit::x86::rdx);
+        popDS(asmjit::x86::rcx);
+        genCallMove();
+    }
+
+    static void genCMove()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genCMove: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- genCMove");
+        popDS(asmjit::x86::rcx);
+        popDS(asmjit::x86::rdx);
+        popDS(asmjit::x86::r9);
+        genRepString(false);
+    }
+
+    static void genFill()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genFill: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- genFill");
+        popDS(asmjit::x86::rax);
+        popDS(asmjit::x86::rcx);
+        popDS(asmjit::x86::rdx);
+        genRepString(true);
+    }
+
+    static void genErase()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genErase: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- genErase");
+        popDS(asmjit::x86::rcx);
+        popDS(asmjit::x86::rdx);
+        a.xor_(asmjit::x86::eax, asmjit::x86::eax);
+        genRepString(true);
+    }
+
+    static void genCompare()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genCompare: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- genCompare");
+        popDS(asmjit::x86::r9);
+        popDS(asmjit::x86::r8);
+        popDS(asmjit::x86::rdx);
+        popDS(asmjit::x86::rcx);
+        genCCall(prim_compare, 4);
+        pushDS(asmjit::x86::rax);
+    }
+
+    // the literals after the MOVE, ERASE and FILL instructions
+    static uint64_t knownLength(const size_t pos)
+    {
+        int64_t value = 0;
+        if (jc.words == nullptr || pos >= jc.words->size() || !caseLiteral((*jc.words)[pos], value))
+        {
+            throw std::runtime_error("Bulk memory word: literal expected");
+        }
+        jc.pos_last_word = pos;
+        return static_cast<uint64_t>(value);
+    }
+
+    // [MOVE] u ( src dst -- )
+    static void genKnownMove()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genKnownMove: Assembler not initialized");
+        }
+        expectTag(TokenTag::MOVE);
+        auto& a = *jc.assembler;
+        const uint64_t u = knownLength(jc.pos_next_word + 1);
+        a.comment(" ; ----- genKnownMove");
+        popDS(asmjit::x86::rdx);
+        popDS(asmjit::x86::rcx);
+        if (u <= inlineMoveMax())
+        {
+            genSmallMove(asmjit::x86::rcx, asmjit::x86::rdx, u);
+            return;
+        }
+        a.mov(asmjit::x86::r8, u);
+        genCallMove();
+    }
+
+    // [FILL] u char ( addr -- ), [ERASE] u ( addr -- )
+    static void genKnownFill(const uint64_t u, const uint8_t c)
+    {
+        auto& a = *jc.assembler;
+        popDS(asmjit::x86::rdx);
+        if (u <= inlineFillMax)
+        {
+            genSmallFill(asmjit::x86::rdx, u, c);
+            return;
+        }
+        a.mov(asmjit::x86::rcx, u);
+        a.mov(asmjit::x86::eax, c);
+        genRepString(true);
+    }
+
+    static void genKnownFill()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genKnownFill: Assembler not initialized");
+        }
+        expectTag(TokenTag::FILL);
+        const uint64_t u = knownLength(jc.pos_next_word + 1);
+        const uint64_t c = knownLength(jc.pos_next_word + 2);
+        jc.assembler->comment(" ; ----- genKnownFill");
+        genKnownFill(u, static_cast<uint8_t>(c));
+    }
+
+    static void genKnownErase()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genKnownErase: Assembler not initialized");
+        }
+        expectTag(TokenTag::ERASE);
+        const uint64_t u = knownLength(jc.pos_next_word + 1);
+        jc.assembler->comment(" ; ----- genKnownErase");
+        genKnownFill(u, 0);
+    }
+
+    // narrow memory access
+    // C@ W@ L@ fetch 1, 2 and 4 bytes and zero extend them, C! W! L! store the low 1, 2 and 4 bytes.
+    // +! ( n addr -- ) adds n to the cell at addr.
+    //
+    // fuseAddresses rewrites an address calculation followed by one of these words, or @ and !,
+    // so that the calculation becomes the addressing mode of the access:
+    //   addr 16 + @          becomes  addr [DISP] 16 @        mov rax, [rcx+16]
+    //   addr i CELLS + @     becomes  addr i [INDEX] 8 @      mov rax, [rcx+rdx*8]
+
+    enum class MemoryOp { FETCH, STORE, ADD };
+
+    struct MemoryAccess
+    {
+        MemoryOp op;
+        uint32_t width;
+    };
+
+    // the access a word makes, false if it is not a memory access word
+    static bool memoryAccess(const ForthFunction gen, MemoryAccess& access)
+    {
+        if (gen == nullptr) return false;
+        if (gen == genAT) access = {MemoryOp::FETCH, 8};
+        else if (gen == genStore) access = {MemoryOp::STORE, 8};
+        else if (gen == genPlusStore) access = {MemoryOp::ADD, 8};
+        else if (gen == genCFetch) access = {MemoryOp::FETCH, 1};
+        else if (gen == genCStore) access = {MemoryOp::STORE, 1};
+        else if (gen == genWFetch) access = {MemoryOp::FETCH, 2};
+        else if (gen == genWStore) access = {MemoryOp::STORE, 2};
+        else if (gen == genLFetch) access = {MemoryOp::FETCH, 4};
+        else if (gen == genLStore) access = {MemoryOp::STORE, 4};
+        else return false;
+        return true;
+    }
+
+    // the scale of an index word, 0 if the word does not scale
+    static uint32_t indexScale(const ForthFunction gen)
+    {
+        if (gen == gen2mul) return 2;
+        if (gen == gen4mul) return 4;
+        if (gen == gen8mul) return 8;
+        return 0;
+    }
+
+    // the access itself, with the address in m, the value of a store is popped here
+    static void genMemoryAccess(const MemoryAccess& access, const asmjit::x86::Mem& m)
+    {
+        using namespace asmjit::x86;
+        auto& a = *jc.assembler;
+        if (access.op == MemoryOp::FETCH)
+        {
+            if (access.width == 8) a.mov(rax, m);
+            else if (access.width == 4) a.mov(eax, m);
+            else a.movzx(eax, m);
+            pushDS(rax);
+            return;
+        }
+
+        popDS(rax);
+        if (access.op == MemoryOp::ADD) a.add(m, rax);
+        else if (access.width == 8) a.mov(m, rax);
+        else if (access.width == 4) a.mov(m, eax);
+        else if (access.width == 2) a.mov(m, ax);
+        else a.mov(m, al);
+    }
+
+    static void genAccess(const MemoryAccess& access)
+    {
+        popDS(asmjit::x86::rcx);
+        genMemoryAccess(access, asmjit::x86::ptr(asmjit::x86::rcx, 0, access.width));
+    }
+
+    static void genCFetch()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genCFetch: Assembler not initialized");
+        }
+        jc.assembler->comment(" ; ----- genCFetch");
+        genAccess({MemoryOp::FETCH, 1});
+    }
+
+    static void genCStore()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genCStore: Assembler not initialized");
+        }
+        jc.assembler->comment(" ; ----- genCStore");
+        genAccess({MemoryOp::STORE, 1});
+    }
+
+    static void genWFetch()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genWFetch: Assembler not initialized");
+        }
+        jc.assembler->comment(" ; ----- genWFetch");
+        genAccess({MemoryOp::FETCH, 2});
+    }
+
+    static void genWStore()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genWStore: Assembler not initialized");
+        }
+        jc.assembler->comment(" ; ----- genWStore");
+        genAccess({MemoryOp::STORE, 2});
+    }
+
+    static void genLFetch()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genLFetch: Assembler not initialized");
+        }
+        jc.assembler->comment(" ; ----- genLFetch");
+        genAccess({MemoryOp::FETCH, 4});
+    }
+
+    static void genLStore()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genLStore: Assembler not initialized");
+        }
+        jc.assembler->comment(" ; ----- genLStore");
+        genAccess({MemoryOp::STORE, 4});
+    }
+
+    static void genPlusStore()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genPlusStore: Assembler not initialized");
+        }
+        jc.assembler->comment(" ; ----- genPlusStore");
+        genAccess({MemoryOp::ADD, 8});
+    }
+
+    // the literal and the memory access word after the DISP or INDEX instruction
+    static MemoryAccess fusedAccess(const TokenTag tag, int64_t& value)
+    {
+        const std::string name = tagName(tag) + 1;
+        if (jc.words == nullptr)
+        {
+            throw std::runtime_error(name + ": no words to compile");
+        }
+        expectTag(tag);
+        const auto& words = *jc.words;
+        const size_t pos = jc.pos_next_word + 1;
+        if (pos + 1 >= words.size() || !caseLiteral(words[pos], value))
+        {
+            throw std::runtime_error(name + ": literal expected");
+        }
+        const ForthWord* word = d.findWord(words[pos + 1].c_str());
+        MemoryAccess access{};
+        if (word == nullptr || !memoryAccess(word->generatorFunc, access))
+        {
+            throw std::runtime_error(name + ": memory access word expected");
+        }
+        jc.pos_last_word = pos + 1;
+        return access;
+    }
+
+    // [DISP] n word ( addr -- ), the access is made at addr+n
+    static void genDisplaced()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genDisplaced: Assembler not initialized");
+        }
+        int64_t disp = 0;
+        const MemoryAccess access = fusedAccess(TokenTag::DISP, disp);
+        if (!asmjit::Support::isInt32(disp))
+        {
+            throw std::runtime_error("DISP: displacement out of range");
+        }
+        jc.assembler->comment(" ; ----- genDisplaced");
+        popDS(asmjit::x86::rcx);
+        genMemoryAccess(access, asmjit::x86::ptr(asmjit::x86::rcx, static_cast<int32_t>(disp), access.width));
+    }
+
+    // [INDEX] scale word ( addr i -- ), the access is made at addr+i*scale
+    static void genIndexed()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genIndexed: Assembler not initialized");
+        }
+        int64_t scale = 0;
+        const MemoryAccess access = fusedAccess(TokenTag::INDEX, scale);
+        if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+        {
+            throw std::runtime_error("INDEX: scale must be 1, 2, 4 or 8");
+        }
+        jc.assembler->comment(" ; ----- genIndexed");
+        popDS(asmjit::x86::rdx);
+        popDS(asmjit::x86::rcx);
+        const auto shift = static_cast<uint32_t>(std::countr_zero(static_cast<uint64_t>(scale)));
+        genMemoryAccess(access, asmjit::x86::ptr(asmjit::x86::rcx, asmjit::x86::rdx, shift, 0, access.width));
+    }
+
+
+
+    // register loops
+    // The innermost DO loop of a word keeps its index in rsi and its limit in rdi,
+    // when the loop body is simple enough.
+    // The two return stack cells DO always takes are used to save the callers rsi and rdi,
+    // which keeps J, K, LEAVE and the EXIT bookkeeping the same for both kinds of loop.
+    // The body must not contain another DO, calls to compiled words, return stack words or EXIT.
+    static bool canUseRegisterLoop()
+    {
+        if (!jc.optRegisterLoops || jc.words == nullptr) return false;
+
+        const auto& words = *jc.words;
+        for (size_t pos = jc.pos_next_word + 1; pos < words.size(); ++pos)
+        {
+            const std::string word = to_lower(words[pos]);
+            if (word == "loop" || word == "+loop") return true;
+            if (word == "do" || word == ">r" || word == "r>" || word == "r@" || word == "rp@" ||
+                word == "rp!" || word == "exit" || word == "recurse" || word == "{")
+                return false;
+
+            // words that read the following token
+            if (readsNextToken(word))
+            {
+                ++pos;
+                continue;
+            }
+
+            // numbers and locals are fine, and so is anything generated inline
+            const ForthWord* fword = d.findWord(word.c_str());
+            if (fword != nullptr && fword->generatorFunc == nullptr && fword->immediateFunc == nullptr)
+                return false;
+        }
+        return false;
+    }
 
     static void genDo()
     {
@@ -2142,9 +3480,22 @@ public:
         popDS(currentIndex);
         popDS(limit);
 
-        // Push current index and limit onto the return stack
-        pushRS(limit);
-        pushRS(currentIndex);
+        const bool inRegisters = canUseRegisterLoop();
+        if (inRegisters)
+        {
+            a.comment(" ; save rsi and rdi, index in rsi and limit in rdi");
+            pushRS(asmjit::x86::rdi);
+            pushRS(asmjit::x86::rsi);
+            a.mov(asmjit::x86::rsi, currentIndex);
+            a.mov(asmjit::x86::rdi, limit);
+            registerLoopDepth++;
+        }
+        else
+        {
+            // Push current index and limit onto the return stack
+            pushRS(limit);
+            pushRS(currentIndex);
+        }
 
         // Increment the DO loop depth counter
         doLoopDepth++;
@@ -2158,6 +3509,7 @@ public:
         doLoopLabel.loopLabel = a.newLabel();
         doLoopLabel.leaveLabel = a.newLabel();
         doLoopLabel.hasLeave = false;
+        doLoopLabel.inRegisters = inRegisters;
         a.bind(doLoopLabel.doLabel);
 
         // Create a LoopLabel struct and push it onto the unified loopStack
@@ -2168,6 +3520,23 @@ public:
         loopStack.push(loopLabel);
     }
 
+    // the end of a register loop, restore the callers rsi and rdi
+    static void genEndRegisterLoop(const DoLoopLabel& loopLabel)
+    {
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- LEAVE and loop label");
+        a.bind(loopLabel.loopLabel);
+        a.bind(loopLabel.leaveLabel);
+
+        a.comment(" ; ----- restore rsi and rdi");
+        popRS(asmjit::x86::rsi);
+        popRS(asmjit::x86::rdi);
+        registerLoopDepth--;
+
+        // Decrement the DO loop depth counter
+        doLoopDepth--;
+    }
+
 
     static void genLoop()
     {
@@ -2190,10 +3559,22 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_loop");
+        spillTOS();
         a.nop();
 
+        genTierCount(a);
         genLeaveLoopOnEscapeKey(a, loopLabel);
 
+        if (loopLabel.inRegisters)
+        {
+            a.comment(" ; Increment index (rsi) and loop while less than the limit (rdi)");
+            a.add(asmjit::x86::rsi, 1);
+            a.cmp(asmjit::x86::rsi, asmjit::x86::rdi);
+            a.jl(loopLabel.doLabel);
+            genEndRegisterLoop(loopLabel);
+            return;
+        }
+
         asmjit::x86::Gp currentIndex = asmjit::x86::rcx; // Current index
         asmjit::x86::Gp limit = asmjit::x86::rdx; // Limit
         a.nop(); // no-op
@@ -2254,14 +3635,36 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_plus_loop");
+        spillTOS();
 
         asmjit::x86::Gp currentIndex = asmjit::x86::rcx; // Current index
         asmjit::x86::Gp limit = asmjit::x86::rdx; // Limit
-        asmjit::x86::Gp increment = asmjit::x86::rsi; // Increment value
+        asmjit::x86::Gp increment = asmjit::x86::r8; // Increment value
 
+        genTierCount(a);
         genLeaveLoopOnEscapeKey(a, loopLabel);
         a.nop(); // no-op
 
+        if (loopLabel.inRegisters)
+        {
+            a.comment(" ; Add increment to index (rsi), the limit is in rdi");
+            popDS(increment);
+            a.add(asmjit::x86::rsi, increment);
+            asmjit::Label positiveIncrement = a.newLabel();
+            asmjit::Label loopEnd = a.newLabel();
+            a.cmp(increment, 0);
+            a.jg(positiveIncrement);
+            a.cmp(asmjit::x86::rsi, asmjit::x86::rdi);
+            a.jge(loopLabel.doLabel);
+            a.jmp(loopEnd);
+            a.bind(positiveIncrement);
+            a.cmp(asmjit::x86::rsi, asmjit::x86::rdi);
+            a.jl(loopLabel.doLabel);
+            a.bind(loopEnd);
+            genEndRegisterLoop(loopLabel);
+            return;
+        }
+
         // Pop current index and limit from return stack
         a.comment(" ; Pop current index and limit from return stack");
         popRS(currentIndex);
@@ -2333,6 +3736,13 @@ public:
             throw std::runtime_error("gen_I: No matching DO_LOOP structure on the stack");
         }
 
+        if (innermostDoLoop().inRegisters)
+        {
+            a.comment(" ; index is in rsi");
+            pushDS(asmjit::x86::rsi);
+            return;
+        }
+
         // Temporary register to hold the current index
         asmjit::x86::Gp currentIndex = asmjit::x86::rcx;
 
@@ -2408,6 +3818,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_leave");
+        spillTOS();
         a.nop();
 
         if (loopStack.empty())
@@ -2480,6 +3891,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_begin");
+        spillTOS();
         a.nop();
 
         BeginAgainRepeatUntilLabel beginLabel;
@@ -2498,7 +3910,7 @@ public:
     }
 
 
-    static void genLeaveAgainOnEscapeKey(asmjit::x86::Assembler& a, const BeginAgainRepeatUntilLabel& beginLabels)
+    static void genLeaveAgainOnEscapeKey(asmjit::x86::Builder& a, const BeginAgainRepeatUntilLabel& beginLabels)
     {
         // optionally generate code to check for escape key pressed
         if (jc.optLoopCheck)
@@ -2507,9 +3919,7 @@ public:
             // shadow stack
             a.comment("; -- check for escape key and leave if pressed");
             a.push(asmjit::x86::rax);
-            a.sub(asmjit::x86::rsp, 40);
-            a.call(escapePressed);
-            a.add(asmjit::x86::rsp, 40);
+            genCCall(escapePressed, 0, 8);
             // compare rax with 0
             a.cmp(asmjit::x86::rax, 0);
             a.pop(asmjit::x86::rax);
@@ -2519,7 +3929,7 @@ public:
     }
 
 
-    static void genLeaveLoopOnEscapeKey(asmjit::x86::Assembler& a, const DoLoopLabel& l)
+    static void genLeaveLoopOnEscapeKey(asmjit::x86::Builder& a, const DoLoopLabel& l)
     {
         // optionally generate code to check for escape key pressed
         if (jc.optLoopCheck)
@@ -2528,9 +3938,7 @@ public:
             // shadow stack
             a.comment("; -- check for escape key and leave if pressed");
             a.push(asmjit::x86::rax);
-            a.sub(asmjit::x86::rsp, 40);
-            a.call(escapePressed);
-            a.add(asmjit::x86::rsp, 40);
+            genCCall(escapePressed, 0, 8);
             // compare rax with 0
             a.cmp(asmjit::x86::rax, 0);
             a.pop(asmjit::x86::rax);
@@ -2540,6 +3948,97 @@ public:
     }
 
 
+    // tiered compilation (*TIERED ON)
+    // the next word generated gets a counter, compile recompiles it with the optimizations once it is hot
+    static void beginTierCounting(const WordCompiler compile)
+    {
+        tierCompiler = compile;
+        tierCountNext = true;
+    }
+
+    // word is the word just compiled, or nullptr if it failed
+    static void endTierCounting(const ForthWord* word)
+    {
+        if (tierCounter != nullptr && word != nullptr)
+        {
+            tierCounter->wordOffset = reinterpret_cast<const char*>(word) - reinterpret_cast<char*>(tierCounter);
+        }
+        tierCounter = nullptr;
+        tierCountNext = false;
+    }
+
+    static void startTierCounter()
+    {
+        tierCountNext = false;
+        d.allot((sizeof(int64_t) - d.getCurrentPos() % sizeof(int64_t)) % sizeof(int64_t));
+        tierCounter = reinterpret_cast<TierCounter*>(d.getCurrentLocation());
+        d.allot(sizeof(TierCounter));
+        tierCounter->count = static_cast<int64_t>(jc.tierThreshold);
+        tierCounter->wordOffset = 0;
+    }
+
+    // at the entry and at each loop back edge, nothing but the Forth registers is live here
+    static void genTierCount(asmjit::x86::Builder& a)
+    {
+        if (tierCounter == nullptr) return;
+
+        a.comment(" ; ----- tier count");
+        const asmjit::Label warm = a.newLabel();
+        movAddress(a, asmjit::x86::rax, tierCounter);
+        a.sub(asmjit::x86::qword_ptr(asmjit::x86::rax), 1);
+        a.jnz(warm);
+        // the register loop index and limit
+        a.push(asmjit::x86::rsi);
+        a.push(asmjit::x86::rdi);
+        a.push(asmjit::x86::rbp);
+        a.mov(asmjit::x86::rbp, asmjit::x86::rsp);
+        a.and_(asmjit::x86::rsp, -16);
+        if (cShadowSpace != 0) a.sub(asmjit::x86::rsp, cShadowSpace);
+        a.mov(cArg(0), asmjit::x86::rax);
+        movAddress(a, cArg(1), reinterpret_cast<void*>(tierCompiler));
+        movAddress(a, asmjit::x86::rax, reinterpret_cast<void*>(tierUp));
+        a.call(asmjit::x86::rax);
+        // a failed recompile is thrown back to the interpreter
+        const asmjit::Label compiled = a.newLabel();
+        a.test(asmjit::x86::rax, asmjit::x86::rax);
+        a.jz(compiled);
+        a.call(asmjit::x86::rax);
+        a.bind(compiled);
+        a.mov(asmjit::x86::rsp, asmjit::x86::rbp);
+        a.pop(asmjit::x86::rbp);
+        a.pop(asmjit::x86::rdi);
+        a.pop(asmjit::x86::rsi);
+        a.bind(warm);
+    }
+
+    // called when a counter runs out, the running baseline code carries on,
+    // the dictionary and the callers move to the optimized code for the next call
+    // returns nullptr, or compileFailed for the counting code to call if the recompile failed
+    static ForthFunction tierUp(TierCounter* counter, const WordCompiler compile)
+    {
+        // the counter is retired for good, the baseline code that called us carries on counting it
+        counter->count = INT64_MAX;
+        if (counter->wordOffset == 0 || compile == nullptr) return nullptr;
+
+        auto* word = reinterpret_cast<ForthWord*>(reinterpret_cast<char*>(counter) + counter->wordOffset);
+        const ForthFunction baseline = word->compiledFunc;
+        try
+        {
+            const ForthFunction fn = compile(word);
+            JitImage::retarget(reinterpret_cast<uint64_t>(baseline), reinterpret_cast<uint64_t>(fn));
+            if (logging) std::cout << "; recompiled hot word " << word->name << std::endl;
+            return nullptr;
+        }
+        catch (const std::exception& e)
+        {
+            // the word tries again once it has run as many times again
+            counter->count = static_cast<int64_t>(jc.tierThreshold);
+            compileError = "Recompile of " + std::string(word->name) + " failed: " + e.what();
+            return compileFailed;
+        }
+    }
+
+
     static void genAgain()
     {
         if (!jc.assembler)
@@ -2554,11 +4053,13 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_again");
+        spillTOS();
         a.nop();
 
         auto beginLabels = std::get<BeginAgainRepeatUntilLabel>(loopStack.top().label);
         loopStack.pop();
 
+        genTierCount(a);
         genLeaveAgainOnEscapeKey(a, beginLabels);
         beginLabels.againLabel = a.newLabel();
         a.jmp(beginLabels.beginLabel);
@@ -2590,11 +4091,13 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_repeat");
+        spillTOS();
         a.nop();
 
         auto beginLabels = std::get<BeginAgainRepeatUntilLabel>(loopStack.top().label);
         loopStack.pop();
 
+        genTierCount(a);
         genLeaveAgainOnEscapeKey(a, beginLabels);
         beginLabels.repeatLabel = a.newLabel();
         a.jmp(beginLabels.beginLabel);
@@ -2627,6 +4130,7 @@ public:
         // Get the label from the unified stack
         const auto& beginLabels = std::get<BeginAgainRepeatUntilLabel>(loopStack.top().label);
 
+        genTierCount(a);
         asmjit::x86::Gp topOfStack = asmjit::x86::rax;
         popDS(topOfStack);
         genLeaveAgainOnEscapeKey(a, beginLabels);
@@ -2685,20 +4189,15 @@ public:
         auto& a = *jc.assembler;
 
         // Look for the current function's entry label on the loop stack
-        if (!loopStack.empty() && loopStack.top().type == FUNCTION_ENTRY_EXIT)
-        {
-            auto functionLabels = std::get<FunctionEntryExitLabel>(loopStack.top().label);
+        const auto labels = functionLabels();
 
-            a.comment(" ; ----- gen_recurse");
-            a.nop();
+        a.comment(" ; ----- gen_recurse");
+        a.nop();
+        spillTOS();
 
-            // Generate a call to the entry label (self-recursion)
-            a.call(functionLabels.entryLabel);
-        }
-        else
-        {
-            throw std::runtime_error("genRecurse: No matching FUNCTION_ENTRY_EXIT structure on the stack");
-        }
+        // Generate a call to the entry label (self-recursion)
+        // genEpilogue and genExit turn it into a jump when it is in tail position
+        a.call(labels.entryLabel);
     }
 
     static void genIf()
@@ -2745,6 +4244,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen_else");
+        spillTOS();
         a.nop();
 
         if (!loopStack.empty() && loopStack.top().type == IF_THEN_ELSE)
@@ -2774,6 +4274,7 @@ public:
         }
 
         auto& a = *jc.assembler;
+        spillTOS();
 
         if (!loopStack.empty() && loopStack.top().type == IF_THEN_ELSE)
         {
@@ -2851,7 +4352,177 @@ public:
     //   End
     //
 
-    // case of endof endcase Implementation
+    // case of endof endcase Implementation
+
+    // a CASE with at least this many arms, spread over at most twice as many values, uses a jump table
+    static constexpr size_t caseTableMinArms = 4;
+    static constexpr uint64_t caseTableMaxRange = 1024;
+
+    // a literal OF selector, numbers and the built in constants named by their value
+    static bool caseLiteral(const std::string& word, int64_t& value)
+    {
+        if (!is_number(word) || is_float(word)) return false;
+        const ForthWord* fword = d.findWord(word.c_str());
+        if (fword != nullptr && (fword->type != ForthWordType::CONSTANT || fword->generatorFunc == nullptr))
+            return false;
+        try
+        {
+            value = parseNumber(word);
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    // collect the selectors of the CASE being compiled, true if every OF is preceded by a literal
+    static bool caseSelectors(std::vector<int64_t>& selectors)
+    {
+        if (!jc.optCaseDispatch || jc.words == nullptr) return false;
+
+        const auto& words = *jc.words;
+        size_t armStart = jc.pos_next_word; // the CASE or the last ENDOF
+        int depth = 0;
+        for (size_t pos = jc.pos_next_word + 1; pos < words.size(); ++pos)
+        {
+            const std::string word = to_lower(words[pos]);
+
+            // words that read the following token
+            if (readsNextToken(word))
+            {
+                ++pos;
+                continue;
+            }
+
+            if (word == "case")
+            {
+                depth++;
+                continue;
+            }
+            if (word == "endcase")
+            {
+                if (depth == 0) return !selectors.empty();
+                depth--;
+                continue;
+            }
+            if (depth > 0) continue;
+
+            if (word == "endof")
+            {
+                armStart = pos;
+            }
+            else if (word == "of")
+            {
+                int64_t value = 0;
+                if (pos != armStart + 2 || !caseLiteral(words[pos - 1], value)) return false;
+                selectors.push_back(value);
+            }
+        }
+        return false;
+    }
+
+    // cmp selector,value, using rcx when the value does not fit in an immediate
+    static void genCompareSelector(asmjit::x86::Gp selector, int64_t value)
+    {
+        auto& a = *jc.assembler;
+        if (value >= INT32_MIN && value <= INT32_MAX)
+        {
+            a.cmp(selector, asmjit::imm(value));
+            return;
+        }
+        a.mov(asmjit::x86::rcx, asmjit::imm(value));
+        a.cmp(selector, asmjit::x86::rcx);
+    }
+
+    // binary search over the sorted selectors, short runs are tested in turn
+    static void genCaseTree(asmjit::x86::Gp selector, const std::vector<std::pair<int64_t, asmjit::Label>>& arms,
+                            size_t lo, size_t hi, asmjit::Label defaultLabel)
+    {
+        auto& a = *jc.assembler;
+        if (hi - lo <= 3)
+        {
+            for (size_t i = lo; i < hi; ++i)
+            {
+                genCompareSelector(selector, arms[i].first);
+                a.je(arms[i].second);
+            }
+            a.jmp(defaultLabel);
+            return;
+        }
+
+        const size_t mid = lo + (hi - lo) / 2;
+        asmjit::Label below = a.newLabel();
+        genCompareSelector(selector, arms[mid].first);
+        a.je(arms[mid].second);
+        a.jl(below);
+        genCaseTree(selector, arms, mid + 1, hi, defaultLabel);
+        a.bind(below);
+        genCaseTree(selector, arms, lo, mid, defaultLabel);
+    }
+
+    // jump from CASE straight to the arm for the selector, or to the default code
+    static void genCaseDispatch(asmjit::x86::Gp selector, const CaseLabel& branches)
+    {
+        auto& a = *jc.assembler;
+
+        // sorted, and the first of any repeated selectors wins as it would in the chain of OFs
+        std::vector<std::pair<int64_t, asmjit::Label>> arms;
+        for (size_t i = 0; i < branches.selectors.size(); ++i)
+            arms.emplace_back(branches.selectors[i], branches.armLabels[i]);
+        std::stable_sort(arms.begin(), arms.end(),
+                         [](const auto& x, const auto& y) { return x.first < y.first; });
+        arms.erase(std::unique(arms.begin(), arms.end(),
+                               [](const auto& x, const auto& y) { return x.first == y.first; }),
+                   arms.end());
+
+        const int64_t low = arms.front().first;
+        const uint64_t range = static_cast<uint64_t>(arms.back().first) - static_cast<uint64_t>(low) + 1;
+        if (arms.size() < caseTableMinArms || range == 0 || range > caseTableMaxRange || range > 2 * arms.size())
+        {
+            a.comment(" ; ---- compare tree");
+            genCaseTree(selector, arms, 0, arms.size(), branches.defaultLabel);
+            return;
+        }
+
+        a.comment(" ; ---- jump table, bounds checked");
+        if (low != 0)
+        {
+            if (low >= INT32_MIN && low <= INT32_MAX)
+            {
+                a.sub(selector, asmjit::imm(low));
+            }
+            else
+            {
+                a.mov(asmjit::x86::rcx, asmjit::imm(low));
+                a.sub(selector, asmjit::x86::rcx);
+            }
+        }
+        a.cmp(selector, asmjit::imm(range - 1));
+        a.ja(branches.defaultLabel);
+
+        asmjit::Label table = a.newLabel();
+        a.lea(asmjit::x86::rcx, asmjit::x86::ptr(table));
+        a.movsxd(asmjit::x86::rdx, asmjit::x86::dword_ptr(asmjit::x86::rcx, selector, 2));
+        a.add(asmjit::x86::rcx, asmjit::x86::rdx);
+        a.jmp(asmjit::x86::rcx);
+
+        a.align(asmjit::AlignMode::kData, 4);
+        a.bind(table);
+        size_t next = 0;
+        for (uint64_t i = 0; i < range; ++i)
+        {
+            const int64_t value = static_cast<int64_t>(static_cast<uint64_t>(low) + i);
+            if (next < arms.size() && arms[next].first == value)
+            {
+                a.embedLabelDelta(arms[next++].second, table, 4);
+            }
+            else
+            {
+                a.embedLabelDelta(branches.defaultLabel, table, 4);
+            }
+        }
+    }
 
     static void genCase()
     {
@@ -2865,13 +4536,24 @@ public:
         branches.end_case_label = a.newLabel();
 
         branches.ofCount = -1;
-        loopStack.push({LoopType::CASE_CONTROL, branches});
 
         asmjit::x86::Gp value = asmjit::x86::rax;
         popDS(value);
         pushRS(value);
 
         a.comment(" ; ---- genCase");
+
+        branches.dispatch = caseSelectors(branches.selectors);
+        if (branches.dispatch)
+        {
+            for (size_t i = 0; i < branches.selectors.size(); ++i)
+                branches.armLabels.push_back(a.newLabel());
+            branches.defaultLabel = a.newLabel();
+            genCaseDispatch(value, branches);
+            // the dispatch has used the first selector, its literal would never be reached
+            jc.pos_last_word = jc.pos_next_word + 1;
+        }
+        loopStack.push({LoopType::CASE_CONTROL, branches});
     }
 
     static void genOf()
@@ -2891,11 +4573,25 @@ public:
             // Create a new endOfLabel for this specific `OF`
             asmjit::Label endOfLabel = a.newLabel();
             branches.ofCount = branches.ofCount + 1; // work on next branches label
+            if (branches.dispatch && branches.ofCount + 1 == static_cast<int>(branches.selectors.size()))
+            {
+                // the last ENDOF leads to the default code
+                endOfLabel = branches.defaultLabel;
+            }
             branches.endOfLabels.push_back(endOfLabel);
             // Save modifications back to the stack
             loopStack.pop();
             loopStack.push({LoopType::CASE_CONTROL, branches});
 
+            if (branches.dispatch)
+            {
+                // CASE has already chosen this arm, and the selector literal before OF was skipped
+                a.comment(" ; arm entered from the case dispatch");
+                a.bind(branches.armLabels.at(branches.ofCount));
+                jc.tosCached = false;
+                return;
+            }
+
             a.comment(" ; compare and jump to endof if false");
             asmjit::x86::Gp value = asmjit::x86::rax;
             popRS(value);
@@ -2921,6 +4617,7 @@ public:
         }
         auto& a = *jc.assembler;
         a.comment(" ; ---- genEndOf");
+        spillTOS();
 
         if (!loopStack.empty() && loopStack.top().type == LoopType::CASE_CONTROL)
         {
@@ -2937,6 +4634,12 @@ public:
                 a.bind(branches.endOfLabels.at(branches.ofCount));
                 printf("bind success, of label %d", branches.ofCount);
             }
+
+            // with the dispatch nothing falls through to the next arm, skip its selector literal
+            if (branches.dispatch && branches.ofCount + 1 < static_cast<int>(branches.selectors.size()))
+            {
+                jc.pos_last_word = jc.pos_next_word + 1;
+            }
         }
         else
         {
@@ -2982,6 +4685,7 @@ public:
             auto branches = std::get<CaseLabel>(loopStack.top().label);
 
             a.comment(" ; ---- genEndCase");
+            spillTOS();
 
             // Final bind at the exit point of the case block
             a.bind(branches.end_case_label);
@@ -3013,6 +4717,17 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genSub");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; second - TOS, result in TOS");
+            fillTOS();
+            a.mov(asmjit::x86::rax, asmjit::x86::qword_ptr(asmjit::x86::r15));
+            a.add(asmjit::x86::r15, 8);
+            a.sub(asmjit::x86::rax, asmjit::x86::r10);
+            a.mov(asmjit::x86::r10, asmjit::x86::rax);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp firstVal = asmjit::x86::rax;
@@ -3037,6 +4752,15 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genPlus");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; TOS + second");
+            fillTOS();
+            a.add(asmjit::x86::r10, asmjit::x86::qword_ptr(asmjit::x86::r15));
+            a.add(asmjit::x86::r15, 8);
+            return;
+        }
+
         asmjit::x86::Gp firstVal = asmjit::x86::rax;
         asmjit::x86::Gp secondVal = asmjit::x86::rbx;
 
@@ -3056,6 +4780,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genDiv");
+        spillTOS();
 
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
@@ -3090,6 +4815,15 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genMul");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; TOS * second");
+            fillTOS();
+            a.imul(asmjit::x86::r10, asmjit::x86::qword_ptr(asmjit::x86::r15));
+            a.add(asmjit::x86::r15, 8);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp firstVal = asmjit::x86::rax;
@@ -3118,6 +4852,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genMod");
+        spillTOS();
 
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
@@ -3222,6 +4957,14 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genNegate");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; negate TOS");
+            fillTOS();
+            a.neg(asmjit::x86::r10);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp value = asmjit::x86::rax;
@@ -3243,6 +4986,14 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genInvert");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; invert TOS");
+            fillTOS();
+            a.not_(asmjit::x86::r10);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp value = asmjit::x86::rax;
@@ -3263,6 +5014,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genAbs");
+        spillTOS();
 
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
@@ -3291,6 +5043,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genMin");
+        spillTOS();
 
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
@@ -3324,6 +5077,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genMax");
+        spillTOS();
 
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
@@ -3357,6 +5111,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genWithin");
+        spillTOS();
 
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
@@ -3401,6 +5156,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genSqrt");
+        spillTOS();
 
         // Declaring labels for control flow
         asmjit::Label startLoop = a.newLabel();
@@ -3462,6 +5218,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genGcdEuclidean");
+        spillTOS();
 
         // Declare labels for control flow
         asmjit::Label loopStart = a.newLabel();
@@ -3511,6 +5268,17 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genZeroEquals");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; TOS = 0, flag in TOS");
+            fillTOS();
+            a.test(asmjit::x86::r10, asmjit::x86::r10);
+            a.sete(asmjit::x86::al);
+            a.movzx(asmjit::x86::r10, asmjit::x86::al);
+            a.neg(asmjit::x86::r10);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp value = asmjit::x86::rax;
@@ -3537,6 +5305,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genZeroLessThan");
+        spillTOS();
 
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
@@ -3564,6 +5333,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genZeroGreaterThan");
+        spillTOS();
 
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
@@ -3592,6 +5362,18 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genEq");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; second = TOS, flag in TOS");
+            fillTOS();
+            a.cmp(asmjit::x86::qword_ptr(asmjit::x86::r15), asmjit::x86::r10);
+            a.sete(asmjit::x86::al);
+            a.add(asmjit::x86::r15, 8);
+            a.movzx(asmjit::x86::r10, asmjit::x86::al);
+            a.neg(asmjit::x86::r10);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp firstVal = asmjit::x86::rax;
@@ -3619,6 +5401,18 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genLt");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; second < TOS, flag in TOS");
+            fillTOS();
+            a.cmp(asmjit::x86::qword_ptr(asmjit::x86::r15), asmjit::x86::r10);
+            a.setl(asmjit::x86::al);
+            a.add(asmjit::x86::r15, 8);
+            a.movzx(asmjit::x86::r10, asmjit::x86::al);
+            a.neg(asmjit::x86::r10);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp firstVal = asmjit::x86::rax;
@@ -3653,6 +5447,18 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genGt");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; second > TOS, flag in TOS");
+            fillTOS();
+            a.cmp(asmjit::x86::qword_ptr(asmjit::x86::r15), asmjit::x86::r10);
+            a.setg(asmjit::x86::al);
+            a.add(asmjit::x86::r15, 8);
+            a.movzx(asmjit::x86::r10, asmjit::x86::al);
+            a.neg(asmjit::x86::r10);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp firstVal = asmjit::x86::rax;
@@ -3680,6 +5486,14 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genNot");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; NOT TOS");
+            fillTOS();
+            a.not_(asmjit::x86::r10);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
 
@@ -3703,6 +5517,15 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genAnd");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; TOS AND second");
+            fillTOS();
+            a.and_(asmjit::x86::r10, asmjit::x86::qword_ptr(asmjit::x86::r15));
+            a.add(asmjit::x86::r15, 8);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp firstVal = asmjit::x86::rax;
@@ -3728,6 +5551,15 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genOR");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; TOS OR second");
+            fillTOS();
+            a.or_(asmjit::x86::r10, asmjit::x86::qword_ptr(asmjit::x86::r15));
+            a.add(asmjit::x86::r15, 8);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp firstVal = asmjit::x86::rax;
@@ -3753,6 +5585,15 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genXOR");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; TOS XOR second");
+            fillTOS();
+            a.xor_(asmjit::x86::r10, asmjit::x86::qword_ptr(asmjit::x86::r15));
+            a.add(asmjit::x86::r15, 8);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp firstVal = asmjit::x86::rax;
@@ -3778,6 +5619,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genDSAT");
+        spillTOS();
 
         asmjit::x86::Gp ds = asmjit::x86::r15; // stack pointer in r15
         asmjit::x86::Gp tempReg = asmjit::x86::rax; // temporary register to hold the stack pointer value
@@ -3803,6 +5645,13 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genDrop");
 
+        if (jc.tosCached)
+        {
+            a.comment(" ; drop cached TOS, no code needed");
+            jc.tosCached = false;
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         a.comment(" ; drop top value");
         asmjit::x86::Gp ds = asmjit::x86::r15;
@@ -3820,6 +5669,23 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genDup");
 
+        if (jc.optTosCache)
+        {
+            if (jc.tosCached)
+            {
+                a.comment(" ; copy TOS to the stack, TOS stays cached");
+                a.sub(asmjit::x86::r15, 8);
+                a.mov(asmjit::x86::qword_ptr(asmjit::x86::r15), asmjit::x86::r10);
+            }
+            else
+            {
+                a.comment(" ; load TOS, leaving the original on the stack");
+                a.mov(asmjit::x86::r10, asmjit::x86::qword_ptr(asmjit::x86::r15));
+                jc.tosCached = true;
+            }
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp topValue = asmjit::x86::rax;
@@ -3841,6 +5707,16 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genSwap");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; swap TOS with second");
+            fillTOS();
+            a.mov(asmjit::x86::rax, asmjit::x86::qword_ptr(asmjit::x86::r15));
+            a.mov(asmjit::x86::qword_ptr(asmjit::x86::r15), asmjit::x86::r10);
+            a.mov(asmjit::x86::r10, asmjit::x86::rax);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp topValue = asmjit::x86::rax;
@@ -3863,6 +5739,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genRot");
+        spillTOS();
 
         asmjit::x86::Gp ds = asmjit::x86::r15; // stack pointer in r15
         asmjit::x86::Gp topValue = asmjit::x86::rax; // top value in rax
@@ -3892,6 +5769,16 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genOver");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; spill TOS, copy second into TOS");
+            fillTOS();
+            a.sub(asmjit::x86::r15, 8);
+            a.mov(asmjit::x86::qword_ptr(asmjit::x86::r15), asmjit::x86::r10);
+            a.mov(asmjit::x86::r10, asmjit::x86::qword_ptr(asmjit::x86::r15, 8));
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp secondValue = asmjit::x86::rax;
@@ -3913,6 +5800,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genTuck");
+        spillTOS();
 
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
@@ -3941,6 +5829,14 @@ public:
         auto& a = *jc.assembler;
         a.comment(" ; ----- genNip");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; TOS stays, drop second");
+            fillTOS();
+            a.add(asmjit::x86::r15, 8);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
         asmjit::x86::Gp topValue = asmjit::x86::rax;
@@ -3961,6 +5857,7 @@ public:
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genPick");
+        spillTOS();
 
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
@@ -3985,6 +5882,15 @@ public:
         auto& a = *jc.assembler;
         asmjit::x86::Gp ds = asmjit::x86::r15; // Stack pointer register
 
+        if (jc.optTosCache)
+        {
+            // the constant becomes the new cached top of stack
+            spillTOS();
+            a.mov(asmjit::x86::r10, value);
+            jc.tosCached = true;
+            return;
+        }
+
         if (value >= std::numeric_limits<int32_t>::min() && value <= std::numeric_limits<int32_t>::max())
         {
             // Push a 32-bit immediate value (optimized for smaller constants)
@@ -4030,6 +5936,14 @@ genPushConstant(value);            \
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen1inc - use inc instruction");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; increment TOS");
+            fillTOS();
+            a.inc(asmjit::x86::r10);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
 
@@ -4048,6 +5962,14 @@ genPushConstant(value);            \
         auto& a = *jc.assembler;
         a.comment(" ; ----- gen1inc - use dec instruction");
 
+        if (jc.optTosCache)
+        {
+            a.comment(" ; decrement TOS");
+            fillTOS();
+            a.dec(asmjit::x86::r10);
+            return;
+        }
+
         // Assuming r15 is the stack pointer
         asmjit::x86::Gp ds = asmjit::x86::r15;
 
@@ -4097,57 +6019,535 @@ operation();                           \
     }
 
 
-    // Helper function for left shifts
-    static void genLeftShift(int shiftAmount)
-    {
-        auto& a = *jc.assembler;
-        asmjit::x86::Gp ds = asmjit::x86::r15; // Stack pointer register
-        asmjit::x86::Gp tempValue = asmjit::x86::rax; // Temporary register for value
+    // Helper function for left shifts
+    static void genLeftShift(int shiftAmount)
+    {
+        auto& a = *jc.assembler;
+        asmjit::x86::Gp ds = asmjit::x86::r15; // Stack pointer register
+        asmjit::x86::Gp tempValue = asmjit::x86::rax; // Temporary register for value
+
+        if (jc.optTosCache)
+        {
+            fillTOS();
+            a.shl(asmjit::x86::r10, shiftAmount);
+            return;
+        }
+
+        // Load the top stack value into tempValue
+        a.mov(tempValue, asmjit::x86::qword_ptr(ds));
+
+        // Perform the shift
+        a.shl(tempValue, shiftAmount);
+
+        // Store the result back on the stack
+        a.mov(asmjit::x86::qword_ptr(ds), tempValue);
+    }
+
+    // Helper function for right shifts
+    static void genRightShift(int shiftAmount)
+    {
+        auto& a = *jc.assembler;
+        asmjit::x86::Gp ds = asmjit::x86::r15; // Stack pointer register
+        asmjit::x86::Gp tempValue = asmjit::x86::rax; // Temporary register for value
+
+        if (jc.optTosCache)
+        {
+            fillTOS();
+            a.shr(asmjit::x86::r10, shiftAmount);
+            return;
+        }
+
+        // Load the top stack value into tempValue
+        a.mov(tempValue, asmjit::x86::qword_ptr(ds));
+
+        // Perform the shift
+        a.shr(tempValue, shiftAmount);
+
+        // Store the result back on the stack
+        a.mov(asmjit::x86::qword_ptr(ds), tempValue);
+    }
+
+    // Macros to define the shift operations
+#define GEN_SHIFT_FN(name, shiftAction, shiftAmount) \
+static void name()                               \
+{                                                \
+shiftAction(shiftAmount);                    \
+}
+
+    // Define specific shift functions for multiplication
+    GEN_SHIFT_FN(gen2mul, genLeftShift, 1)
+    GEN_SHIFT_FN(gen4mul, genLeftShift, 2)
+    GEN_SHIFT_FN(gen8mul, genLeftShift, 3)
+    GEN_SHIFT_FN(gen16mul, genLeftShift, 4)
+
+    // Define specific shift functions for division
+    GEN_SHIFT_FN(gen2Div, genRightShift, 1)
+    GEN_SHIFT_FN(gen4Div, genRightShift, 2)
+    GEN_SHIFT_FN(gen8Div, genRightShift, 3)
+
+
+    // Register allocation (*REGALLOC ON, *FPREGS ON)
+    // allocateRegisters marks runs of simple stack words as [REGBLOCK] n word ... , or as
+    // [FPBLOCK] n word ... when the run does floating point arithmetic.
+    // The run is compiled against a virtual stack, so DUP SWAP OVER and the rest only
+    // rename values, and the arithmetic works on registers, general purpose or xmm.  Items
+    // are read from the data stack where the run first needs them, and the stack is written
+    // once, at the end.
+    // A run may call colon definitions whose stack effect is known.  Only the cells the
+    // called word takes are written before the call, constants below them stay in the
+    // virtual stack, and the cells it leaves are read as inputs after it.
+
+    // the shuffles move cells of either kind
+    static bool shuffleWord(const ForthFunction gen)
+    {
+        return gen == genDup || gen == genDrop || gen == genSwap || gen == genOver || gen == genRot ||
+            gen == genNip || gen == genTuck;
+    }
+
+    // integer words a REGBLOCK may contain, besides shuffles and literals
+    static bool intBlockWord(const ForthFunction gen)
+    {
+        static const ForthFunction words[] = {
+            genPlus, genSub, genMul, genAnd, genOR, genXOR, genEq, genLt, genGt,
+            genZeroEquals, genZeroLessThan, genZeroGreaterThan, genNegate, genInvert,
+            gen1Inc, gen2Inc, gen16Inc, gen1Dec, gen2Dec, gen16Dec,
+            gen2mul, gen4mul, gen8mul, gen16mul, genMulBy10, gen2Div, gen4Div, gen8Div
+        };
+        return gen != nullptr && std::find(std::begin(words), std::end(words), gen) != std::end(words);
+    }
+
+    // floating point words an FPBLOCK may contain, besides shuffles and literals.
+    // fsin and fcos call the C library and end a block.
+    static bool floatBlockWord(const ForthFunction gen)
+    {
+        return gen != nullptr && (gen == genFPlus || gen == genFSub || gen == genFMul || gen == genFDiv ||
+            gen == genFMax || gen == genFMin || gen == genSqrt || gen == genFAbs);
+    }
+
+    static bool regBlockWord(const ForthFunction gen, const bool floats)
+    {
+        return shuffleWord(gen) || (floats ? floatBlockWord(gen) : intBlockWord(gen));
+    }
+
+    struct RegOp
+    {
+        ForthFunction gen; // nullptr for a literal or a call
+        int64_t value; // the literal, the bits of a double in an FPBLOCK
+        const ForthWord* call; // a colon definition with a known stack effect
+    };
+
+    // a colon definition a block may call, its stack effect tells the block which cells it uses
+    static bool blockCallWord(const ForthWord* word)
+    {
+        return word != nullptr && word->type == ForthWordType::WORD && (word->state & IMMEDIATE) == 0 &&
+            word->generatorFunc == nullptr && word->immediateFunc == nullptr &&
+            word->compiledFunc != nullptr && word->stackIn >= 0;
+    }
+
+    struct RegValue
+    {
+        enum Kind { INPUT, CONSTANT, REGISTER } kind;
+        int64_t value; // the cell of an input counted from the top of stack, the constant, or the register
+    };
+
+    // rax is kept for scratch, rsi and rdi may hold a loop, r10 the cached top of stack
+    static constexpr int64_t regPoolSize = 5;
+    // xmm0 and xmm1 are kept for scratch, xmm6 and up belong to the caller under Win64
+    static constexpr int64_t xmmPoolSize = 4;
+
+    static asmjit::x86::Gp regPool(const int64_t r)
+    {
+        static const asmjit::x86::Gp pool[regPoolSize] = {
+            asmjit::x86::rcx, asmjit::x86::rdx, asmjit::x86::r8, asmjit::x86::r9, asmjit::x86::r11
+        };
+        return pool[r];
+    }
+
+    static asmjit::x86::Xmm xmmPool(const int64_t r)
+    {
+        static const asmjit::x86::Xmm pool[xmmPoolSize] = {
+            asmjit::x86::xmm2, asmjit::x86::xmm3, asmjit::x86::xmm4, asmjit::x86::xmm5
+        };
+        return pool[r];
+    }
+
+    // the result of a unary REGBLOCK word, in place on dst
+    static void genRegUnary(const ForthFunction g, const asmjit::x86::Gp& dst)
+    {
+        auto& a = *jc.assembler;
+        if (g == genNegate) a.neg(dst);
+        else if (g == genInvert) a.not_(dst);
+        else if (g == gen1Inc) a.add(dst, 1);
+        else if (g == gen2Inc) a.add(dst, 2);
+        else if (g == gen16Inc) a.add(dst, 16);
+        else if (g == gen1Dec) a.sub(dst, 1);
+        else if (g == gen2Dec) a.sub(dst, 2);
+        else if (g == gen16Dec) a.sub(dst, 16);
+        else if (g == gen2mul) a.shl(dst, 1);
+        else if (g == gen4mul) a.shl(dst, 2);
+        else if (g == gen8mul) a.shl(dst, 3);
+        else if (g == gen16mul) a.shl(dst, 4);
+        else if (g == genMulBy10) a.imul(dst, dst, 10);
+        // the shifts are logical, as they are outside a block
+        else if (g == gen2Div) a.shr(dst, 1);
+        else if (g == gen4Div) a.shr(dst, 2);
+        else if (g == gen8Div) a.shr(dst, 3);
+        else
+        {
+            a.test(dst, dst);
+            if (g == genZeroEquals) a.sete(asmjit::x86::al);
+            else if (g == genZeroLessThan) a.setl(asmjit::x86::al);
+            else a.setg(asmjit::x86::al);
+            a.movzx(dst, asmjit::x86::al);
+            a.neg(dst);
+        }
+    }
+
+    // the result of a unary FPBLOCK word, in place on dst
+    static void genXmmUnary(const ForthFunction g, const asmjit::x86::Xmm& dst)
+    {
+        auto& a = *jc.assembler;
+        if (g == genSqrt)
+        {
+            a.sqrtsd(dst, dst);
+            return;
+        }
+        // fabs clears the sign bit
+        a.mov(asmjit::x86::rax, 0x7FFFFFFFFFFFFFFF);
+        a.movq(asmjit::x86::xmm1, asmjit::x86::rax);
+        a.andpd(dst, asmjit::x86::xmm1);
+    }
+
+    // compile a register block, false if it needs more registers than there are.
+    // Without emit nothing is generated, which lets genRegBlock try the block first.
+    static bool compileRegBlock(const std::vector<RegOp>& ops, const bool floats, const bool emit)
+    {
+        using namespace asmjit;
+        auto& a = *jc.assembler;
+        const int64_t poolSize = floats ? xmmPoolSize : regPoolSize;
+        std::vector<RegValue> vs;
+        int64_t inputs = 0;
+
+        // items below the block are read from the data stack
+        auto need = [&](const size_t n)
+        {
+            while (vs.size() < n) vs.insert(vs.begin(), RegValue{RegValue::INPUT, inputs++});
+        };
+        auto referenced = [&](const int64_t r)
+        {
+            return std::any_of(vs.begin(), vs.end(), [r](const RegValue& v)
+            {
+                return v.kind == RegValue::REGISTER && v.value == r;
+            });
+        };
+        auto cell = [](const int64_t c)
+        {
+            return x86::qword_ptr(x86::r15, static_cast<int32_t>(8 * c));
+        };
+        // a source operand, constants go through rax, and into xmm0 for floating point
+        auto operand = [&](const RegValue& v) -> Operand
+        {
+            if (v.kind == RegValue::INPUT) return cell(v.value);
+            if (v.kind == RegValue::REGISTER) return floats ? Operand(xmmPool(v.value)) : Operand(regPool(v.value));
+            if (!floats && Support::isInt32(v.value)) return imm(v.value);
+            if (emit) a.mov(x86::rax, v.value);
+            if (!floats) return x86::rax;
+            if (emit) a.movq(x86::xmm0, x86::rax);
+            return x86::xmm0;
+        };
+        // a register holding v that may be overwritten, keeping clear of the register keep
+        auto writable = [&](const RegValue& v, const int64_t keep) -> int64_t
+        {
+            if (v.kind == RegValue::REGISTER && !referenced(v.value)) return v.value;
+            for (int64_t r = 0; r < poolSize; ++r)
+            {
+                if (r == keep || referenced(r)) continue;
+                if (!emit) return r;
+                if (!floats) a.emit(x86::Inst::kIdMov, regPool(r), operand(v));
+                else if (v.kind == RegValue::INPUT) a.movsd(xmmPool(r), cell(v.value));
+                else if (v.kind == RegValue::REGISTER) a.movapd(xmmPool(r), xmmPool(v.value));
+                else
+                {
+                    a.mov(x86::rax, v.value);
+                    a.movq(xmmPool(r), x86::rax);
+                }
+                return r;
+            }
+            return -1;
+        };
+
+        // write the items to their cells and move r15 to the top of them, constants
+        // below the item keep may stay virtual.  The cells are then counted from the new top.
+        auto settle = [&](const size_t keep) -> bool
+        {
+            // the item i, counted from the bottom of vs, goes to the cell inputs - 1 - i
+            const auto outputs = static_cast<int64_t>(vs.size());
+            auto target = [&](const int64_t i) { return inputs - 1 - i; };
+
+            // inputs that move are loaded first, the stores could overwrite them
+            for (int64_t i = 0; i < outputs; ++i)
+            {
+                const RegValue v = vs[i];
+                if (v.kind != RegValue::INPUT || v.value == target(i)) continue;
+                const int64_t r = writable(v, -1);
+                if (r < 0) return false;
+                for (auto& w : vs)
+                {
+                    if (w.kind == RegValue::INPUT && w.value == v.value) w = {RegValue::REGISTER, r};
+                }
+            }
+
+            for (int64_t i = 0; i < outputs; ++i)
+            {
+                const RegValue v = vs[i];
+                if (v.kind == RegValue::INPUT) continue;
+                if (v.kind == RegValue::CONSTANT && i < static_cast<int64_t>(keep)) continue;
+                vs[i] = {RegValue::INPUT, target(i)};
+                if (!emit) continue;
+                if (v.kind == RegValue::REGISTER && floats)
+                {
+                    a.movsd(cell(target(i)), xmmPool(v.value));
+                    continue;
+                }
+                // a constant is stored as its bits, whatever its kind
+                const bool viaRax = v.kind == RegValue::CONSTANT && !Support::isInt32(v.value);
+                if (viaRax) a.mov(x86::rax, v.value);
+                a.emit(x86::Inst::kIdMov, cell(target(i)),
+                       viaRax ? Operand(x86::rax) : v.kind == RegValue::CONSTANT ? Operand(imm(v.value)) : Operand(regPool(v.value)));
+            }
+            if (inputs != outputs)
+            {
+                if (emit) a.add(x86::r15, 8 * (inputs - outputs));
+                for (auto& v : vs)
+                {
+                    if (v.kind == RegValue::INPUT) v.value -= inputs - outputs;
+                }
+            }
+            inputs = outputs;
+            return true;
+        };
+
+        for (const auto& op : ops)
+        {
+            const ForthFunction g = op.gen;
+            if (op.call != nullptr)
+            {
+                // the word sees the cells it takes in memory, and registers do not survive the call
+                const auto in = static_cast<size_t>(op.call->stackIn);
+                const auto out = static_cast<int64_t>(op.call->stackOut);
+                need(in);
+                if (!settle(vs.size() - in)) return false;
+                if (emit) genCall(op.call->compiledFunc);
+                vs.resize(vs.size() - in);
+                for (auto& v : vs)
+                {
+                    if (v.kind == RegValue::INPUT) v.value += out - static_cast<int64_t>(in);
+                }
+                for (int64_t c = out - 1; c >= 0; --c) vs.push_back({RegValue::INPUT, c});
+                inputs = static_cast<int64_t>(vs.size());
+                continue;
+            }
+            if (g == nullptr)
+            {
+                vs.push_back({RegValue::CONSTANT, op.value});
+                continue;
+            }
+
+            // the stack shuffles generate nothing
+            if (g == genDup || g == genDrop)
+            {
+                need(1);
+                const RegValue top = vs.back();
+                if (g == genDup) vs.push_back(top);
+                else vs.pop_back();
+                continue;
+            }
+            if (g == genSwap || g == genOver || g == genNip || g == genTuck)
+            {
+                need(2);
+                const RegValue second = vs[vs.size() - 2];
+                const RegValue top = vs.back();
+                if (g == genSwap) std::swap(vs[vs.size() - 2], vs.back());
+                else if (g == genOver) vs.push_back(second);
+                else if (g == genNip) vs.erase(vs.end() - 2);
+                else vs.insert(vs.end() - 2, top);
+                continue;
+            }
+            if (g == genRot)
+            {
+                need(3);
+                std::rotate(vs.end() - 3, vs.end() - 2, vs.end());
+                continue;
+            }
 
-        // Load the top stack value into tempValue
-        a.mov(tempValue, asmjit::x86::qword_ptr(ds));
+            const bool binary = floats
+                ? g == genFPlus || g == genFSub || g == genFMul || g == genFDiv || g == genFMax || g == genFMin
+                : g == genPlus || g == genSub || g == genMul || g == genAnd || g == genOR || g == genXOR ||
+                g == genEq || g == genLt || g == genGt;
+            if (!binary)
+            {
+                need(1);
+                const RegValue x = vs.back();
+                vs.pop_back();
+                const int64_t r = writable(x, -1);
+                if (r < 0) return false;
+                if (emit && floats) genXmmUnary(g, xmmPool(r));
+                else if (emit) genRegUnary(g, regPool(r));
+                vs.push_back({RegValue::REGISTER, r});
+                continue;
+            }
 
-        // Perform the shift
-        a.shl(tempValue, shiftAmount);
+            // lhs is second and rhs is top of stack
+            need(2);
+            RegValue lhs = vs[vs.size() - 2];
+            RegValue rhs = vs.back();
+            vs.resize(vs.size() - 2);
+            const bool commutative = g != genSub && g != genLt && g != genGt && g != genFSub && g != genFDiv;
+            // reuse a register that nothing else refers to, whichever side it is on
+            if (commutative && rhs.kind == RegValue::REGISTER && !referenced(rhs.value) &&
+                !(lhs.kind == RegValue::REGISTER && !referenced(lhs.value)))
+            {
+                std::swap(lhs, rhs);
+            }
+            const int64_t r = writable(lhs, rhs.kind == RegValue::REGISTER ? rhs.value : -1);
+            if (r < 0) return false;
+            if (emit && floats)
+            {
+                const x86::Xmm dst = xmmPool(r);
+                const Operand src = operand(rhs);
+                if (g == genFPlus) a.emit(x86::Inst::kIdAddsd, dst, src);
+                else if (g == genFSub) a.emit(x86::Inst::kIdSubsd, dst, src);
+                else if (g == genFMul) a.emit(x86::Inst::kIdMulsd, dst, src);
+                else if (g == genFDiv) a.emit(x86::Inst::kIdDivsd, dst, src);
+                else if (g == genFMax) a.emit(x86::Inst::kIdMaxsd, dst, src);
+                else a.emit(x86::Inst::kIdMinsd, dst, src);
+            }
+            else if (emit)
+            {
+                const x86::Gp dst = regPool(r);
+                if (g == genMul && rhs.kind == RegValue::CONSTANT && Support::isInt32(rhs.value))
+                {
+                    a.imul(dst, dst, rhs.value);
+                }
+                else
+                {
+                    const Operand src = operand(rhs);
+                    if (g == genPlus) a.emit(x86::Inst::kIdAdd, dst, src);
+                    else if (g == genSub) a.emit(x86::Inst::kIdSub, dst, src);
+                    else if (g == genMul) a.emit(x86::Inst::kIdImul, dst, src);
+                    else if (g == genAnd) a.emit(x86::Inst::kIdAnd, dst, src);
+                    else if (g == genOR) a.emit(x86::Inst::kIdOr, dst, src);
+                    else if (g == genXOR) a.emit(x86::Inst::kIdXor, dst, src);
+                    else
+                    {
+                        a.emit(x86::Inst::kIdCmp, dst, src);
+                        if (g == genEq) a.sete(x86::al);
+                        else if (g == genLt) a.setl(x86::al);
+                        else a.setg(x86::al);
+                        a.movzx(dst, x86::al);
+                        a.neg(dst);
+                    }
+                }
+            }
+            vs.push_back({RegValue::REGISTER, r});
+        }
 
-        // Store the result back on the stack
-        a.mov(asmjit::x86::qword_ptr(ds), tempValue);
+        return settle(0);
     }
 
-    // Helper function for right shifts
-    static void genRightShift(int shiftAmount)
+    // read the words of a REGBLOCK or FPBLOCK and compile them
+    static void genBlock(const bool floats)
     {
-        auto& a = *jc.assembler;
-        asmjit::x86::Gp ds = asmjit::x86::r15; // Stack pointer register
-        asmjit::x86::Gp tempValue = asmjit::x86::rax; // Temporary register for value
+        const char* name = floats ? "genFPBlock" : "genRegBlock";
+        if (!jc.assembler)
+        {
+            throw std::runtime_error(std::string(name) + ": Assembler not initialized");
+        }
+        if (jc.words == nullptr)
+        {
+            throw std::runtime_error(std::string(name) + ": no words to compile");
+        }
+        expectTag(floats ? TokenTag::FPBLOCK : TokenTag::REGBLOCK);
 
-        // Load the top stack value into tempValue
-        a.mov(tempValue, asmjit::x86::qword_ptr(ds));
+        const auto& words = *jc.words;
+        size_t pos = jc.pos_next_word + 1;
+        if (pos >= words.size() || !is_number(words[pos]))
+        {
+            throw std::runtime_error(std::string(name) + ": word count expected");
+        }
+        const auto count = static_cast<size_t>(parseNumber(words[pos]));
+        if (pos + count >= words.size())
+        {
+            throw std::runtime_error(std::string(name) + ": block runs past the end of the definition");
+        }
 
-        // Perform the shift
-        a.shr(tempValue, shiftAmount);
+        std::vector<RegOp> ops;
+        for (size_t k = 0; k < count; ++k)
+        {
+            const std::string& word = words[++pos];
+            RegOp op{nullptr, 0, nullptr};
+            if (floats && is_float(word) && d.findWord(word.c_str()) == nullptr)
+            {
+                op.value = std::bit_cast<int64_t>(std::stod(word));
+            }
+            else if (!caseLiteral(word, op.value))
+            {
+                const ForthWord* fword = d.findWord(word.c_str());
+                if (blockCallWord(fword))
+                {
+                    op.call = fword;
+                }
+                else if (fword == nullptr || !regBlockWord(fword->generatorFunc, floats))
+                {
+                    throw std::runtime_error(std::string(name) + ": word can not be in the block: " + word);
+                }
+                else
+                {
+                    op.gen = fword->generatorFunc;
+                }
+            }
+            ops.push_back(op);
+        }
+        jc.pos_last_word = pos;
 
-        // Store the result back on the stack
-        a.mov(asmjit::x86::qword_ptr(ds), tempValue);
-    }
+        auto& a = *jc.assembler;
+        a.comment(floats ? " ; ----- genFPBlock" : " ; ----- genRegBlock");
+        spillTOS();
+        if (compileRegBlock(ops, floats, false))
+        {
+            compileRegBlock(ops, floats, true);
+            return;
+        }
 
-    // Macros to define the shift operations
-#define GEN_SHIFT_FN(name, shiftAction, shiftAmount) \
-static void name()                               \
-{                                                \
-shiftAction(shiftAmount);                    \
-}
+        a.comment(" ; out of registers, each word on its own");
+        for (const auto& op : ops)
+        {
+            if (op.call != nullptr)
+            {
+                genCall(op.call->compiledFunc);
+                continue;
+            }
+            if (op.gen != nullptr)
+            {
+                op.gen();
+                continue;
+            }
+            jc.uint64_A = static_cast<uint64_t>(op.value);
+            genPushLong();
+        }
+    }
 
-    // Define specific shift functions for multiplication
-    GEN_SHIFT_FN(gen2mul, genLeftShift, 1)
-    GEN_SHIFT_FN(gen4mul, genLeftShift, 2)
-    GEN_SHIFT_FN(gen8mul, genLeftShift, 3)
-    GEN_SHIFT_FN(gen16mul, genLeftShift, 4)
+    // [REGBLOCK] n word ...
+    static void genRegBlock()
+    {
+        genBlock(false);
+    }
 
-    // Define specific shift functions for division
-    GEN_SHIFT_FN(gen2Div, genRightShift, 1)
-    GEN_SHIFT_FN(gen4Div, genRightShift, 2)
-    GEN_SHIFT_FN(gen8Div, genRightShift, 3)
+    // [FPBLOCK] n word ...
+    static void genFPBlock()
+    {
+        genBlock(true);
+    }
 
 
     //  abort e.g. IF ABORT" error" THEN
@@ -4201,15 +6601,11 @@ shiftAction(shiftAmount);                    \
 
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- Quit SDL2 ");
+        spillTOS();
 
-        // call function with shadow
-        a.sub(asmjit::x86::rsp, 40); // Allocate space for the shadow space
-        a.call(sdl_quit);
-        a.add(asmjit::x86::rsp, 40); // restore shadow space
+        genCCall(sdl_quit);
 
-        a.sub(asmjit::x86::rsp, 40); // Allocate space for the shadow space
-        a.call(prim_end_sdl);
-        a.add(asmjit::x86::rsp, 40); // restore shadow space
+        genCCall(prim_end_sdl);
     }
 
 
@@ -4222,11 +6618,9 @@ shiftAction(shiftAmount);                    \
 
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- Start SDL2 ");
+        spillTOS();
 
-        // call function with shadow
-        a.sub(asmjit::x86::rsp, 40); // Allocate space for the shadow space
-        a.call(prim_start_sdl);
-        a.add(asmjit::x86::rsp, 40); // restore shadow space
+        genCCall(prim_start_sdl);
     }
 
 
@@ -4239,11 +6633,9 @@ shiftAction(shiftAmount);                    \
 
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- Quit SDL2 ");
+        spillTOS();
 
-        // call function with shadow
-        a.sub(asmjit::x86::rsp, 40); // Allocate space for the shadow space
-        a.call(sdl_show);
-        a.add(asmjit::x86::rsp, 40); // restore shadow space
+        genCCall(sdl_show);
     }
 
 
@@ -4256,11 +6648,16 @@ shiftAction(shiftAmount);                    \
 
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- Quit SDL2 ");
+        spillTOS();
+
+        genCCall(sdl_hide);
+    }
 
-        // call function with shadow
-        a.sub(asmjit::x86::rsp, 40); // Allocate space for the shadow space
-        a.call(sdl_hide);
-        a.add(asmjit::x86::rsp, 40); // restore shadow space
+    // the title is copied before the string is dropped
+    static void prim_set_window_title(const uint64_t index)
+    {
+        sdl_set_window_title(std::string(strIntern.view(index)));
+        strIntern.drop(index);
     }
 
     static void genSDLSetTitle()
@@ -4272,17 +6669,9 @@ shiftAction(shiftAmount);                    \
 
         auto& a = *jc.assembler;
         a.comment(" ; ----- genSDLSetTitle - set title");
+        spillTOS();
         popSS(asmjit::x86::rcx); // get the string from the string stack.
-
-        // get string address
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(prim_sindex);
-        a.add(asmjit::x86::rsp, 40); // adress in rax.
-
-        a.mov(asmjit::x86::rcx, asmjit::x86::rax);
-        a.sub(asmjit::x86::rsp, 40);
-        a.call(sdl_set_window_title);
-        a.add(asmjit::x86::rsp, 40);
+        genCCall(prim_set_window_title, 1);
     }
 
     // swap buffers
@@ -4294,10 +6683,8 @@ shiftAction(shiftAmount);                    \
         }
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- Test SDL ");
-        // call function with shadow
-        a.sub(asmjit::x86::rsp, 40); // Allocate space for the shadow space
-        a.call(swap_buffers);
-        a.add(asmjit::x86::rsp, 40); // restore shadow space
+        spillTOS();
+        genCCall(swap_buffers);
     }
 
 
@@ -4309,10 +6696,8 @@ shiftAction(shiftAmount);                    \
         }
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- Test SDL ");
-        // call function with shadow
-        a.sub(asmjit::x86::rsp, 40); // Allocate space for the shadow space
-        a.call(test1);
-        a.add(asmjit::x86::rsp, 40); // restore shadow space
+        spillTOS();
+        genCCall(test1);
     }
 
     static void genTestSDL2()
@@ -4323,10 +6708,8 @@ shiftAction(shiftAmount);                    \
         }
         auto& a = *jc.assembler;
         commentWithWord(" ; ----- Test SDL ");
-        // call function with shadow
-        a.sub(asmjit::x86::rsp, 40); // Allocate space for the shadow space
-        a.call(test2);
-        a.add(asmjit::x86::rsp, 40); // restore shadow space
+        spillTOS();
+        genCCall(test2);
     }
 
     // floating point support
@@ -4579,9 +6962,7 @@ shiftAction(shiftAmount);                    \
         a.movq(asmjit::x86::xmm0, val); // Move the value to XMM0
 
         // Call the sin() function
-        a.sub(asmjit::x86::rsp, 40); // Reserve space on stack
-        a.call(reinterpret_cast<void*>(sin)); // Call the `sin` function from the standard library
-        a.add(asmjit::x86::rsp, 40); // Free reserved space
+        genCCall(static_cast<double (*)(double)>(sin));
 
         a.movq(val, asmjit::x86::xmm0); // Move the result back to a general-purpose register
         pushDS(val); // Push the result back onto the stack
@@ -4604,9 +6985,7 @@ shiftAction(shiftAmount);                    \
         popDS(val); // Pop the floating point value from the stack
         a.movq(asmjit::x86::xmm0, val); // Move the value to XMM0
         // Call the cos() function
-        a.sub(asmjit::x86::rsp, 40); // Reserve space on stack
-        a.call(reinterpret_cast<void*>(cos)); // Call the `cos` function from the standard library
-        a.add(asmjit::x86::rsp, 40); // Free reserved space
+        genCCall(static_cast<double (*)(double)>(cos));
         a.movq(val, asmjit::x86::xmm0); // Move the result back to a general-purpose register
         pushDS(val); // Push the result back onto the stack
     }
@@ -4719,19 +7098,397 @@ shiftAction(shiftAmount);                    \
         // Preserve the stack pointers
         preserveStackPointers();
 
-        // Allocate space for the shadow space (32 bytes) + an additional space required by the ABI (8 bytes)
-        a.sub(asmjit::x86::rsp, 40);
-
-        // Call the printFloat function
-        a.call(asmjit::imm(reinterpret_cast<void*>(printFloat)));
-
-        // Restore the stack
-        a.add(asmjit::x86::rsp, 40);
+        genCCall(printFloat);
 
         // Restore the stack pointers
         restoreStackPointers();
     }
 
+    // Vector words over FARRAY
+    // The loops are generated in line, with AVX2 when the processor has it and SSE2
+    // otherwise, see JitContext::detectSimd.  An array holds its element count in the cell before its
+    // first element, and a word that takes several arrays works on as many elements as
+    // the shortest of them has.
+    //
+    // rcx, rdx and r8 hold the arrays, r9 the count and r11 the index.
+
+    static constexpr uint64_t vectorAlignment = 32;
+
+    // the instructions of an element wise word, packed AVX, packed SSE and scalar
+    struct VectorInst
+    {
+        asmjit::InstId avx;
+        asmjit::InstId sse;
+        asmjit::InstId scalar;
+    };
+
+    static asmjit::x86::Mem vectorElement(const asmjit::x86::Gp& array)
+    {
+        return asmjit::x86::qword_ptr(array, asmjit::x86::r11, 3);
+    }
+
+    static asmjit::x86::Mem vectorElements(const asmjit::x86::Gp& array)
+    {
+        return jc.simdAVX2
+                   ? asmjit::x86::ymmword_ptr(array, asmjit::x86::r11, 3)
+                   : asmjit::x86::xmmword_ptr(array, asmjit::x86::r11, 3);
+    }
+
+    // r9 = the smaller of r9 and the count of array
+    static void genVectorCount(const asmjit::x86::Gp& array)
+    {
+        auto& a = *jc.assembler;
+        a.mov(asmjit::x86::rax, asmjit::x86::qword_ptr(array, -8));
+        a.cmp(asmjit::x86::rax, asmjit::x86::r9);
+        a.cmovb(asmjit::x86::r9, asmjit::x86::rax);
+    }
+
+    // pop the arrays, the last one is on top of the stack, and set r9 to the shortest count
+    static void genVectorArrays(const std::vector<asmjit::x86::Gp>& arrays)
+    {
+        auto& a = *jc.assembler;
+        for (auto it = arrays.rbegin(); it != arrays.rend(); ++it)
+        {
+            popDS(*it);
+        }
+        a.mov(asmjit::x86::r9, asmjit::x86::qword_ptr(arrays.front(), -8));
+        for (size_t i = 1; i < arrays.size(); ++i)
+        {
+            genVectorCount(arrays[i]);
+        }
+    }
+
+    // for r11 from 0 below r9, a vector of elements at a time while they last, then one at a time.
+    // between runs once after the wide loop, while the upper halves of the ymm registers still count.
+    static void genVectorLoop(const std::function<void()>& wide, const std::function<void()>& scalar,
+                              const std::function<void()>& between = nullptr)
+    {
+        auto& a = *jc.assembler;
+        const int width = jc.simdAVX2 ? 4 : 2;
+        const asmjit::Label wideLoop = a.newLabel();
+        const asmjit::Label wideDone = a.newLabel();
+        const asmjit::Label tailLoop = a.newLabel();
+        const asmjit::Label done = a.newLabel();
+
+        a.xor_(asmjit::x86::r11, asmjit::x86::r11);
+        a.bind(wideLoop);
+        a.lea(asmjit::x86::rax, asmjit::x86::ptr(asmjit::x86::r11, width));
+        a.cmp(asmjit::x86::rax, asmjit::x86::r9);
+        a.ja(wideDone);
+        wide();
+        a.add(asmjit::x86::r11, width);
+        a.jmp(wideLoop);
+
+        a.bind(wideDone);
+        if (between) between();
+        if (jc.simdAVX2) a.vzeroupper();
+
+        a.bind(tailLoop);
+        a.cmp(asmjit::x86::r11, asmjit::x86::r9);
+        a.jae(done);
+        scalar();
+        a.inc(asmjit::x86::r11);
+        a.jmp(tailLoop);
+        a.bind(done);
+    }
+
+    // ( a b c -- ) c[i] = a[i] op b[i]
+    static void genVectorBinary(const char* name, const VectorInst& inst)
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error(std::string(name) + ": Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        commentWithWord(" ; ----- ", name);
+        using namespace asmjit::x86;
+
+        genVectorArrays({rcx, rdx, r8});
+        genVectorLoop(
+            [&]
+            {
+                if (jc.simdAVX2)
+                {
+                    a.vmovupd(ymm0, vectorElements(rcx));
+                    a.emit(inst.avx, ymm0, ymm0, vectorElements(rdx));
+                    a.vmovupd(vectorElements(r8), ymm0);
+                    return;
+                }
+                a.movupd(xmm0, vectorElements(rcx));
+                a.movupd(xmm1, vectorElements(rdx));
+                a.emit(inst.sse, xmm0, xmm1);
+                a.movupd(vectorElements(r8), xmm0);
+            },
+            [&]
+            {
+                a.movsd(xmm0, vectorElement(rcx));
+                a.emit(inst.scalar, xmm0, vectorElement(rdx));
+                a.movsd(vectorElement(r8), xmm0);
+            });
+    }
+
+    static void genVPlus()
+    {
+        genVectorBinary("genVPlus", {asmjit::x86::Inst::kIdVaddpd, asmjit::x86::Inst::kIdAddpd, asmjit::x86::Inst::kIdAddsd});
+    }
+
+    static void genVSub()
+    {
+        genVectorBinary("genVSub", {asmjit::x86::Inst::kIdVsubpd, asmjit::x86::Inst::kIdSubpd, asmjit::x86::Inst::kIdSubsd});
+    }
+
+    static void genVMul()
+    {
+        genVectorBinary("genVMul", {asmjit::x86::Inst::kIdVmulpd, asmjit::x86::Inst::kIdMulpd, asmjit::x86::Inst::kIdMulsd});
+    }
+
+    static void genVMin()
+    {
+        genVectorBinary("genVMin", {asmjit::x86::Inst::kIdVminpd, asmjit::x86::Inst::kIdMinpd, asmjit::x86::Inst::kIdMinsd});
+    }
+
+    static void genVMax()
+    {
+        genVectorBinary("genVMax", {asmjit::x86::Inst::kIdVmaxpd, asmjit::x86::Inst::kIdMaxpd, asmjit::x86::Inst::kIdMaxsd});
+    }
+
+    // ( a b c -- ) c[i] = c[i] + a[i] * b[i]
+    static void genVFma()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genVFma: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- genVFma");
+        using namespace asmjit::x86;
+
+        genVectorArrays({rcx, rdx, r8});
+        genVectorLoop(
+            [&]
+            {
+                if (jc.simdFMA)
+                {
+                    a.vmovupd(ymm0, vectorElements(r8));
+                    a.vmovupd(ymm1, vectorElements(rcx));
+                    a.vfmadd231pd(ymm0, ymm1, vectorElements(rdx));
+                }
+                else if (jc.simdAVX2)
+                {
+                    a.vmovupd(ymm1, vectorElements(rcx));
+                    a.vmulpd(ymm1, ymm1, vectorElements(rdx));
+                    a.vaddpd(ymm0, ymm1, vectorElements(r8));
+                }
+                else
+                {
+                    a.movupd(xmm1, vectorElements(rcx));
+                    a.movupd(xmm2, vectorElements(rdx));
+                    a.mulpd(xmm1, xmm2);
+                    a.movupd(xmm0, vectorElements(r8));
+                    a.addpd(xmm0, xmm1);
+                    a.movupd(vectorElements(r8), xmm0);
+                    return;
+                }
+                a.vmovupd(vectorElements(r8), ymm0);
+            },
+            [&]
+            {
+                // the tail rounds the same way as the wide loop
+                if (jc.simdFMA)
+                {
+                    a.movsd(xmm0, vectorElement(r8));
+                    a.movsd(xmm1, vectorElement(rcx));
+                    a.vfmadd231sd(xmm0, xmm1, vectorElement(rdx));
+                }
+                else
+                {
+                    a.movsd(xmm1, vectorElement(rcx));
+                    a.mulsd(xmm1, vectorElement(rdx));
+                    a.movsd(xmm0, vectorElement(r8));
+                    a.addsd(xmm0, xmm1);
+                }
+                a.movsd(vectorElement(r8), xmm0);
+            });
+    }
+
+    // the float in rax in every lane of xmm1, or ymm1
+    static void genVectorBroadcast()
+    {
+        auto& a = *jc.assembler;
+        a.movq(asmjit::x86::xmm1, asmjit::x86::rax);
+        if (jc.simdAVX2) a.vbroadcastsd(asmjit::x86::ymm1, asmjit::x86::xmm1);
+        else a.unpcklpd(asmjit::x86::xmm1, asmjit::x86::xmm1);
+    }
+
+    // ( a f c -- ) c[i] = f * a[i]
+    static void genVScale()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genVScale: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- genVScale");
+        using namespace asmjit::x86;
+
+        popDS(r8);
+        popDS(rax);
+        popDS(rcx);
+        genVectorBroadcast();
+        a.mov(r9, qword_ptr(r8, -8));
+        genVectorCount(rcx);
+        genVectorLoop(
+            [&]
+            {
+                if (jc.simdAVX2)
+                {
+                    a.vmulpd(ymm0, ymm1, vectorElements(rcx));
+                    a.vmovupd(vectorElements(r8), ymm0);
+                    return;
+                }
+                a.movupd(xmm0, vectorElements(rcx));
+                a.mulpd(xmm0, xmm1);
+                a.movupd(vectorElements(r8), xmm0);
+            },
+            [&]
+            {
+                a.movsd(xmm0, vectorElement(rcx));
+                a.mulsd(xmm0, xmm1);
+                a.movsd(vectorElement(r8), xmm0);
+            });
+    }
+
+    // ( f c -- ) c[i] = f
+    static void genVFill()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genVFill: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- genVFill");
+        using namespace asmjit::x86;
+
+        popDS(r8);
+        popDS(rax);
+        genVectorBroadcast();
+        a.mov(r9, qword_ptr(r8, -8));
+        genVectorLoop(
+            [&]
+            {
+                if (jc.simdAVX2) a.vmovupd(vectorElements(r8), ymm1);
+                else a.movupd(vectorElements(r8), xmm1);
+            },
+            [&]
+            {
+                a.movsd(vectorElement(r8), xmm1);
+            });
+    }
+
+    // ( a -- f ) the sum of a[i], or ( a b -- f ) the sum of a[i] * b[i]
+    static void genVectorReduce(const bool dot)
+    {
+        auto& a = *jc.assembler;
+        using namespace asmjit::x86;
+
+        if (dot) genVectorArrays({rcx, rdx});
+        else genVectorArrays({rcx});
+
+        if (jc.simdAVX2) a.vxorpd(ymm0, ymm0, ymm0);
+        else a.xorpd(xmm0, xmm0);
+        genVectorLoop(
+            [&]
+            {
+                if (jc.simdAVX2)
+                {
+                    if (!dot)
+                    {
+                        a.vaddpd(ymm0, ymm0, vectorElements(rcx));
+                        return;
+                    }
+                    a.vmovupd(ymm1, vectorElements(rcx));
+                    if (jc.simdFMA)
+                    {
+                        a.vfmadd231pd(ymm0, ymm1, vectorElements(rdx));
+                        return;
+                    }
+                    a.vmulpd(ymm1, ymm1, vectorElements(rdx));
+                    a.vaddpd(ymm0, ymm0, ymm1);
+                    return;
+                }
+                a.movupd(xmm1, vectorElements(rcx));
+                if (dot)
+                {
+                    a.movupd(xmm2, vectorElements(rdx));
+                    a.mulpd(xmm1, xmm2);
+                }
+                a.addpd(xmm0, xmm1);
+            },
+            [&]
+            {
+                if (!dot)
+                {
+                    a.addsd(xmm0, vectorElement(rcx));
+                    return;
+                }
+                a.movsd(xmm1, vectorElement(rcx));
+                a.mulsd(xmm1, vectorElement(rdx));
+                a.addsd(xmm0, xmm1);
+            },
+            [&]
+            {
+                a.comment(" ; add the lanes together");
+                if (jc.simdAVX2)
+                {
+                    a.vextractf128(xmm1, ymm0, 1);
+                    a.vaddpd(xmm0, xmm0, xmm1);
+                    a.vunpckhpd(xmm1, xmm0, xmm0);
+                    a.vaddsd(xmm0, xmm0, xmm1);
+                    return;
+                }
+                a.movapd(xmm1, xmm0);
+                a.unpckhpd(xmm1, xmm1);
+                a.addsd(xmm0, xmm1);
+            });
+        a.movq(rax, xmm0);
+        pushDS(rax);
+    }
+
+    static void genVSum()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genVSum: Assembler not initialized");
+        }
+        jc.assembler->comment(" ; ----- genVSum");
+        genVectorReduce(false);
+    }
+
+    static void genVDot()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genVDot: Assembler not initialized");
+        }
+        jc.assembler->comment(" ; ----- genVDot");
+        genVectorReduce(true);
+    }
+
+    // ( a -- n ) the element count of an array
+    static void genVLen()
+    {
+        if (!jc.assembler)
+        {
+            throw std::runtime_error("genVLen: Assembler not initialized");
+        }
+        auto& a = *jc.assembler;
+        a.comment(" ; ----- genVLen");
+        popDS(asmjit::x86::rax);
+        a.mov(asmjit::x86::rax, asmjit::x86::qword_ptr(asmjit::x86::rax, -8));
+        pushDS(asmjit::x86::rax);
+    }
+
+
 
     //
     //     static void genFApproxEqual() {
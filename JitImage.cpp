@@ -0,0 +1,866 @@
+#include "JitImage.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include "ForthDictionary.h"
+#include "JitArena.h"
+#include "StringInterner.h"
+#include "jitContext.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr char IMAGE_MAGIC[8] = {'J', 'B', 'F', 'I', 'M', 'A', 'G', 'E'};
+    constexpr uint32_t IMAGE_VERSION = 3;
+    constexpr uint64_t NO_WORD = UINT64_MAX;
+
+    // user space addresses, anything outside this is a constant
+    constexpr uint64_t LOWEST_ADDRESS = 0x10000;
+    constexpr uint64_t HIGHEST_ADDRESS = 1ULL << 47;
+
+    // builder node user data of an instruction whose immediate is an address
+    constexpr uint64_t ADDRESS_TAG = 0x41444452; // "ADDR"
+
+    // what an address points into
+    enum class RefKind : uint8_t
+    {
+        RAW, // not an address we know about, kept as it is
+        DICTIONARY, // offset into the dictionary memory
+        ARENA, // offset into the saved code
+        STRING, // offset into an interned string
+        NATIVE // offset into a loaded module
+    };
+
+    struct Ref
+    {
+        RefKind kind = RefKind::RAW;
+        uint32_t index = 0; // string or module
+        uint64_t offset = 0;
+    };
+
+#ifndef _WIN32
+    const uint8_t* executableBase()
+    {
+        Dl_info info;
+        dladdr(reinterpret_cast<void*>(&executableBase), &info);
+        return static_cast<const uint8_t*>(info.dli_fbase);
+    }
+#endif
+
+    // the module holding a native address, the executable is named ""
+    bool findModule(const void* address, std::string& name, const uint8_t*& base)
+    {
+#ifdef _WIN32
+        HMODULE module = nullptr;
+        if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                                static_cast<LPCSTR>(address), &module))
+        {
+            return false;
+        }
+        base = reinterpret_cast<const uint8_t*>(module);
+        name.clear();
+        if (module != GetModuleHandleA(nullptr))
+        {
+            char path[MAX_PATH];
+            const DWORD length = GetModuleFileNameA(module, path, MAX_PATH);
+            name.assign(path, length);
+            name = name.substr(name.find_last_of("\\/") + 1);
+        }
+        return true;
+#else
+        Dl_info info;
+        if (dladdr(address, &info) == 0 || info.dli_fbase == nullptr)
+        {
+            return false;
+        }
+        base = static_cast<const uint8_t*>(info.dli_fbase);
+        name = base == executableBase() ? "" : info.dli_fname;
+        return true;
+#endif
+    }
+
+    const uint8_t* moduleBase(const std::string& name)
+    {
+#ifdef _WIN32
+        return reinterpret_cast<const uint8_t*>(GetModuleHandleA(name.empty() ? nullptr : name.c_str()));
+#else
+        if (name.empty()) return executableBase();
+        void* handle = dlopen(name.c_str(), RTLD_LAZY | RTLD_NOLOAD);
+        if (handle == nullptr) return nullptr;
+        link_map* map = nullptr;
+        Dl_info info{};
+        if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0 || dladdr(map->l_ld, &info) == 0)
+        {
+            info.dli_fbase = nullptr;
+        }
+        dlclose(handle);
+        return static_cast<const uint8_t*>(info.dli_fbase);
+#endif
+    }
+
+    // the processor features the generated code was compiled for
+    uint32_t cpuFeatures()
+    {
+        const JitContext& context = JitContext::getInstance();
+        return (context.simdAVX2 ? 1u : 0u) | (context.simdFMA ? 2u : 0u);
+    }
+
+    // offset of a function in this program, differs between builds
+    uint64_t buildAnchor()
+    {
+        std::string name;
+        const uint8_t* base = nullptr;
+        const auto* anchor = reinterpret_cast<const uint8_t*>(&JitImage::load);
+        if (!findModule(anchor, name, base)) return 0;
+        return anchor - base;
+    }
+
+    // describes addresses by what they point into
+    class AddressClassifier
+    {
+    public:
+        AddressClassifier(const std::vector<char>& memory, const JitArena& arena, const StringInterner& interner)
+            : dictionaryBase(reinterpret_cast<uint64_t>(memory.data())), dictionarySize(memory.size()),
+              arenaBase(reinterpret_cast<uint64_t>(arena.baseAddress())), arenaSize(arena.usedBytes())
+        {
+            for (size_t i = 0; i < interner.size(); ++i)
+            {
+                // a removed string's index and block may be given to another one
+                if (interner.refCount(i) == 0) continue;
+                const auto start = reinterpret_cast<uint64_t>(interner.getStringAddress(i));
+                // the terminating zero is part of the string
+                strings.push_back({start, start + interner.getString(i).size() + 1, static_cast<uint32_t>(i)});
+            }
+            std::ranges::sort(strings, {}, &StringRange::start);
+        }
+
+        Ref classify(const uint64_t value)
+        {
+            if (value < LOWEST_ADDRESS || value >= HIGHEST_ADDRESS) return {RefKind::RAW, 0, value};
+            if (value - dictionaryBase < dictionarySize) return {RefKind::DICTIONARY, 0, value - dictionaryBase};
+            if (arenaBase != 0 && value - arenaBase < arenaSize) return {RefKind::ARENA, 0, value - arenaBase};
+
+            const auto it = std::ranges::upper_bound(strings, value, {}, &StringRange::start);
+            if (it != strings.begin() && value < std::prev(it)->end)
+            {
+                return {RefKind::STRING, std::prev(it)->index, value - std::prev(it)->start};
+            }
+
+            std::string name;
+            const uint8_t* base = nullptr;
+            if (findModule(reinterpret_cast<const void*>(value), name, base))
+            {
+                const auto found = std::ranges::find(modules, name);
+                const auto index = static_cast<uint32_t>(found - modules.begin());
+                if (found == modules.end()) modules.push_back(name);
+                return {RefKind::NATIVE, index, value - reinterpret_cast<uint64_t>(base)};
+            }
+            return {RefKind::RAW, 0, value};
+        }
+
+        // the dictionary and the code are somewhere else in the next process
+        [[nodiscard]] bool moves(const uint64_t value) const
+        {
+            return value - dictionaryBase < dictionarySize || (arenaBase != 0 && value - arenaBase < arenaSize);
+        }
+
+        std::vector<std::string> modules;
+
+    private:
+        struct StringRange
+        {
+            uint64_t start;
+            uint64_t end;
+            uint32_t index;
+        };
+
+        uint64_t dictionaryBase;
+        uint64_t dictionarySize;
+        uint64_t arenaBase;
+        uint64_t arenaSize;
+        std::vector<StringRange> strings;
+    };
+
+    class ImageWriter
+    {
+    public:
+        explicit ImageWriter(const std::string& fileName) : out(fileName, std::ios::binary)
+        {
+            if (!out.is_open())
+            {
+                throw std::runtime_error("SAVE-IMAGE: could not create " + fileName);
+            }
+        }
+
+        template <typename T>
+        void put(const T& value)
+        {
+            out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        void putBytes(const void* bytes, const size_t size)
+        {
+            put<uint64_t>(size);
+            out.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(size));
+        }
+
+        void putString(const std::string& s)
+        {
+            putBytes(s.data(), s.size());
+        }
+
+        void putRef(const Ref& ref)
+        {
+            put(ref.kind);
+            put(ref.index);
+            put(ref.offset);
+        }
+
+        void close(const std::string& fileName)
+        {
+            out.close();
+            if (out.fail())
+            {
+                throw std::runtime_error("SAVE-IMAGE: could not write " + fileName);
+            }
+        }
+
+    private:
+        std::ofstream out;
+    };
+
+    // the image file is mapped, the code and the dictionary are copied straight out of the mapping
+    class ImageReader
+    {
+    public:
+        explicit ImageReader(const std::string& fileName)
+        {
+#ifdef _WIN32
+            const HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                            FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+            {
+                throw std::runtime_error("LOAD-IMAGE: could not open " + fileName);
+            }
+            LARGE_INTEGER fileSize{};
+            GetFileSizeEx(file, &fileSize);
+            length = static_cast<size_t>(fileSize.QuadPart);
+            if (length > 0)
+            {
+                const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping != nullptr)
+                {
+                    view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                    CloseHandle(mapping);
+                }
+            }
+            CloseHandle(file);
+#else
+            const int file = open(fileName.c_str(), O_RDONLY);
+            if (file < 0)
+            {
+                throw std::runtime_error("LOAD-IMAGE: could not open " + fileName);
+            }
+            struct stat status{};
+            length = fstat(file, &status) == 0 ? static_cast<size_t>(status.st_size) : 0;
+            if (length > 0)
+            {
+                view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+                if (view == MAP_FAILED) view = nullptr;
+            }
+            close(file);
+#endif
+            if (length > 0 && view == nullptr)
+            {
+                throw std::runtime_error("LOAD-IMAGE: could not map " + fileName);
+            }
+            data = static_cast<const char*>(view);
+        }
+
+        ~ImageReader()
+        {
+            if (view == nullptr) return;
+#ifdef _WIN32
+            UnmapViewOfFile(view);
+#else
+            munmap(view, length);
+#endif
+        }
+
+        ImageReader(const ImageReader&) = delete;
+        ImageReader& operator=(const ImageReader&) = delete;
+
+        template <typename T>
+        T get()
+        {
+            T value;
+            std::memcpy(&value, take(sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        const char* getBytes(size_t& size)
+        {
+            size = get<uint64_t>();
+            return take(size);
+        }
+
+        std::string getString()
+        {
+            size_t size;
+            const char* bytes = getBytes(size);
+            return {bytes, size};
+        }
+
+        Ref getRef()
+        {
+            Ref ref;
+            ref.kind = get<RefKind>();
+            ref.index = get<uint32_t>();
+            ref.offset = get<uint64_t>();
+            return ref;
+        }
+
+    private:
+        const char* take(const size_t size)
+        {
+            if (size > length - pos)
+            {
+                throw std::runtime_error("LOAD-IMAGE: the image is truncated");
+            }
+            const char* p = data + pos;
+            pos += size;
+            return p;
+        }
+
+        void* view = nullptr;
+        const char* data = nullptr;
+        size_t length = 0;
+        size_t pos = 0;
+    };
+
+    struct SavedWord
+    {
+        uint64_t offset = 0;
+        Ref funcs[4]; // compiled, generator, immediate, interpreter
+        bool pointerData = false;
+        Ref data;
+    };
+
+    struct SavedAddress
+    {
+        uint64_t offset;
+        JitImage::AddressForm form;
+        Ref target;
+    };
+
+    void patch(uint8_t* field, const JitImage::AddressForm form, const uint64_t value)
+    {
+        switch (form)
+        {
+        case JitImage::AddressForm::ABS64:
+            std::memcpy(field, &value, 8);
+            return;
+        case JitImage::AddressForm::ABS32:
+            {
+                if (value > UINT32_MAX) throw std::runtime_error("JitImage: address does not fit in 32 bits");
+                const auto v = static_cast<uint32_t>(value);
+                std::memcpy(field, &v, 4);
+                return;
+            }
+        case JitImage::AddressForm::SABS32:
+            {
+                const auto s = static_cast<int64_t>(value);
+                if (s < INT32_MIN || s > INT32_MAX) throw std::runtime_error("JitImage: address does not fit in 32 bits");
+                const auto v = static_cast<int32_t>(s);
+                std::memcpy(field, &v, 4);
+                return;
+            }
+        case JitImage::AddressForm::REL32:
+            {
+                const int64_t displacement = static_cast<int64_t>(value - reinterpret_cast<uint64_t>(field + 4));
+                if (displacement < INT32_MIN || displacement > INT32_MAX)
+                    throw std::runtime_error("JitImage: call target is out of rel32 range");
+                const auto v = static_cast<int32_t>(displacement);
+                std::memcpy(field, &v, 4);
+            }
+        }
+    }
+}
+
+
+void JitImage::tagAddress(asmjit::x86::Builder& b)
+{
+    b.cursor()->setUserDataAsUInt64(ADDRESS_TAG);
+}
+
+std::vector<JitImage::AddressMark> JitImage::markAddresses(asmjit::x86::Builder& b)
+{
+    std::vector<AddressMark> marks;
+    asmjit::BaseNode* cursor = b.cursor();
+    for (asmjit::BaseNode* node = b.firstNode(); node != nullptr; node = node->next())
+    {
+        if (!node->isInst() || node->userDataAsUInt64() != ADDRESS_TAG) continue;
+
+        const auto* inst = node->as<asmjit::InstNode>();
+        for (uint32_t i = 0; i < inst->opCount(); ++i)
+        {
+            if (!inst->op(i).isImm()) continue;
+            const auto value = inst->op(i).as<asmjit::Imm>().valueAs<uint64_t>();
+
+            // a label right after the instruction gives us the end of its encoding
+            b.setCursor(node);
+            const asmjit::Label end = b.newLabel();
+            b.bind(end);
+            marks.push_back({end, value});
+            node = node->next();
+            break;
+        }
+    }
+    b.setCursor(cursor);
+    return marks;
+}
+
+void JitImage::recordAddresses(const asmjit::CodeHolder& code, uint8_t* block, const size_t size,
+                               const std::vector<AddressMark>& marks)
+{
+    const uint8_t* arenaBase = JitArena::getInstance().baseAddress();
+    auto record = [&](const uint8_t* field, const AddressForm form, const uint64_t value)
+    {
+        codeAddresses.push_back({static_cast<uint64_t>(field - arenaBase), value, form});
+    };
+
+    for (const auto& mark : marks)
+    {
+        const uint8_t* end = block + code.labelOffsetFromBase(mark.end);
+
+        // the immediate is the last field of mov, push and the alu instructions
+        uint64_t field64 = 0;
+        if (end - block >= 8)
+        {
+            std::memcpy(&field64, end - 8, 8);
+            if (field64 == mark.value)
+            {
+                record(end - 8, AddressForm::ABS64, mark.value);
+                continue;
+            }
+        }
+
+        int32_t field32 = 0;
+        if (end - block >= 4)
+        {
+            std::memcpy(&field32, end - 4, 4);
+            if (static_cast<uint32_t>(field32) == mark.value)
+            {
+                record(end - 4, AddressForm::ABS32, mark.value);
+                continue;
+            }
+            if (static_cast<int64_t>(field32) == static_cast<int64_t>(mark.value))
+            {
+                record(end - 4, AddressForm::SABS32, mark.value);
+                continue;
+            }
+
+            // call and jmp, either direct or through the address table
+            if (reinterpret_cast<uint64_t>(end + field32) == mark.value)
+            {
+                record(end - 4, AddressForm::REL32, mark.value);
+                continue;
+            }
+            const uint8_t* slot = end + field32;
+            if (slot >= block && slot + 8 <= block + size)
+            {
+                std::memcpy(&field64, slot, 8);
+                if (field64 == mark.value)
+                {
+                    record(slot, AddressForm::ABS64, mark.value);
+                    continue;
+                }
+            }
+        }
+        unlocated.push_back(mark.value);
+    }
+}
+
+void JitImage::retarget(const uint64_t from, const uint64_t to)
+{
+    uint8_t* arenaBase = JitArena::getInstance().baseAddress();
+    for (auto& address : codeAddresses)
+    {
+        if (address.value != from) continue;
+        uint8_t* field = arenaBase + address.offset;
+        JitArena::Writable writable(field, address.form == AddressForm::ABS64 ? 8 : 4);
+        patch(field, address.form, to);
+        address.value = to;
+    }
+}
+
+void JitImage::save(const std::string& fileName)
+{
+    ForthDictionary& dictionary = ForthDictionary::getInstance();
+    const JitArena& arena = JitArena::getInstance();
+    const StringInterner& interner = StringInterner::getInstance();
+    AddressClassifier classifier(dictionary.memory, arena, interner);
+
+    if (!unlocated.empty())
+    {
+        throw std::runtime_error("SAVE-IMAGE: the code holds an address that could not be located");
+    }
+
+    std::vector<SavedAddress> addresses;
+    for (const auto& address : codeAddresses)
+    {
+        const Ref target = classifier.classify(address.value);
+        if (target.kind != RefKind::RAW)
+        {
+            addresses.push_back({address.offset, address.form, target});
+        }
+    }
+
+    // oldest first, so loading can link them up again in order
+    std::vector<ForthWord*> words;
+    for (ForthWord* word = dictionary.latestWord; word != nullptr; word = word->link)
+    {
+        words.push_back(word);
+    }
+    std::ranges::reverse(words);
+
+    auto wordOffset = [&](const ForthWord* word)
+    {
+        return word == nullptr ? NO_WORD : static_cast<uint64_t>(
+            reinterpret_cast<const char*>(word) - dictionary.memory.data());
+    };
+
+    std::vector<SavedWord> savedWords;
+    for (const ForthWord* word : words)
+    {
+        SavedWord saved;
+        saved.offset = wordOffset(word);
+        const ForthFunction funcs[4] = {word->compiledFunc, word->generatorFunc, word->immediateFunc, word->terpFunc};
+        for (int i = 0; i < 4; ++i)
+        {
+            saved.funcs[i] = classifier.classify(reinterpret_cast<uint64_t>(funcs[i]));
+            if (funcs[i] != nullptr && saved.funcs[i].kind == RefKind::RAW)
+            {
+                throw std::runtime_error(std::string("SAVE-IMAGE: ") + word->name + " was not compiled into the code arena");
+            }
+        }
+        if (std::holds_alternative<void*>(word->data))
+        {
+            saved.pointerData = true;
+            saved.data = classifier.classify(reinterpret_cast<uint64_t>(std::get<void*>(word->data)));
+        }
+        savedWords.push_back(saved);
+    }
+
+    // An address in the data of a word, such as a VARIABLE holding HERE or an execution token,
+    // would be wrong in the next process. Every aligned cell that points into the dictionary or
+    // the code is relocated like an address in the code. A number that happens to have the same
+    // value as such an address is relocated too.
+    std::vector<SavedAddress> dataAddresses;
+    const char* memory = dictionary.memory.data();
+    auto relocateCell = [&](const uint64_t offset)
+    {
+        uint64_t cell;
+        std::memcpy(&cell, memory + offset, 8);
+        if (classifier.moves(cell))
+        {
+            dataAddresses.push_back({offset, AddressForm::ABS64, classifier.classify(cell)});
+        }
+    };
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        const ForthWord* word = words[i];
+        if (std::holds_alternative<uint64_t>(word->data))
+        {
+            relocateCell(reinterpret_cast<const char*>(&std::get<uint64_t>(word->data)) - memory);
+        }
+
+        const uint64_t start = (wordOffset(word) + sizeof(ForthWord) + 7) & ~uint64_t{7};
+        const uint64_t end = i + 1 < words.size() ? wordOffset(words[i + 1]) : dictionary.currentPos;
+        for (uint64_t offset = start; offset + 8 <= end; offset += 8)
+        {
+            relocateCell(offset);
+        }
+    }
+
+    ImageWriter out(fileName);
+    for (const char c : IMAGE_MAGIC) out.put(c);
+    out.put(IMAGE_VERSION);
+    out.put(static_cast<uint32_t>(sizeof(ForthWord)));
+    out.put(buildAnchor());
+    out.put(cpuFeatures());
+
+    out.put(static_cast<uint64_t>(classifier.modules.size()));
+    for (const auto& module : classifier.modules) out.putString(module);
+
+    out.put(static_cast<uint64_t>(interner.size()));
+    for (size_t i = 0; i < interner.size(); ++i)
+    {
+        out.putString(interner.getString(i));
+        out.put(static_cast<uint64_t>(interner.refCount(i)));
+    }
+
+    out.putBytes(arena.baseAddress(), arena.usedBytes());
+    out.put(static_cast<uint64_t>(addresses.size()));
+    for (const auto& address : addresses)
+    {
+        out.put(address.offset);
+        out.put(address.form);
+        out.putRef(address.target);
+    }
+
+    out.putBytes(dictionary.memory.data(), dictionary.currentPos);
+    out.put(static_cast<uint64_t>(dataAddresses.size()));
+    for (const auto& address : dataAddresses)
+    {
+        out.put(address.offset);
+        out.putRef(address.target);
+    }
+    out.put(static_cast<uint64_t>(savedWords.size()));
+    for (const auto& saved : savedWords)
+    {
+        out.put(saved.offset);
+        for (const auto& ref : saved.funcs) out.putRef(ref);
+        out.put(saved.pointerData);
+        out.putRef(saved.data);
+    }
+
+    out.put(static_cast<uint64_t>(dictionary.sourceCodeMap.size()));
+    for (const auto& [name, source] : dictionary.sourceCodeMap)
+    {
+        out.putString(name);
+        out.putString(source);
+    }
+
+    out.put(static_cast<uint64_t>(dictionary.inlineBodies.size()));
+    for (const auto& [word, body] : dictionary.inlineBodies)
+    {
+        out.put(wordOffset(word));
+        out.put(body.inlinable);
+        out.put(static_cast<uint64_t>(body.tokens.size()));
+        for (size_t i = 0; i < body.tokens.size(); ++i)
+        {
+            out.putString(body.tokens[i]);
+            out.put(wordOffset(i < body.bindings.size() ? body.bindings[i] : nullptr));
+        }
+    }
+
+    out.close(fileName);
+    std::cout << "Saved image " << fileName << ": " << words.size() << " words, " << arena.usedBytes()
+        << " bytes of code, " << addresses.size() + dataAddresses.size() << " relocations" << std::endl;
+}
+
+void JitImage::load(const std::string& fileName)
+{
+    ImageReader in(fileName);
+
+    for (const char c : IMAGE_MAGIC)
+    {
+        if (in.get<char>() != c)
+        {
+            throw std::runtime_error("LOAD-IMAGE: " + fileName + " is not an image");
+        }
+    }
+    if (in.get<uint32_t>() != IMAGE_VERSION || in.get<uint32_t>() != sizeof(ForthWord) ||
+        in.get<uint64_t>() != buildAnchor())
+    {
+        throw std::runtime_error("LOAD-IMAGE: " + fileName + " was saved by a different build");
+    }
+    if (in.get<uint32_t>() != cpuFeatures())
+    {
+        throw std::runtime_error("LOAD-IMAGE: " + fileName + " was compiled for a processor with other vector features");
+    }
+
+    std::vector<const uint8_t*> moduleBases(in.get<uint64_t>());
+    for (auto& base : moduleBases)
+    {
+        const std::string name = in.getString();
+        base = moduleBase(name);
+        if (base == nullptr)
+        {
+            throw std::runtime_error("LOAD-IMAGE: module " + name + " is not loaded");
+        }
+    }
+
+    std::vector<std::string> strings(in.get<uint64_t>());
+    std::vector<size_t> counts(strings.size());
+    for (size_t i = 0; i < strings.size(); ++i)
+    {
+        strings[i] = in.getString();
+        counts[i] = in.get<uint64_t>();
+    }
+
+    size_t codeSize;
+    const auto* code = reinterpret_cast<const uint8_t*>(in.getBytes(codeSize));
+    std::vector<SavedAddress> addresses(in.get<uint64_t>());
+    for (auto& address : addresses)
+    {
+        address.offset = in.get<uint64_t>();
+        address.form = in.get<AddressForm>();
+        address.target = in.getRef();
+        if (address.offset + (address.form == AddressForm::ABS64 ? 8 : 4) > codeSize)
+        {
+            throw std::runtime_error("LOAD-IMAGE: relocation outside the code");
+        }
+    }
+
+    size_t dictionarySize;
+    const char* dictionaryBytes = in.getBytes(dictionarySize);
+    ForthDictionary& dictionary = ForthDictionary::getInstance();
+    if (dictionarySize > dictionary.memory.size())
+    {
+        throw std::runtime_error("LOAD-IMAGE: the dictionary is too small for " + fileName);
+    }
+    std::vector<SavedAddress> dataAddresses(in.get<uint64_t>());
+    for (auto& address : dataAddresses)
+    {
+        address.offset = in.get<uint64_t>();
+        address.form = AddressForm::ABS64;
+        address.target = in.getRef();
+        if (address.offset + 8 > dictionarySize)
+        {
+            throw std::runtime_error("LOAD-IMAGE: relocation outside the dictionary");
+        }
+    }
+
+    std::vector<SavedWord> savedWords(in.get<uint64_t>());
+    for (auto& saved : savedWords)
+    {
+        saved.offset = in.get<uint64_t>();
+        for (auto& ref : saved.funcs) ref = in.getRef();
+        saved.pointerData = in.get<bool>();
+        saved.data = in.getRef();
+        if (saved.offset + sizeof(ForthWord) > dictionarySize)
+        {
+            throw std::runtime_error("LOAD-IMAGE: word outside the dictionary");
+        }
+    }
+
+    std::vector<std::pair<std::string, std::string>> sources(in.get<uint64_t>());
+    for (auto& [name, source] : sources)
+    {
+        name = in.getString();
+        source = in.getString();
+    }
+
+    struct SavedBody
+    {
+        uint64_t word;
+        bool inlinable;
+        std::vector<std::string> tokens;
+        std::vector<uint64_t> bindings;
+    };
+    std::vector<SavedBody> bodies(in.get<uint64_t>());
+    for (auto& body : bodies)
+    {
+        body.word = in.get<uint64_t>();
+        body.inlinable = in.get<bool>();
+        body.tokens.resize(in.get<uint64_t>());
+        for (auto& token : body.tokens)
+        {
+            token = in.getString();
+            body.bindings.push_back(in.get<uint64_t>());
+        }
+    }
+
+    // everything has been read, put the strings back so their new addresses are known
+    StringInterner& interner = StringInterner::getInstance();
+    interner.restore(strings, counts);
+
+    JitArena& arena = JitArena::getInstance();
+    uint8_t* block = codeSize > 0 ? arena.addBytes(code, codeSize) : arena.baseAddress();
+    char* memory = dictionary.memory.data();
+
+    auto resolve = [&](const Ref& ref) -> uint64_t
+    {
+        switch (ref.kind)
+        {
+        case RefKind::DICTIONARY:
+            return reinterpret_cast<uint64_t>(memory + ref.offset);
+        case RefKind::ARENA:
+            return reinterpret_cast<uint64_t>(block + ref.offset);
+        case RefKind::STRING:
+            if (ref.index >= strings.size()) throw std::runtime_error("LOAD-IMAGE: bad string reference");
+            return reinterpret_cast<uint64_t>(interner.getStringAddress(ref.index)) + ref.offset;
+        case RefKind::NATIVE:
+            if (ref.index >= moduleBases.size()) throw std::runtime_error("LOAD-IMAGE: bad module reference");
+            return reinterpret_cast<uint64_t>(moduleBases[ref.index]) + ref.offset;
+        default:
+            return ref.offset;
+        }
+    };
+
+    // the code goes in at the end of the arena, fix each address for this process
+    // the words compiled before the load are gone, an address lost in their code no longer matters
+    unlocated.clear();
+    const uint8_t* arenaBase = arena.baseAddress();
+    {
+        JitArena::Writable writable(block, codeSize);
+        for (const auto& address : addresses)
+        {
+            const uint64_t value = resolve(address.target);
+            patch(block + address.offset, address.form, value);
+            codeAddresses.push_back({static_cast<uint64_t>(block + address.offset - arenaBase), value, address.form});
+        }
+    }
+
+    // replace the dictionary, the words are linked up again oldest first
+    std::memcpy(memory, dictionaryBytes, dictionarySize);
+    dictionary.currentPos = dictionarySize;
+    for (const auto& address : dataAddresses)
+    {
+        patch(reinterpret_cast<uint8_t*>(memory + address.offset), address.form, resolve(address.target));
+    }
+    dictionary.latestWord = nullptr;
+    std::ranges::fill(dictionary.hashBuckets, nullptr);
+    for (const auto& saved : savedWords)
+    {
+        auto* word = reinterpret_cast<ForthWord*>(memory + saved.offset);
+        word->compiledFunc = reinterpret_cast<ForthFunction>(resolve(saved.funcs[0]));
+        word->generatorFunc = reinterpret_cast<ForthFunction>(resolve(saved.funcs[1]));
+        word->immediateFunc = reinterpret_cast<ForthFunction>(resolve(saved.funcs[2]));
+        word->terpFunc = reinterpret_cast<ForthFunction>(resolve(saved.funcs[3]));
+        if (saved.pointerData)
+        {
+            word->data = reinterpret_cast<void*>(resolve(saved.data));
+        }
+        word->link = dictionary.latestWord;
+        dictionary.latestWord = word;
+        dictionary.linkHash(word);
+    }
+
+    dictionary.sourceCodeMap.clear();
+    for (auto& [name, source] : sources)
+    {
+        dictionary.sourceCodeMap[name] = source;
+    }
+
+    auto wordAt = [&](const uint64_t offset)
+    {
+        return offset == NO_WORD ? nullptr : reinterpret_cast<const ForthWord*>(memory + offset);
+    };
+    dictionary.inlineBodies.clear();
+    for (auto& body : bodies)
+    {
+        InlineBody restored;
+        restored.tokens = std::move(body.tokens);
+        restored.inlinable = body.inlinable;
+        for (const uint64_t binding : body.bindings) restored.bindings.push_back(wordAt(binding));
+        dictionary.inlineBodies[wordAt(body.word)] = std::move(restored);
+    }
+
+    std::cout << "Loaded image " << fileName << ": " << savedWords.size() << " words, " << codeSize
+        << " bytes of code" << std::endl;
+}
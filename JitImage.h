@@ -0,0 +1,76 @@
+#ifndef JITIMAGE_H
+#define JITIMAGE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "include/asmjit/asmjit.h"
+
+// Saved images.
+// SAVE-IMAGE writes the dictionary memory, the interned strings and the code arena to a file.
+// LOAD-IMAGE puts them back, so a program can start without compiling anything.
+//
+// Generated code holds absolute addresses, for example mov rax, dataAddress or a call to a
+// C++ primitive. The generator tags each instruction whose immediate is an address as it
+// emits it (tagAddress), other immediates are constants however large they are. Before the
+// word is serialized the tagged instructions are marked (markAddresses), and once the code
+// is in the arena the bytes holding each address are found (recordAddresses). When the image is saved, each address is described by what it points
+// into: the dictionary, the arena, an interned string or a loaded module. Loading rewrites
+// it for wherever those are in the new process.
+//
+// Cells in the data of the dictionary that point into the dictionary or the arena, such as a
+// VARIABLE holding HERE, are relocated the same way. LOAD-IMAGE maps the file and copies
+// straight out of it.
+//
+// The image can only be loaded by the same build of the program.
+
+class JitImage
+{
+public:
+    // an address immediate, and the label just after its instruction
+    struct AddressMark
+    {
+        asmjit::Label end;
+        uint64_t value;
+    };
+
+    // how an address is held in the code
+    enum class AddressForm : uint8_t
+    {
+        ABS64, // 8 byte address
+        ABS32, // 4 byte address, zero extended
+        SABS32, // 4 byte address, sign extended
+        REL32 // 4 byte displacement from the end of the field, direct call and jmp
+    };
+
+    // the instruction just emitted holds an address as its immediate
+    static void tagAddress(asmjit::x86::Builder& b);
+
+    // before finalize, label every tagged instruction
+    static std::vector<AddressMark> markAddresses(asmjit::x86::Builder& b);
+
+    // after the code has been copied to the arena, find where each marked value ended up
+    static void recordAddresses(const asmjit::CodeHolder& code, uint8_t* block, size_t size,
+                                const std::vector<AddressMark>& marks);
+
+    // point every located address of from at to instead, used when a lazy word is compiled
+    static void retarget(uint64_t from, uint64_t to);
+
+    static void save(const std::string& fileName);
+    static void load(const std::string& fileName);
+
+private:
+    struct CodeAddress
+    {
+        uint64_t offset; // from the start of the arena
+        uint64_t value;
+        AddressForm form;
+    };
+
+    // every address located in the arena so far
+    static inline std::vector<CodeAddress> codeAddresses;
+    // addresses that were tagged but not found in the code, saving fails while there are any
+    static inline std::vector<uint64_t> unlocated;
+};
+
+#endif //JITIMAGE_H
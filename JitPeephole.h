@@ -0,0 +1,272 @@
+#ifndef JITPEEPHOLE_H
+#define JITPEEPHOLE_H
+
+#include "include/asmjit/asmjit.h"
+
+// Peephole optimizer.
+// Runs over the builder node list after a word has been generated and before it is
+// serialized by endGeneration.
+// The generators push and pop through memory all the time, so the common
+// sequences it removes are
+//
+//   nop                                      ; removed
+//   sub r15,8 ; mov [r15],X ; mov Y,[r15] ; add r15,8   ; push then pop becomes mov Y,X
+//   add r15,8 ; sub r15,8                    ; stack adjustments fused
+//   mov [r15],X ; mov Y,[r15]                ; load forwarded from the store
+//   mov X,[r14] ; mov [r14],X                ; store of the loaded value removed
+//   jmp L ; X                                ; X is unreachable, removed up to the next label
+//
+// The stack registers are r12 (SS), r13 (LS), r14 (RS) and r15 (DS).
+// Comments are skipped over, labels and any other nodes end a sequence.
+
+class JitPeephole
+{
+public:
+    // returns the number of instructions removed
+    // `from` limits the pass to the nodes after it, used when a builder holds a batch of words
+    static int optimize(asmjit::x86::Builder& b, asmjit::BaseNode* from = nullptr)
+    {
+        int removed = 0;
+        asmjit::BaseNode* node = from ? from->next() : b.firstNode();
+        while (node != nullptr)
+        {
+            if (!node->isInst())
+            {
+                node = node->next();
+                continue;
+            }
+            asmjit::BaseNode* resume = resumePoint(node, from);
+            const int n = rewrite(b, node->as<asmjit::InstNode>());
+            if (n > 0)
+            {
+                // nodes have been removed, look again at the instructions that may now match
+                removed += n;
+                node = resume ? resume : (from ? from->next() : b.firstNode());
+            }
+            else
+            {
+                node = node->next();
+            }
+        }
+        return removed;
+    }
+
+private:
+    static bool isStackReg(const asmjit::Operand& op)
+    {
+        if (!op.isReg()) return false;
+        const auto& reg = op.as<asmjit::x86::Gp>();
+        return reg.isGp() && reg.size() == 8 && reg.id() >= asmjit::x86::Gp::kIdR12
+            && reg.id() <= asmjit::x86::Gp::kIdR15;
+    }
+
+    static bool isGp64(const asmjit::Operand& op)
+    {
+        if (!op.isReg()) return false;
+        const auto& reg = op.as<asmjit::x86::Gp>();
+        return reg.isGp() && reg.size() == 8;
+    }
+
+    static bool sameReg(const asmjit::Operand& x, const asmjit::Operand& y)
+    {
+        return x.isReg() && y.isReg() && x.as<asmjit::x86::Gp>().id() == y.as<asmjit::x86::Gp>().id();
+    }
+
+    // [S+disp] with no index, where S is a stack register
+    static bool isStackMem(const asmjit::Operand& op)
+    {
+        if (!op.isMem()) return false;
+        const auto& mem = op.as<asmjit::x86::Mem>();
+        return mem.hasBaseReg() && !mem.hasIndex() && mem.baseId() >= asmjit::x86::Gp::kIdR12
+            && mem.baseId() <= asmjit::x86::Gp::kIdR15 && (mem.size() == 0 || mem.size() == 8);
+    }
+
+    static bool sameMem(const asmjit::Operand& x, const asmjit::Operand& y)
+    {
+        const auto& a = x.as<asmjit::x86::Mem>();
+        const auto& b = y.as<asmjit::x86::Mem>();
+        return a.baseId() == b.baseId() && a.offset() == b.offset();
+    }
+
+    // next instruction node, skipping comments, nullptr at a label or other node
+    static asmjit::InstNode* nextInst(asmjit::BaseNode* node)
+    {
+        for (node = node->next(); node != nullptr; node = node->next())
+        {
+            if (node->isInst()) return node->as<asmjit::InstNode>();
+            if (node->type() != asmjit::NodeType::kComment) return nullptr;
+        }
+        return nullptr;
+    }
+
+    // A rule matches at most four instructions, so a rewrite at `node` can only make a new
+    // match that starts up to three instructions before it. Returns the earliest of those,
+    // stopping at a label or `from`, or nullptr when there is nothing before `node`.
+    static asmjit::BaseNode* resumePoint(asmjit::BaseNode* node, const asmjit::BaseNode* from)
+    {
+        asmjit::BaseNode* resume = nullptr;
+        for (int back = 0; back < 3;)
+        {
+            node = node->prev();
+            if (node == nullptr || node == from) break;
+            resume = node;
+            if (node->isInst()) back++;
+            else if (node->type() != asmjit::NodeType::kComment) break;
+        }
+        return resume;
+    }
+
+    static bool is(const asmjit::InstNode* inst, asmjit::InstId id, uint32_t opCount)
+    {
+        return inst != nullptr && inst->id() == id && inst->opCount() == opCount;
+    }
+
+    // mov [S+disp],reg
+    static bool isStore(const asmjit::InstNode* inst)
+    {
+        return is(inst, asmjit::x86::Inst::kIdMov, 2) && isStackMem(inst->op(0)) && isGp64(inst->op(1));
+    }
+
+    // mov reg,[S+disp]
+    static bool isLoad(const asmjit::InstNode* inst)
+    {
+        return is(inst, asmjit::x86::Inst::kIdMov, 2) && isGp64(inst->op(0)) && isStackMem(inst->op(1));
+    }
+
+    // add S,imm or sub S,imm, returns the signed adjustment
+    static bool isStackAdjust(const asmjit::InstNode* inst, int64_t& amount)
+    {
+        if (inst == nullptr || inst->opCount() != 2) return false;
+        if (inst->id() != asmjit::x86::Inst::kIdAdd && inst->id() != asmjit::x86::Inst::kIdSub) return false;
+        if (!isStackReg(inst->op(0)) || !inst->op(1).isImm()) return false;
+        amount = inst->op(1).as<asmjit::Imm>().value();
+        if (inst->id() == asmjit::x86::Inst::kIdSub) amount = -amount;
+        return true;
+    }
+
+    // true if the flags set by the instruction before `node` may still be read.
+    static bool flagsLive(const asmjit::BaseNode* node)
+    {
+        constexpr auto status = asmjit::CpuRWFlags::kX86_CF | asmjit::CpuRWFlags::kX86_OF |
+            asmjit::CpuRWFlags::kX86_SF | asmjit::CpuRWFlags::kX86_ZF |
+            asmjit::CpuRWFlags::kX86_AF | asmjit::CpuRWFlags::kX86_PF;
+
+        for (node = node->next(); node != nullptr; node = node->next())
+        {
+            if (node->type() == asmjit::NodeType::kComment) continue;
+            if (!node->isInst()) return true;
+
+            const auto* inst = node->as<asmjit::InstNode>();
+            // flags are not preserved over a call or a return
+            if (inst->id() == asmjit::x86::Inst::kIdCall || inst->id() == asmjit::x86::Inst::kIdRet) return false;
+            if (inst->id() == asmjit::x86::Inst::kIdJmp) return true;
+
+            asmjit::InstRWInfo rw;
+            if (asmjit::InstAPI::queryRWInfo(asmjit::Arch::kX64, inst->baseInst(), inst->operands(),
+                                             inst->opCount(), &rw) != asmjit::kErrorOk)
+                return true;
+            if ((rw.readFlags() & status) != asmjit::CpuRWFlags::kNone) return true;
+            if ((rw.writeFlags() & status) == status) return false;
+        }
+        return false;
+    }
+
+    static void setStackAdjust(asmjit::InstNode* inst, int64_t amount)
+    {
+        inst->setId(amount > 0 ? asmjit::x86::Inst::kIdAdd : asmjit::x86::Inst::kIdSub);
+        inst->setOp(1, asmjit::Imm(amount > 0 ? amount : -amount));
+    }
+
+    // try each rule at `inst`, returns the number of instructions removed
+    static int rewrite(asmjit::x86::Builder& b, asmjit::InstNode* inst)
+    {
+        // nop
+        if (is(inst, asmjit::x86::Inst::kIdNop, 0))
+        {
+            b.removeNode(inst);
+            return 1;
+        }
+
+        // mov X,X
+        if (is(inst, asmjit::x86::Inst::kIdMov, 2) && isGp64(inst->op(0)) && sameReg(inst->op(0), inst->op(1)))
+        {
+            b.removeNode(inst);
+            return 1;
+        }
+
+        asmjit::InstNode* second = nextInst(inst);
+        if (second == nullptr) return 0;
+
+        // jmp L ; X   =>   jmp L
+        if (is(inst, asmjit::x86::Inst::kIdJmp, 1))
+        {
+            b.removeNode(second);
+            return 1;
+        }
+
+        // sub S,8 ; mov [S],X ; mov Y,[S] ; add S,8   =>   mov Y,X
+        int64_t down = 0;
+        if (isStackAdjust(inst, down) && down < 0 && isStore(second))
+        {
+            asmjit::InstNode* third = nextInst(second);
+            asmjit::InstNode* fourth = third ? nextInst(third) : nullptr;
+            int64_t up = 0;
+            if (isLoad(third) && isStackAdjust(fourth, up) && up == -down
+                && sameReg(inst->op(0), fourth->op(0))
+                && sameMem(second->op(0), third->op(1))
+                && second->op(0).as<asmjit::x86::Mem>().baseId() == inst->op(0).as<asmjit::x86::Gp>().id()
+                && second->op(0).as<asmjit::x86::Mem>().offset() >= 0
+                && second->op(0).as<asmjit::x86::Mem>().offset() + 8 <= -down
+                && !isStackReg(second->op(1)) && !isStackReg(third->op(0))
+                && !flagsLive(fourth))
+            {
+                third->setOp(1, second->op(1));
+                b.removeNode(inst);
+                b.removeNode(second);
+                b.removeNode(fourth);
+                return 3;
+            }
+        }
+
+        // add S,a ; add S,b   =>   add S,a+b
+        int64_t first = 0;
+        int64_t next = 0;
+        if (isStackAdjust(inst, first) && isStackAdjust(second, next) && sameReg(inst->op(0), second->op(0))
+            && !flagsLive(second))
+        {
+            const int64_t total = first + next;
+            b.removeNode(second);
+            if (total == 0)
+            {
+                b.removeNode(inst);
+                return 2;
+            }
+            setStackAdjust(inst, total);
+            return 1;
+        }
+
+        // mov [S],X ; mov Y,[S]   =>   mov [S],X ; mov Y,X
+        if (isStore(inst) && isLoad(second) && sameMem(inst->op(0), second->op(1)))
+        {
+            if (sameReg(inst->op(1), second->op(0)))
+            {
+                b.removeNode(second);
+                return 1;
+            }
+            second->setOp(1, inst->op(1));
+            return 0;
+        }
+
+        // mov X,[S] ; mov [S],X   =>   mov X,[S]
+        if (isLoad(inst) && isStore(second) && sameMem(inst->op(1), second->op(0))
+            && sameReg(inst->op(0), second->op(1)))
+        {
+            b.removeNode(second);
+            return 1;
+        }
+
+        return 0;
+    }
+};
+
+#endif //JITPEEPHOLE_H
@@ -7,12 +7,20 @@
 #include <iostream>
 #include <algorithm>
 #include "StringInterner.h"
+#include "include/asmjit/asmjit.h"
 
 inline StringInterner& strIntern = StringInterner::getInstance();
 
 // Forward declaration
 class jitGenerator;
 
+// The data, return, locals and string stacks each sit between two guard areas that can not
+// be read or written. A push past the bottom of a stack, or a pop past its top, in generated
+// code faults, and the fault handler in quit.cpp asks stackFault which stack the address
+// belongs to and reports the overflow or underflow before going back to the interpreter.
+// The pushes and pops here are made from C++, where a fault is not recovered, so they check
+// the depth and throw instead.
+
 class StackManager
 {
 public:
@@ -28,16 +36,15 @@ public:
     // Data Stack Operations
     void pushDS(uint64_t value)
     {
-        if (dsPtr == dsStack)
-        {
-            printf("DS stack overflow\n");
-            throw std::runtime_error("DS stack overflow");
-        }
-
         asm volatile (
             "mov %%r15, %0;"
             : "=r"(dsPtr) // output
         );
+        if (dsPtr <= dsStack)
+        {
+            printf("DS stack overflow\n");
+            throw std::runtime_error("DS stack overflow");
+        }
 
         dsPtr--;
         *dsPtr = value;
@@ -51,12 +58,6 @@ public:
 
     void pushDSDouble(double value)
     {
-        if (dsPtr == dsStack)
-        {
-            printf("DS stack overflow\n");
-            throw std::runtime_error("DS stack overflow");
-        }
-
         uint64_t* ptrToUint64 = reinterpret_cast<uint64_t*>(&value);
         uint64_t intValue = *ptrToUint64;
 
@@ -64,6 +65,11 @@ public:
             "mov %%r15, %0;"
             : "=r"(dsPtr) // output
         );
+        if (dsPtr <= dsStack)
+        {
+            printf("DS stack overflow\n");
+            throw std::runtime_error("DS stack overflow");
+        }
 
         dsPtr--;
         *dsPtr = intValue;
@@ -94,7 +100,7 @@ public:
         );
 
         int dsDepth = dsTop - dsPtr;
-        if (dsDepth < 0)
+        if (dsDepth <= 0)
         {
             printf("DS stack underflow\n");
             throw std::runtime_error("DS stack underflow");
@@ -119,7 +125,7 @@ public:
         );
 
         int dsDepth = dsTop - dsPtr;
-        if (dsDepth < 0)
+        if (dsDepth <= 0)
         {
             printf("DS stack underflow\n");
             throw std::runtime_error("DS stack underflow");
@@ -144,16 +150,15 @@ public:
     // Return Stack Operations
     void pushRS(uint64_t value)
     {
-        if (rsPtr == rsStack)
-        {
-            printf("RS stack overflow\n");
-            throw std::runtime_error("RS stack overflow");
-        }
-
         asm volatile (
             "mov %%r14, %0;"
             : "=r"(rsPtr) // output
         );
+        if (rsPtr <= rsStack)
+        {
+            printf("RS stack overflow\n");
+            throw std::runtime_error("RS stack overflow");
+        }
 
         rsPtr--;
         *rsPtr = value;
@@ -184,7 +189,7 @@ public:
         );
 
         int rsDepth = rsTop - rsPtr;
-        if (rsDepth < 0)
+        if (rsDepth <= 0)
         {
             printf("RS stack underflow\n");
             throw std::runtime_error("RS stack underflow");
@@ -204,16 +209,15 @@ public:
     // Local Stack Operations
     void pushLS(uint64_t value)
     {
-        if (lsPtr == lsStack)
-        {
-            printf("LS stack overflow\n");
-            throw std::runtime_error("LS stack overflow");
-        }
-
         asm volatile (
             "mov %%r13, %0;"
             : "=r"(lsPtr) // output
         );
+        if (lsPtr <= lsStack)
+        {
+            printf("LS stack overflow\n");
+            throw std::runtime_error("LS stack overflow");
+        }
 
         lsPtr--;
         *lsPtr = value;
@@ -244,7 +248,7 @@ public:
         );
 
         int lsDepth = lsTop - lsPtr;
-        if (lsDepth < 0)
+        if (lsDepth <= 0)
         {
             printf("LS stack underflow\n");
             throw std::runtime_error("LS stack underflow");
@@ -264,16 +268,15 @@ public:
     // String Stack Operations
     void pushSS(uint64_t value)
     {
-        if (ssPtr == ssStack)
-        {
-            printf("SS stack overflow\n");
-            throw std::runtime_error("SS stack overflow");
-        }
-
         asm volatile (
             "mov %%r12, %0;"
             : "=r"(ssPtr) // output
         );
+        if (ssPtr <= ssStack)
+        {
+            printf("SS stack overflow\n");
+            throw std::runtime_error("SS stack overflow");
+        }
 
         ssPtr--;
         *ssPtr = value;
@@ -304,7 +307,7 @@ public:
         );
 
         int ssDepth = ssTop - ssPtr;
-        if (ssDepth < 0)
+        if (ssDepth <= 0)
         {
             printf("SS stack underflow\n");
             throw std::runtime_error("SS stack underflow");
@@ -328,6 +331,10 @@ public:
             "mov %%r12, %0;"
             : "=r"(ssPtr) // output
         );
+        if (ssPtr >= ssTop)
+        {
+            throw std::runtime_error("SS stack underflow");
+        }
         auto val = *ssPtr;
         return val;
     }
@@ -338,6 +345,10 @@ public:
             "mov %%r13, %0;"
             : "=r"(lsPtr) // output
         );
+        if (lsPtr >= lsTop)
+        {
+            throw std::runtime_error("LS stack underflow");
+        }
         auto val = *lsPtr;
         return val;
     }
@@ -348,6 +359,10 @@ public:
             "mov %%r15, %0;"
             : "=r"(dsPtr) // output
         );
+        if (dsPtr >= dsTop)
+        {
+            throw std::runtime_error("DS stack underflow");
+        }
         auto val = *dsPtr;
         return val;
     }
@@ -358,6 +373,10 @@ public:
             "mov %%r14, %0;"
             : "=r"(rsPtr) // output
         );
+        if (rsPtr >= rsTop)
+        {
+            throw std::runtime_error("RS stack underflow");
+        }
         auto val = *rsPtr;
         return val;
     }
@@ -501,6 +520,22 @@ public:
         return ssDepth / 8;
     }
 
+    // the error for a fault at address, nullptr if it is not in a guard area.
+    // Called from the fault handler, so it only compares addresses.
+    [[nodiscard]] const char* stackFault(const void* address) const
+    {
+        const auto* p = static_cast<const uint8_t*>(address);
+        for (const auto& guarded : guardedStacks)
+        {
+            if (guarded.region == nullptr) continue;
+            const uint8_t* bottom = guarded.region + GUARD_SIZE;
+            const uint8_t* end = guarded.region + guarded.regionSize;
+            if (p >= guarded.region && p < bottom) return guarded.overflow;
+            if (p >= end - GUARD_SIZE && p < end) return guarded.underflow;
+        }
+        return nullptr;
+    }
+
     void displayStacks() const
     {
         uint64_t* currentDsPtr;
@@ -555,23 +590,19 @@ public:
 private:
     StackManager() : dsSize(1024 * 1024 * 2), rsSize(1024 * 1024 * 1), lsSize(1024 * 1024), ssSize(1024 * 1024)
     {
-        dsStack = new uint64_t[dsSize];
-        rsStack = new uint64_t[rsSize];
-        lsStack = new uint64_t[lsSize];
-        ssStack = new uint64_t[ssSize];
-
-        std::fill(dsStack, dsStack + dsSize, 0);
-        std::fill(rsStack, rsStack + rsSize, 0);
-        std::fill(lsStack, lsStack + lsSize, 0);
-        std::fill(ssStack, ssStack + ssSize, 0);
+        dsStack = allocateStack(guardedStacks[0], dsSize, "DS stack overflow", "DS stack underflow");
+        rsStack = allocateStack(guardedStacks[1], rsSize, "RS stack overflow", "RS stack underflow");
+        lsStack = allocateStack(guardedStacks[2], lsSize, "LS stack overflow", "LS stack underflow");
+        ssStack = allocateStack(guardedStacks[3], ssSize, "SS stack overflow", "SS stack underflow");
 
-        dsTop = dsStack + dsSize - 4;
+        // each top is flush against its upper guard, so popping one cell too many faults
+        dsTop = dsStack + dsSize;
         dsPtr = dsTop;
-        rsTop = rsStack + rsSize - 4;
+        rsTop = rsStack + rsSize;
         rsPtr = rsTop;
-        lsTop = lsStack + lsSize - 4;
+        lsTop = lsStack + lsSize;
         lsPtr = lsTop;
-        ssTop = ssStack + ssSize - 4;
+        ssTop = ssStack + ssSize;
         ssPtr = ssTop;
 
         asm volatile (
@@ -601,12 +632,48 @@ private:
 
     ~StackManager()
     {
-        delete[] dsStack;
-        delete[] rsStack;
-        delete[] lsStack;
-        delete[] ssStack;
+        for (const auto& guarded : guardedStacks)
+        {
+            if (guarded.region != nullptr) asmjit::VirtMem::release(guarded.region, guarded.regionSize);
+        }
+    }
+
+    // larger than any offset generated code uses from a stack pointer, and a multiple of the page size
+    static constexpr size_t GUARD_SIZE = 64 * 1024;
+
+    struct GuardedStack
+    {
+        uint8_t* region = nullptr; // guard, stack, guard
+        size_t regionSize = 0;
+        const char* overflow = nullptr;
+        const char* underflow = nullptr;
+    };
+
+    // reserve a stack of cells between two guard areas, the memory starts out zeroed
+    static uint64_t* allocateStack(GuardedStack& guarded, const size_t cells, const char* overflow,
+                                   const char* underflow)
+    {
+        const size_t stackSize = cells * sizeof(uint64_t);
+        const size_t regionSize = GUARD_SIZE + stackSize + GUARD_SIZE;
+        void* p = nullptr;
+        if (asmjit::VirtMem::alloc(&p, regionSize, asmjit::VirtMem::MemoryFlags::kAccessRW) != asmjit::kErrorOk)
+        {
+            throw std::runtime_error("StackManager: cannot reserve the stacks");
+        }
+        auto* region = static_cast<uint8_t*>(p);
+        if (asmjit::VirtMem::protect(region, GUARD_SIZE, asmjit::VirtMem::MemoryFlags::kNone) != asmjit::kErrorOk ||
+            asmjit::VirtMem::protect(region + GUARD_SIZE + stackSize, GUARD_SIZE,
+                                     asmjit::VirtMem::MemoryFlags::kNone) != asmjit::kErrorOk)
+        {
+            asmjit::VirtMem::release(region, regionSize);
+            throw std::runtime_error("StackManager: cannot protect the stack guards");
+        }
+        guarded = {region, regionSize, overflow, underflow};
+        return reinterpret_cast<uint64_t*>(region + GUARD_SIZE);
     }
 
+    GuardedStack guardedStacks[4];
+
     uint64_t* dsStack;
     uint64_t* rsStack;
     uint64_t* lsStack;
@@ -1,286 +1,837 @@
 #ifndef STRINGINTERNER_H
 #define STRINGINTERNER_H
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
-#include <unordered_map>
-#include <vector>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "StringSearch.h"
+
+// Interned strings.
+// Each string is stored once, in an arena, as a header holding its length, hash and reference
+// count, followed by its characters and a terminating zero. A string stays where it is while
+// it is referenced, so the address given to JIT code stays valid until an image replaces the
+// strings.
+//
+// An index finds its entry through a table of segments that double in size, which never moves
+// either. A string finds its index through an open addressing hash table.
+//
+// Looking up a string, reading a string and changing reference counts take no lock.
+// Adding and removing a string take the writer lock.
+// The count is the first field of the header, so JIT code can find the entry of an index
+// through segmentTable() and change the count with lock inc and lock dec.
+// Everything that holds an index holds a reference: a string value, a compiled literal and
+// each value on the string stack, which the word that takes it off the stack drops.
+// A string whose count reaches zero is removed (removeIfUnused). Its index and its storage are
+// given to later strings once no lookup that could still see them is under way.
+// The hash table is replaced, never resized in place, and old tables are kept until no lookup
+// is under way, so a reader can always finish a probe it started.
+//
+// A value on the string stack is either an index or a slice: a part of an interned string
+// given by its base index, offset and length. These are kept in a table of slice descriptors,
+// and the value holds the top bit, the descriptor's generation and its index. A slice holds a
+// reference to its base string until it is dropped. Dropping a descriptor moves it to the next
+// generation before it is reused, so a copy of a dropped value is refused rather than read as
+// a later slice, and dropping it again does nothing.
+// Splitting a string makes slices and copies nothing. A slice becomes a string of its own
+// only when something keeps it (retain).
 
-class StringStorage
+class StringInterner
 {
 public:
-    // Adds a string and returns the index
-    size_t addString(const std::string& str)
+    // Returns the singleton instance of StringInterner.
+    static StringInterner& getInstance()
     {
-        strings.push_back(str);
-        return strings.size() - 1;
+        static StringInterner instance;
+        return instance;
     }
 
-    // Retrieves a string by its index
-    [[nodiscard]] std::string getString(size_t index) const
+    // Deletes the copy constructor and assignment operator to prevent copying.
+    StringInterner(const StringInterner&) = delete;
+    StringInterner& operator=(const StringInterner&) = delete;
+
+    // Interns a string and returns its index.
+    size_t intern(const std::string_view str)
     {
-        if (index >= strings.size())
+        const uint64_t hash = hashOf(str);
+        size_t index = 0;
         {
-            throw std::out_of_range("Index out of range");
+            const Lookup lookup(readers);
+            if (find(*table.load(std::memory_order_seq_cst), str, hash, index) && acquire(index))
+            {
+                return index;
+            }
         }
-        return strings[index];
-    }
 
-    [[nodiscard]] void* getStringAddress(const size_t index) const
-    {
-        if (index >= strings.size())
+        std::lock_guard<std::mutex> lock(writer);
+        if (find(*table.load(std::memory_order_acquire), str, hash, index) && acquire(index))
         {
-            throw std::out_of_range("Index out of range");
+            return index;
         }
-
-        const auto address = (void*)strings[index].c_str();
-        return address;
+        reclaim();
+        index = addEntry(str, hash, 1);
+        insert(index, hash);
+        return index;
     }
 
-    // Clears all stored strings
-    void clearStrings()
+    // Retrieves a string by its index.
+    [[nodiscard]] std::string getString(const size_t index) const
     {
-        strings.clear();
+        return std::string(view(index));
     }
 
-    // Removes a string by its index
-    void removeString(size_t index)
+    // The characters of the string or slice, they stay where they are once interned.
+    [[nodiscard]] std::string_view view(const size_t index) const
     {
-        if (index < strings.size())
+        if (isSlice(index))
         {
-            strings[index].clear(); // Clearing the string content
+            const Slice& part = sliceAt(index);
+            const std::string_view base = view(part.base);
+            return base.substr(std::min(part.offset, base.size()), part.length);
         }
+        const Entry* entry = entryAt(index);
+        return {entry->text(), entry->length};
     }
 
-private:
-    std::vector<std::string> strings;
-};
+    // a slice value has the top bit set, the generation of its descriptor in bits 32 to 62
+    // and the index of its descriptor below them
+    static constexpr uint64_t SLICE = uint64_t{1} << 63;
+    static constexpr int GENERATION_SHIFT = 32;
+    static constexpr uint64_t GENERATION_MASK = (uint64_t{1} << 31) - 1;
+    static constexpr uint64_t SLICE_ID_MASK = (uint64_t{1} << GENERATION_SHIFT) - 1;
 
-class StringInterner
-{
-public:
-    // Returns the singleton instance of StringInterner.
-    static StringInterner& getInstance()
+    [[nodiscard]] static bool isSlice(const uint64_t value)
     {
-        static StringInterner instance;
-        return instance;
+        return (value & SLICE) != 0;
     }
 
-    // Deletes the copy constructor and assignment operator to prevent copying.
-    StringInterner(const StringInterner&) = delete;
-    StringInterner& operator=(const StringInterner&) = delete;
-
-    // Interns a string and returns its index.
-    size_t intern(const std::string& str)
+    // A part of the string or slice at index, which takes a reference to the base string.
+    uint64_t slice(const uint64_t index, const size_t offset, const size_t length)
     {
+        uint64_t base = index;
+        size_t start = offset;
+        size_t size = length;
+        if (isSlice(index))
+        {
+            // a slice of a slice refers to the same base, within the outer slice
+            const Slice& outer = sliceAt(index);
+            base = outer.base;
+            start = outer.offset + std::min(offset, outer.length);
+            size = std::min(length, outer.length - std::min(offset, outer.length));
+        }
+        incrementRef(base);
 
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto it = intern_map.find(str);
-        if (it != intern_map.end())
+        std::lock_guard<std::mutex> lock(slicer);
+        size_t id = 0;
+        if (!freeSlices.empty())
+        {
+            id = freeSlices.back();
+            freeSlices.pop_back();
+        }
+        else
         {
-            ref_counts[it->second]++;
-            return it->second;
+            id = sliceCount.load(std::memory_order_relaxed);
+            size_t segment = 0;
+            size_t position = 0;
+            segmentOf(id, segment, position);
+            if (segment >= SEGMENTS || id > SLICE_ID_MASK)
+            {
+                throw std::runtime_error("StringInterner: too many slices");
+            }
+            if (sliceSegments[segment].load(std::memory_order_relaxed) == nullptr)
+            {
+                sliceStore.emplace_back(new Slice[FIRST_SEGMENT << segment]);
+                sliceSegments[segment].store(sliceStore.back().get(), std::memory_order_release);
+            }
+            sliceCount.store(id + 1, std::memory_order_release);
         }
+        Slice& part = sliceRef(id);
+        part.base = base;
+        part.offset = start;
+        part.length = size;
+        return SLICE | part.generation << GENERATION_SHIFT | id;
+    }
 
-        // Add the string to storage and get the index
-        size_t index = storage.addString(str);
-        intern_map[str] = index;
-        ref_counts[index] = 1;
+    // Drops a value taken off the string stack, which gives back its reference.
+    // A slice gives back its descriptor and its reference to the base string.
+    void drop(const uint64_t value)
+    {
+        if (!isSlice(value))
+        {
+            decrementRef(value);
+            return;
+        }
+        uint64_t base = 0;
+        {
+            std::lock_guard<std::mutex> lock(slicer);
+            Slice* part = liveSlice(value);
+            if (part == nullptr) return; // dropped already
+            base = part->base;
+            part->generation = (part->generation + 1) & GENERATION_MASK;
+            freeSlices.push_back(value & SLICE_ID_MASK);
+        }
+        decrementRef(base);
+    }
 
-        return index;
+    // Hands the reference of a value taken off the string stack to something that keeps the
+    // string, such as a string value. Returns the index that holds it, a slice is interned as a
+    // string of its own and dropped.
+    size_t retain(const uint64_t value)
+    {
+        if (isSlice(value))
+        {
+            const size_t index = intern(view(value));
+            drop(value);
+            return index;
+        }
+        return value;
     }
 
-    // Retrieves a string by its index.
-    std::string getString(size_t index) const
+    [[nodiscard]] void* getStringAddress(const size_t index) const
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return storage.getString(index);
+        return entryAt(index)->text();
     }
 
-    void* getStringAddress(size_t index) const
+    // The terminated characters of the string or slice. A slice is copied to a buffer of the
+    // calling thread, valid until its next call.
+    [[nodiscard]] const char* terminated(const uint64_t value) const
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return storage.getStringAddress(index);
+        if (!isSlice(value)) return static_cast<const char*>(getStringAddress(value));
+        thread_local std::string copy;
+        copy.assign(view(value));
+        return copy.c_str();
     }
 
     // increment ref for string at index
-    void incrementRef(size_t index)
+    void incrementRef(const size_t index)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (ref_counts.find(index) != ref_counts.end())
-        {
-            ref_counts[index]++;
-        }
+        if (index < size()) (void)acquire(index);
     }
 
-    // decrement ref for string at index
-    void decrementRef(size_t index)
+    // decrement ref for string at index, a string whose count reaches zero is removed
+    void decrementRef(const size_t index)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (ref_counts.find(index) != ref_counts.end())
+        if (index >= size()) return;
+        Entry* entry = entryAt(index);
+        int64_t refs = entry->refs.load(std::memory_order_relaxed);
+        while (refs > 0 && !entry->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_acq_rel))
         {
-            ref_counts[index]--;
-
-            // Release resources if the reference count drops to zero
-            if (ref_counts[index] <= 0)
-            {
-                removeString(index);
-            }
         }
+        if (refs == 1) removeIfUnused(index);
+    }
+
+    // Removes the string at index if its count is still zero. JIT code calls this when its
+    // lock dec takes a count to zero; a lookup may have taken the string back since.
+    void removeIfUnused(const size_t index)
+    {
+        std::lock_guard<std::mutex> lock(writer);
+        if (index >= size()) return;
+        Entry* entry = entryAt(index);
+        int64_t unused = 0;
+        if (!entry->refs.compare_exchange_strong(unused, REMOVED, std::memory_order_acq_rel)) return;
+        unlink(index, entry->hash);
+        setEntry(index, removedEntry);
+        removed.push_back(entry);
+        removedIndices.push_back(index);
+        reclaim();
     }
 
-    // Decreases the reference count of the string by its index and removes it if the count reaches zero.
-    void release(size_t index)
+    // Decreases the reference count of the string by its index.
+    void release(const size_t index)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
         decrementRef(index);
     }
 
-    void releaseIf1(size_t index)
+    // the index table, for JIT code that finds an entry itself
+    // segment k is at segmentTable()[k] and holds (1 << SEGMENT_SHIFT) << k entry pointers
+    [[nodiscard]] const void* segmentTable() const
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        // decrement ref for string at index
-        if (ref_counts.find(index) != ref_counts.end())
-        {
-            if (ref_counts[index] == 1)
-                decrementRef(index);
-        }
+        return segments;
+    }
+
+    // the number of indices given out, for JIT code that checks an index before using it
+    [[nodiscard]] const void* countAddress() const
+    {
+        return &count;
     }
 
+    static constexpr size_t SEGMENT_SHIFT = 10;
 
-    // Lists all interned strings along with their reference counts.
+    // Lists all referenced strings along with their reference counts.
     std::vector<std::pair<std::string, size_t>> list() const
     {
-        std::lock_guard<std::mutex> lock(mutex_);
         std::vector<std::pair<std::string, size_t>> list;
-        for (const auto& entry : intern_map)
+        for (size_t i = 0; i < size(); ++i)
         {
-            list.emplace_back(entry.first, ref_counts.at(entry.second));
+            const Entry* entry = entryAt(i);
+            if (entry->refs.load(std::memory_order_relaxed) <= 0) continue;
+            list.emplace_back(std::string(entry->text(), entry->length),
+                              static_cast<size_t>(entry->refs.load(std::memory_order_relaxed)));
         }
         return list;
     }
 
+    // The number of indices given out, removed ones included.
+    [[nodiscard]] size_t size() const
+    {
+        return count.load(std::memory_order_acquire);
+    }
+
+    // The reference count of the string at index, 0 once it has been removed.
+    [[nodiscard]] size_t refCount(const size_t index) const
+    {
+        if (index >= size()) return 0;
+        return static_cast<size_t>(std::max<int64_t>(entryAt(index)->refs.load(std::memory_order_relaxed), 0));
+    }
+
+    // Replaces every string with ones saved in an image, each keeps the index it was saved with.
+    // Addresses of the strings held before are no longer valid.
+    // A string saved with a count of zero had been removed, its index is free again.
+    void restore(const std::vector<std::string>& strings, const std::vector<size_t>& counts)
+    {
+        std::lock_guard<std::mutex> lock(writer);
+        clear();
+        std::vector<size_t> unused;
+        for (size_t i = 0; i < strings.size(); ++i)
+        {
+            if (counts[i] == 0)
+            {
+                unused.push_back(append(removedEntry));
+                continue;
+            }
+            const uint64_t hash = hashOf(strings[i]);
+            insert(addEntry(strings[i], hash, static_cast<int64_t>(counts[i])), hash);
+        }
+        freeIndices = std::move(unused);
+    }
+
     // Displays list of strings, their indices, and reference counts.
     void display_list() const
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        for (const auto& entry : intern_map)
+        for (size_t i = 0; i < size(); ++i)
         {
-            const auto& str = entry.first;
-            const auto index = entry.second;
-            const auto ref_count = ref_counts.at(index);
-            const auto address = storage.getStringAddress(index);
-            std::cout << "[" << str << "] (Index: " << index << ", Ref Count: " << ref_count << ", Address: " << address
-                << ")" << std::endl;
+            const Entry* entry = entryAt(i);
+            if (entry->refs.load(std::memory_order_relaxed) <= 0) continue;
+            std::cout << "[" << std::string_view(entry->text(), entry->length) << "] (Index: " << i << ", Ref Count: "
+                << entry->refs.load(std::memory_order_relaxed) << ", Address: "
+                << static_cast<const void*>(entry->text()) << ")" << std::endl;
         }
     }
 
     // Concatenate two strings by their indices and intern the result.
     size_t StringCat(const size_t index1, const size_t index2)
     {
-        const std::string newStr = getString(index1) + getString(index2);
+        const std::string_view s1 = view(index1);
+        const std::string_view s2 = view(index2);
+        std::string newStr;
+        newStr.reserve(s1.size() + s2.size());
+        newStr.append(s1).append(s2);
         return intern(newStr);
     }
 
     // Compare two strings by their indices to check if they are the same.
-    bool StrEqual(const size_t index1, const size_t index2) const
+    [[nodiscard]] bool StrEqual(const size_t index1, const size_t index2) const
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return getString(index1) == getString(index2);
+        return view(index1) == view(index2);
     }
 
-    bool StrContains(size_t index1, size_t index2) const
+    [[nodiscard]] bool StrContains(const size_t index1, const size_t index2) const
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return getString(index1).find(getString(index2)) != std::string::npos;
+        return StringSearch::find(view(index1), view(index2)) != std::string_view::npos;
     }
 
     // Return the position of the string at index1 within the string at index2, or -1 if not found.
-    int StrPos(size_t index1, size_t index2) const
+    [[nodiscard]] int StrPos(const size_t index1, const size_t index2) const
     {
-        size_t pos = getString(index2).find(getString(index1));
-        return (pos != std::string::npos) ? static_cast<int>(pos) : -1;
+        const size_t pos = StringSearch::find(view(index2), view(index1));
+        return (pos != std::string_view::npos) ? static_cast<int>(pos) : -1;
     }
 
 
-    // Split the string at index1 by the string at index2 and return the interned string at the given position.
-    size_t StringSplit(size_t index1, size_t delimiterIndex, size_t position)
+    // Split the string at index1 by the string at index2 and return a slice of the field at the given position.
+    uint64_t StringSplit(const uint64_t index1, const uint64_t delimiterIndex, const size_t position)
     {
-
-        std::string str = getString(index1);
-        std::string delimiter = getString(delimiterIndex);
+        const std::string_view str = view(index1);
+        const std::string_view delimiter = view(delimiterIndex);
         size_t start = 0;
-        size_t end = 0;
         size_t current_pos = 0;
+        uint64_t field = 0;
+        bool found = false;
 
-        while ((end = str.find(delimiter, start)) != std::string::npos)
+        StringSearch::forEach(str, delimiter, [&](const size_t end)
         {
             if (current_pos == position)
             {
-                return intern(str.substr(start, end - start));
+                field = slice(index1, start, end - start);
+                found = true;
+                return false;
             }
             start = end + delimiter.length();
             ++current_pos;
-        }
+            return true;
+        });
 
+        if (found) return field;
         if (current_pos == position)
         {
-            return intern(str.substr(start));
+            return slice(index1, start, str.size() - start);
         }
 
         throw std::out_of_range("Position exceeds the number of substrings");
     }
 
+    // The first field of the string at index1 and the rest after its delimiter, both slices.
+    // Returns false, and leaves both alone, once the string is empty.
+    bool NextField(const uint64_t index1, const uint64_t delimiterIndex, uint64_t& field, uint64_t& rest)
+    {
+        const std::string_view str = view(index1);
+        if (str.empty()) return false;
+        const std::string_view delimiter = view(delimiterIndex);
+        const size_t end = delimiter.empty() ? std::string_view::npos : StringSearch::find(str, delimiter);
+        if (end == std::string_view::npos)
+        {
+            field = slice(index1, 0, str.size());
+            rest = slice(index1, str.size(), 0);
+            return true;
+        }
+        field = slice(index1, 0, end);
+        rest = slice(index1, end + delimiter.size(), str.size() - end - delimiter.size());
+        return true;
+    }
 
     // Count the number of fields in the string at index1 that would result from splitting by the string at delimiterIndex.
-    size_t CountFields(size_t index1, size_t delimiterIndex) const
+    [[nodiscard]] size_t CountFields(const size_t index1, const size_t delimiterIndex) const
     {
-        std::string str = getString(index1);
-        std::string delimiter = getString(delimiterIndex);
-        size_t field_count = 0;
-        size_t start = 0;
-        size_t end = 0;
+        const std::string_view str = view(index1);
+        const std::string_view delimiter = view(delimiterIndex);
+        // a one byte delimiter is counted with the compares alone, a trailing one ends the last field
+        if (delimiter.size() == 1 && !str.empty())
+        {
+            return 1 + StringSearch::count(str, delimiter) - (str.back() == delimiter[0] ? 1 : 0);
+        }
+        return StringSearch::fieldOffsets(str, delimiter, nullptr, 0);
+    }
+
+    // Write the offset of each field of the string at index1 to offsets, as many as fit.
+    // Returns the number of fields, the same as CountFields.
+    size_t FieldOffsets(const uint64_t index1, const uint64_t delimiterIndex, uint64_t* offsets,
+                        const size_t capacity) const
+    {
+        return StringSearch::fieldOffsets(view(index1), view(delimiterIndex), offsets, capacity);
+    }
+
+
+private:
+    StringInterner()
+    {
+        std::lock_guard<std::mutex> lock(writer);
+        clear();
+    }
+
+    // a part of a base string, a slice value holds the index of one
+    struct Slice
+    {
+        uint64_t base = 0;
+        size_t offset = 0;
+        size_t length = 0;
+        uint64_t generation = 0; // the values of earlier generations have been dropped
+    };
+
+    // slice descriptors are stored in segments like the index table, so they never move
+    [[nodiscard]] Slice& sliceRef(const size_t id) const
+    {
+        size_t segment = 0;
+        size_t position = 0;
+        segmentOf(id, segment, position);
+        return sliceSegments[segment].load(std::memory_order_acquire)[position];
+    }
 
-        while ((end = str.find(delimiter, start)) != std::string::npos)
+    // the descriptor of a slice value, nullptr once the value has been dropped
+    [[nodiscard]] Slice* liveSlice(const uint64_t value) const
+    {
+        const uint64_t id = value & SLICE_ID_MASK;
+        if (id >= sliceCount.load(std::memory_order_acquire))
         {
-            ++field_count;
-            start = end + delimiter.length();
+            throw std::out_of_range("Slice out of range");
+        }
+        Slice& part = sliceRef(id);
+        if (part.generation != ((value & ~SLICE) >> GENERATION_SHIFT)) return nullptr;
+        return &part;
+    }
+
+    [[nodiscard]] const Slice& sliceAt(const uint64_t value) const
+    {
+        const Slice* part = liveSlice(value);
+        if (part == nullptr)
+        {
+            throw std::out_of_range("Slice has been dropped");
+        }
+        return *part;
+    }
+
+    // counts the lookups under way, which may still read a retired table
+    class Lookup
+    {
+    public:
+        explicit Lookup(std::atomic<size_t>& readers) : readers(readers)
+        {
+            readers.fetch_add(1, std::memory_order_seq_cst);
+        }
+
+        ~Lookup()
+        {
+            readers.fetch_sub(1, std::memory_order_release);
+        }
+
+        Lookup(const Lookup&) = delete;
+        Lookup& operator=(const Lookup&) = delete;
+
+    private:
+        std::atomic<size_t>& readers;
+    };
+
+    // the header in front of the characters of each string
+    struct Entry
+    {
+        std::atomic<int64_t> refs;
+        uint64_t hash;
+        size_t length;
+
+        [[nodiscard]] char* text() const
+        {
+            return reinterpret_cast<char*>(const_cast<Entry*>(this) + 1);
+        }
+    };
+
+    // JIT code addresses the count as qword [entry] and the index table as plain pointers
+    static_assert(offsetof(Entry, refs) == 0);
+    static_assert(sizeof(std::atomic<int64_t>) == 8 && std::atomic<int64_t>::is_always_lock_free);
+    static_assert(sizeof(std::atomic<Entry*>) == sizeof(Entry*));
+    static_assert(sizeof(std::atomic<size_t>) == sizeof(size_t) && std::atomic<size_t>::is_always_lock_free);
+
+    // a hash table slot holds index + 1, or one of these
+    static constexpr uint64_t EMPTY = 0;
+    static constexpr uint64_t TOMBSTONE = ~uint64_t{0}; // a removed string, probes go past it
+
+    // the count of a removed string, which can not be taken back
+    static constexpr int64_t REMOVED = std::numeric_limits<int64_t>::min();
+
+    struct Table
+    {
+        explicit Table(const size_t capacity) : mask(capacity - 1), slots(new std::atomic<uint64_t>[capacity])
+        {
+            for (size_t i = 0; i < capacity; ++i) slots[i].store(EMPTY, std::memory_order_relaxed);
         }
 
-        // Account for the last field after the final delimiter
-        if (start < str.length())
+        size_t mask;
+        size_t used = 0; // slots that are not EMPTY, written under the writer lock
+        std::unique_ptr<std::atomic<uint64_t>[]> slots;
+    };
+
+    static constexpr size_t INITIAL_TABLE = 1024;
+    static constexpr size_t ARENA_BLOCK = 64 * 1024;
+    // entries are stored in blocks of MIN_BLOCK << k bytes, a free list for each k
+    static constexpr size_t MIN_BLOCK = 32;
+    static constexpr size_t BLOCK_CLASSES = 48;
+    // segment k of the index table holds FIRST_SEGMENT << k entries
+    static constexpr size_t FIRST_SEGMENT = size_t{1} << SEGMENT_SHIFT;
+    static constexpr size_t SEGMENTS = 40;
+
+    static uint64_t hashOf(const std::string_view str)
+    {
+        return std::hash<std::string_view>{}(str);
+    }
+
+    // the segment and the position in it of an index
+    static void segmentOf(const size_t index, size_t& segment, size_t& offset)
+    {
+        const size_t n = index / FIRST_SEGMENT + 1;
+        segment = std::bit_width(n) - 1;
+        offset = index - ((FIRST_SEGMENT << segment) - FIRST_SEGMENT);
+    }
+
+    [[nodiscard]] Entry* entryAt(const size_t index) const
+    {
+        if (index >= size())
         {
-            ++field_count;
+            throw std::out_of_range("Index out of range");
         }
+        size_t segment = 0;
+        size_t offset = 0;
+        segmentOf(index, segment, offset);
+        return segments[segment].load(std::memory_order_acquire)[offset].load(std::memory_order_acquire);
+    }
 
-        return field_count;
+    // take a reference to a string, false once it has been removed
+    // a string at zero that is not removed yet is taken back
+    bool acquire(const size_t index)
+    {
+        Entry* entry = entryAt(index);
+        int64_t refs = entry->refs.load(std::memory_order_relaxed);
+        do
+        {
+            if (refs == REMOVED) return false;
+        }
+        while (!entry->refs.compare_exchange_weak(refs, refs + 1, std::memory_order_acq_rel));
+        return true;
     }
 
+    bool find(const Table& t, const std::string_view str, const uint64_t hash, size_t& index) const
+    {
+        for (size_t i = hash & t.mask;; i = (i + 1) & t.mask)
+        {
+            const uint64_t slot = t.slots[i].load(std::memory_order_seq_cst);
+            if (slot == EMPTY) return false;
+            if (slot == TOMBSTONE) continue;
+            const Entry* entry = entryAt(slot - 1);
+            if (entry->hash == hash && entry->length == str.size() &&
+                std::memcmp(entry->text(), str.data(), str.size()) == 0)
+            {
+                index = slot - 1;
+                return true;
+            }
+        }
+    }
 
+    // the rest is called with the writer lock held
 
+    // the block size class of an entry of bytes: the smallest k with MIN_BLOCK << k >= bytes
+    static size_t blockClass(const size_t bytes)
+    {
+        return std::bit_width((std::max(bytes, MIN_BLOCK) - 1) / MIN_BLOCK);
+    }
 
+    static size_t entryBytes(const size_t length)
+    {
+        return sizeof(Entry) + length + 1;
+    }
 
-private:
-    StringInterner() = default; // Private constructor for singleton.
+    // a block from the arena for an entry of bytes, the block of a removed string if one fits
+    char* allocate(const size_t bytes)
+    {
+        const size_t k = blockClass(bytes);
+        if (k >= BLOCK_CLASSES)
+        {
+            throw std::runtime_error("StringInterner: string too long");
+        }
+        if (!freeBlocks[k].empty())
+        {
+            char* p = freeBlocks[k].back();
+            freeBlocks[k].pop_back();
+            return p;
+        }
+        const size_t size = MIN_BLOCK << k;
+        if (arenaUsed + size > arenaSize)
+        {
+            arenaSize = std::max(ARENA_BLOCK, size);
+            blocks.emplace_back(new char[arenaSize]);
+            arenaUsed = 0;
+        }
+        char* p = blocks.back().get() + arenaUsed;
+        arenaUsed += size;
+        return p;
+    }
+
+    // copy a string into the arena and give it an index, one of a removed string if any is free
+    size_t addEntry(const std::string_view str, const uint64_t hash, const int64_t refs)
+    {
+        auto* entry = new(allocate(entryBytes(str.size()))) Entry{};
+        entry->refs.store(refs, std::memory_order_relaxed);
+        entry->hash = hash;
+        entry->length = str.size();
+        std::memcpy(entry->text(), str.data(), str.size());
+        entry->text()[str.size()] = '\0';
+
+        if (freeIndices.empty()) return append(entry);
+        const size_t index = freeIndices.back();
+        freeIndices.pop_back();
+        setEntry(index, entry);
+        return index;
+    }
+
+    void setEntry(const size_t index, Entry* entry)
+    {
+        size_t segment = 0;
+        size_t offset = 0;
+        segmentOf(index, segment, offset);
+        segments[segment].load(std::memory_order_relaxed)[offset].store(entry, std::memory_order_release);
+    }
+
+    // give the entry the next index
+    size_t append(Entry* entry)
+    {
+        const size_t index = count.load(std::memory_order_relaxed);
+        size_t segment = 0;
+        size_t offset = 0;
+        segmentOf(index, segment, offset);
+        if (segment >= SEGMENTS)
+        {
+            throw std::runtime_error("StringInterner: too many strings");
+        }
+        if (segments[segment].load(std::memory_order_relaxed) == nullptr)
+        {
+            const size_t length = FIRST_SEGMENT << segment;
+            segmentStore.emplace_back(new std::atomic<Entry*>[length]);
+            segments[segment].store(segmentStore.back().get(), std::memory_order_release);
+        }
+        segments[segment].load(std::memory_order_relaxed)[offset].store(entry, std::memory_order_release);
+        count.store(index + 1, std::memory_order_release);
+        return index;
+    }
+
+    void insert(const size_t index, const uint64_t hash)
+    {
+        Table* t = table.load(std::memory_order_relaxed);
+        // keep at least half the slots empty
+        if ((t->used + 1) * 2 > t->mask + 1)
+        {
+            t = rebuild();
+        }
+        for (size_t i = hash & t->mask;; i = (i + 1) & t->mask)
+        {
+            if (t->slots[i].load(std::memory_order_relaxed) == EMPTY)
+            {
+                t->slots[i].store(index + 1, std::memory_order_release);
+                t->used++;
+                return;
+            }
+        }
+    }
+
+    // take the slot of a removed string out of the hash table
+    void unlink(const size_t index, const uint64_t hash)
+    {
+        const Table* t = table.load(std::memory_order_relaxed);
+        for (size_t i = hash & t->mask;; i = (i + 1) & t->mask)
+        {
+            const uint64_t slot = t->slots[i].load(std::memory_order_relaxed);
+            if (slot == EMPTY) return;
+            if (slot == index + 1)
+            {
+                t->slots[i].store(TOMBSTONE, std::memory_order_release);
+                return;
+            }
+        }
+    }
 
-    // Private members for holding the interned strings and mutex for thread safety.
-    std::unordered_map<std::string, size_t> intern_map;
-    std::unordered_map<size_t, size_t> ref_counts; // Store ref counts by index
-    mutable std::mutex mutex_; // Mutable to allow locking in const functions.
-    StringStorage storage; // Storage for the interned strings
+    // a new table with every string, large enough to leave room to grow, without tombstones
+    Table* rebuild()
+    {
+        const Table* old = table.load(std::memory_order_relaxed);
+        size_t live = 0;
+        for (size_t i = 0; i <= old->mask; ++i)
+        {
+            const uint64_t slot = old->slots[i].load(std::memory_order_relaxed);
+            if (slot != EMPTY && slot != TOMBSTONE) live++;
+        }
+        size_t capacity = INITIAL_TABLE;
+        while (capacity < (live + 1) * 4) capacity *= 2;
 
-    void removeString(size_t index)
+        auto fresh = std::make_unique<Table>(capacity);
+        for (size_t i = 0; i <= old->mask; ++i)
+        {
+            const uint64_t slot = old->slots[i].load(std::memory_order_relaxed);
+            if (slot == EMPTY || slot == TOMBSTONE) continue;
+            for (size_t j = entryAt(slot - 1)->hash & fresh->mask;; j = (j + 1) & fresh->mask)
+            {
+                if (fresh->slots[j].load(std::memory_order_relaxed) == EMPTY)
+                {
+                    fresh->slots[j].store(slot, std::memory_order_relaxed);
+                    fresh->used++;
+                    break;
+                }
+            }
+        }
+        Table* t = fresh.get();
+        tables.push_back(std::move(fresh));
+        table.store(t, std::memory_order_seq_cst);
+        return t;
+    }
+
+    // Frees the retired tables, and the indices and blocks of removed strings, once no lookup
+    // is under way. A lookup that starts later only sees the current table, where the removed
+    // strings are tombstones. The stores that retire a table or a slot, the count of lookups
+    // and the loads of a lookup are all sequentially consistent, so a lookup either is counted
+    // or sees the change.
+    void reclaim()
     {
-        auto it = std::find_if(intern_map.begin(), intern_map.end(),
-                               [index](const auto& pair) { return pair.second == index; });
-        if (it != intern_map.end())
+        if (readers.load(std::memory_order_seq_cst) != 0) return;
+        tables.erase(tables.begin(), tables.end() - 1);
+        for (const Entry* entry : removed)
         {
-            intern_map.erase(it);
-            ref_counts.erase(index);
-            storage.removeString(index);
+            freeBlocks[blockClass(entryBytes(entry->length))].push_back(reinterpret_cast<char*>(const_cast<Entry*>(entry)));
         }
+        removed.clear();
+        freeIndices.insert(freeIndices.end(), removedIndices.begin(), removedIndices.end());
+        removedIndices.clear();
+    }
+
+    void clear()
+    {
+        tables.clear();
+        tables.push_back(std::make_unique<Table>(INITIAL_TABLE));
+        table.store(tables.back().get(), std::memory_order_release);
+        count.store(0, std::memory_order_release);
+        for (auto& segment : segments) segment.store(nullptr, std::memory_order_relaxed);
+        segmentStore.clear();
+        blocks.clear();
+        arenaUsed = 0;
+        arenaSize = 0;
+        for (auto& free : freeBlocks) free.clear();
+        freeIndices.clear();
+        removed.clear();
+        removedIndices.clear();
+
+        // every removed index reads as this, an empty string that can not be taken back
+        removedEntry = new(allocate(entryBytes(0))) Entry{};
+        removedEntry->refs.store(REMOVED, std::memory_order_relaxed);
+        removedEntry->hash = ~hashOf({});
+        removedEntry->length = 0;
+        removedEntry->text()[0] = '\0';
+
+        std::lock_guard<std::mutex> lock(slicer);
+        sliceCount.store(0, std::memory_order_release);
+        for (auto& segment : sliceSegments) segment.store(nullptr, std::memory_order_relaxed);
+        sliceStore.clear();
+        freeSlices.clear();
     }
+
+    std::atomic<Table*> table{nullptr};
+    std::atomic<size_t> count{0};
+    std::atomic<std::atomic<Entry*>*> segments[SEGMENTS]{};
+    std::atomic<size_t> readers{0};
+
+    std::mutex writer;
+    // the memory behind the pointers above, only changed under the writer lock
+    std::vector<std::unique_ptr<Table>> tables;
+    std::vector<std::unique_ptr<std::atomic<Entry*>[]>> segmentStore;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t arenaUsed = 0;
+    size_t arenaSize = 0;
+    std::vector<char*> freeBlocks[BLOCK_CLASSES];
+    std::vector<size_t> freeIndices;
+    // removed strings whose index and block wait until no lookup is under way
+    std::vector<Entry*> removed;
+    std::vector<size_t> removedIndices;
+    Entry* removedEntry = nullptr;
+
+    // slice descriptors, given out and dropped under their own lock
+    std::mutex slicer;
+    std::atomic<size_t> sliceCount{0};
+    std::atomic<Slice*> sliceSegments[SEGMENTS]{};
+    std::vector<std::unique_ptr<Slice[]>> sliceStore;
+    std::vector<size_t> freeSlices;
 };
 
 #endif // STRINGINTERNER_H
@@ -0,0 +1,202 @@
+#ifndef STRINGSEARCH_H
+#define STRINGSEARCH_H
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <emmintrin.h>
+#include <immintrin.h>
+#include "jitContext.h"
+
+// String search.
+// Finds a needle, such as a field delimiter, in a string with SIMD compares, AVX2 when the
+// context found it in the processor (JitContext::detectSimd) and SSE2 otherwise. Each block compares the first byte of the needle
+// against every position, and its last byte against the position needle length - 1 further
+// on. Only positions where both match are compared in full, so a search seldom looks at a
+// byte twice, and a one byte delimiter is found with the compares alone.
+//
+// Matches are reported left to right and do not overlap, as repeated std::string_view::find
+// calls from the end of the last match would give. An empty needle matches nothing,
+// except in find.
+
+#if defined(__GNUC__) || defined(__clang__)
+#define STRING_SEARCH_AVX2 __attribute__((target("avx2")))
+#else
+#define STRING_SEARCH_AVX2
+#endif
+
+class StringSearch
+{
+public:
+    // calls found(position) for each match, stops early when found returns false
+    template <class F>
+    static void forEach(const std::string_view text, const std::string_view needle, F&& found)
+    {
+        if (needle.empty() || needle.size() > text.size()) return;
+        size_t next = 0;
+        const size_t scanned = avx2()
+                                   ? scanAVX2(text, needle, next, found)
+                                   : scanSSE2(text, needle, next, found);
+        if (scanned == std::string_view::npos) return;
+
+        // the last few positions, too close to the end for a whole block
+        for (size_t pos = std::max(scanned, next);
+             (pos = text.find(needle, pos)) != std::string_view::npos;
+             pos += needle.size())
+        {
+            if (!found(pos)) return;
+        }
+    }
+
+    // the position of the first match, or npos
+    // as with std::string_view::find, an empty needle is found at 0
+    [[nodiscard]] static size_t find(const std::string_view text, const std::string_view needle)
+    {
+        if (needle.empty()) return 0;
+        size_t first = std::string_view::npos;
+        forEach(text, needle, [&](const size_t pos)
+        {
+            first = pos;
+            return false;
+        });
+        return first;
+    }
+
+    // the number of matches
+    [[nodiscard]] static size_t count(const std::string_view text, const std::string_view needle)
+    {
+        if (needle.size() == 1)
+        {
+            return avx2() ? countByteAVX2(text, needle[0]) : countByteSSE2(text, needle[0]);
+        }
+        size_t n = 0;
+        forEach(text, needle, [&](size_t)
+        {
+            ++n;
+            return true;
+        });
+        return n;
+    }
+
+    // The number of fields text splits into at delimiter, a trailing delimiter ends the
+    // last field rather than starting an empty one. The offset of the first character of
+    // each field is written to offsets, as far as capacity allows.
+    static size_t fieldOffsets(const std::string_view text, const std::string_view delimiter,
+                               uint64_t* offsets, const size_t capacity)
+    {
+        if (text.empty()) return 0;
+        size_t n = 0;
+        auto field = [&](const size_t start)
+        {
+            if (n < capacity) offsets[n] = start;
+            ++n;
+        };
+        field(0);
+        forEach(text, delimiter, [&](const size_t pos)
+        {
+            const size_t start = pos + delimiter.size();
+            if (start < text.size()) field(start);
+            return true;
+        });
+        return n;
+    }
+
+private:
+    // the same flag the vector words are compiled for
+    static bool avx2()
+    {
+        return JitContext::getInstance().simdAVX2;
+    }
+
+    // Each scan checks the blocks of positions whose last compared byte is in the text,
+    // and returns the first position it did not check, or npos once found asks to stop.
+
+    template <class F>
+    STRING_SEARCH_AVX2 static size_t scanAVX2(const std::string_view text, const std::string_view needle,
+                                              size_t& next, F& found)
+    {
+        const char* s = text.data();
+        const size_t n = text.size();
+        const size_t m = needle.size();
+        const __m256i first = _mm256_set1_epi8(needle[0]);
+        const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+        size_t i = 0;
+        for (; i + m - 1 + 32 <= n; i += 32)
+        {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+            const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + m - 1));
+            auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))));
+            for (; mask != 0; mask &= mask - 1)
+            {
+                const size_t pos = i + std::countr_zero(mask);
+                if (pos < next || (m > 2 && std::memcmp(s + pos + 1, needle.data() + 1, m - 2) != 0)) continue;
+                if (!found(pos)) return std::string_view::npos;
+                next = pos + m;
+            }
+        }
+        return i;
+    }
+
+    template <class F>
+    static size_t scanSSE2(const std::string_view text, const std::string_view needle, size_t& next, F& found)
+    {
+        const char* s = text.data();
+        const size_t n = text.size();
+        const size_t m = needle.size();
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[m - 1]);
+        size_t i = 0;
+        for (; i + m - 1 + 16 <= n; i += 16)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + m - 1));
+            auto mask = static_cast<uint32_t>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+            for (; mask != 0; mask &= mask - 1)
+            {
+                const size_t pos = i + std::countr_zero(mask);
+                if (pos < next || (m > 2 && std::memcmp(s + pos + 1, needle.data() + 1, m - 2) != 0)) continue;
+                if (!found(pos)) return std::string_view::npos;
+                next = pos + m;
+            }
+        }
+        return i;
+    }
+
+    // a one byte needle never overlaps itself, so every equal byte is a match
+
+    STRING_SEARCH_AVX2 static size_t countByteAVX2(const std::string_view text, const char c)
+    {
+        const char* s = text.data();
+        const size_t n = text.size();
+        const __m256i v = _mm256_set1_epi8(c);
+        size_t total = 0;
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+            total += std::popcount(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, v))));
+        }
+        return total + static_cast<size_t>(std::count(s + i, s + n, c));
+    }
+
+    static size_t countByteSSE2(const std::string_view text, const char c)
+    {
+        const char* s = text.data();
+        const size_t n = text.size();
+        const __m128i v = _mm_set1_epi8(c);
+        size_t total = 0;
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+            total += std::popcount(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, v))));
+        }
+        return total + static_cast<size_t>(std::count(s + i, s + n, c));
+    }
+};
+
+#endif //STRINGSEARCH_H
@@ -0,0 +1,127 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <string_view>
+
+// Tokenizer for the outer interpreter.
+// Splits source text into words in one pass, without copying it; each token is a view of
+// the source, which must outlive it.
+//
+// - words are separated by white space
+// - ( starts a comment that ends at the next ), on the same line or a later one
+// - \ starts a comment that ends at the end of the line
+// - a word ending in " (s" ." and so on) is followed by a literal: the text after the one
+//   white space character that ends the word, up to the next " that is not escaped with \.
+//   The literal is the next token, and its escapes are left as they are.
+//
+// Comments and literals are found in the same scan as words, so a ) or \ inside a literal
+// is part of the literal, and a " inside a comment starts nothing.
+//
+// Text read a line at a time carries an unfinished ( comment to the next line: inComment()
+// after the last token of one line is passed to the tokenizer of the next.
+
+class Tokenizer
+{
+public:
+    enum class Kind
+    {
+        WORD,
+        LITERAL
+    };
+
+    struct Token
+    {
+        std::string_view text;
+        Kind kind = Kind::WORD;
+    };
+
+    explicit Tokenizer(const std::string_view source, const bool inComment = false)
+        : source(source), commentOpen(inComment)
+    {
+    }
+
+    // the source ended inside a ( comment
+    [[nodiscard]] bool inComment() const
+    {
+        return commentOpen;
+    }
+
+    // the next token, false at the end of the source
+    bool next(Token& token)
+    {
+        if (literalNext)
+        {
+            literalNext = false;
+            token = {readLiteral(), Kind::LITERAL};
+            return true;
+        }
+
+        if (commentOpen)
+        {
+            skipComment();
+        }
+
+        while (true)
+        {
+            while (pos < source.size() && isSpace(source[pos])) ++pos;
+            if (pos == source.size()) return false;
+
+            const size_t start = pos;
+            while (pos < source.size() && !isSpace(source[pos])) ++pos;
+            const std::string_view word = source.substr(start, pos - start);
+
+            if (word == "\\")
+            {
+                skipPast('\n');
+                continue;
+            }
+            if (word == "(")
+            {
+                skipComment();
+                continue;
+            }
+
+            // the white space after the word belongs to it, the literal starts after that
+            literalNext = word.back() == '"' && pos < source.size();
+            token = {word, Kind::WORD};
+            return true;
+        }
+    }
+
+    static bool isSpace(const char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+private:
+    void skipPast(const char end)
+    {
+        const size_t found = source.find(end, pos);
+        pos = found == std::string_view::npos ? source.size() : found + 1;
+    }
+
+    // past the ) that ends a comment, which may be in a later source
+    void skipComment()
+    {
+        const size_t found = source.find(')', pos);
+        commentOpen = found == std::string_view::npos;
+        pos = commentOpen ? source.size() : found + 1;
+    }
+
+    // up to the closing quote, or the end of the source if there is none
+    std::string_view readLiteral()
+    {
+        const size_t start = ++pos;
+        size_t end = start;
+        while (end < source.size() && (source[end] != '"' || source[end - 1] == '\\')) ++end;
+        pos = end < source.size() ? end + 1 : end;
+        return source.substr(start, end - start);
+    }
+
+    std::string_view source;
+    size_t pos = 0;
+    bool literalNext = false;
+    bool commentOpen = false;
+};
+
+#endif //TOKENIZER_H
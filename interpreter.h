@@ -5,11 +5,12 @@
 #include <iostream>
 #include <cctype>
 #include <fstream>
-#include <regex>
+#include <functional>
 #include <sstream>
 #include "utility.h"
 #include "StringInterner.h"
-#include "JitContext.h"
+#include "Tokenizer.h"
+#include "jitContext.h"
 #include "JitGenerator.h"
 #include "tests.h"
 #include "CompilerUtility.h"
@@ -43,44 +44,62 @@ inline void interpreter(const std::string& sourceCode)
 inline bool startup_loaded = false;
 
 
+// tracks : and ; over the words of one line, a ( comment left open carries over to the next
+inline void scanDefinitionLine(const std::string_view line, bool& compiling, bool& inComment,
+                               std::vector<std::string>* words = nullptr)
+{
+    Tokenizer tokens(line, inComment);
+    for (Tokenizer::Token token; tokens.next(token);)
+    {
+        if (token.kind != Tokenizer::Kind::WORD)
+        {
+            continue;
+        }
+        if (token.text == ":")
+        {
+            compiling = true;
+        }
+        else if (token.text == ";")
+        {
+            compiling = false;
+        }
+        if (words != nullptr)
+        {
+            words->emplace_back(token.text);
+        }
+    }
+    inComment = tokens.inComment();
+}
+
+
 // Function to interpret multiple statements and functions in the given text
+// Lines are gathered until a definition, and any ( comment, is complete. The words are only
+// looked at for : and ; here, the interpreter splits the gathered text once.
 inline void interpretText(const std::string& text)
 {
-    std::istringstream stream(text);
-    std::string line;
+    const std::string_view source(text);
     std::string accumulated_input;
     bool compiling = false;
+    bool inComment = false;
 
-    while (std::getline(stream, line))
+    for (size_t start = 0; start < source.size();)
     {
+        const size_t end = std::min(source.find('\n', start), source.size());
+        const std::string_view line = source.substr(start, end - start);
+        start = end + 1;
+
         if (line.empty())
         {
             continue;
         }
 
-        accumulated_input += " " + line; // Accumulate input lines
+        // new lines are kept, they end \ comments
+        accumulated_input += '\n';
+        accumulated_input += line; // Accumulate input lines
 
-        auto words = split(line);
+        scanDefinitionLine(line, compiling, inComment);
 
-        for (auto it = words.begin(); it != words.end(); ++it)
-        {
-            const auto& word = *it;
-
-            if (word == ":")
-            {
-                compiling = true;
-            }
-            else if (word == ";")
-            {
-                compiling = false;
-                //printf("Interpret text : [%s]\n", accumulated_input.c_str());
-                interpreter(accumulated_input);
-                accumulated_input.clear();
-                break;
-            }
-        }
-
-        if (!compiling)
+        if (!compiling && !inComment)
         {
             interpreter(accumulated_input);
             accumulated_input.clear();
@@ -122,12 +141,28 @@ inline void slurpIn(const std::string& file_name = "start.f")
 
         // Close the file
         file.close();
+
+        // the definitions in the file are compiled in batches, see JitGenerator::beginBatch
+        if (jc.optBatch) JitGenerator::beginBatch();
+        jc.lazyMode = jc.optLazy;
         interpretText(fileContent);
+        jc.lazyMode = false;
+        JitGenerator::endBatch();
     }
 
     catch (const std::exception& e)
     {
         std::cerr << "Runtime error: " << e.what() << std::endl;
+        jc.lazyMode = false;
+        try
+        {
+            // keep the words that did compile
+            JitGenerator::endBatch();
+        }
+        catch (const std::exception& flushError)
+        {
+            std::cerr << "Runtime error: " << flushError.what() << std::endl;
+        }
         // Reset context and stack as required
     }
 }
@@ -141,6 +176,11 @@ inline std::string handleSpecialCommands(const std::string& input)
         jc.reportMemoryUsage();
         handled = true;
     }
+    else if (input == "*ARENA" || input == "*arena")
+    {
+        arena.report();
+        handled = true;
+    }
     else if (input == "*TESTS" || input == "*tests")
     {
         run_basic_tests();
@@ -241,6 +281,73 @@ inline bool processLoopCheckCommands(auto& it, const auto& words, std::string& a
     return false; // Not a loop check command
 }
 
+// handles simple compiler option commands of the form *OPTION ON|OFF
+inline bool processOptionCommand(auto& it, const auto& words, std::string& accumulated_input,
+                                 const std::string& option, const std::string& description,
+                                 const std::function<void()>& on, const std::function<void()>& off)
+{
+    const auto& word = *it;
+    if (word != option && word != to_lower(option))
+    {
+        return false;
+    }
+    ++it;
+    if (it == words.end())
+    {
+        std::cerr << "Error: Expected argument (on,off) after " << word << std::endl;
+        --it;
+        return true;
+    }
+    const auto& nextWord = *it;
+    if (nextWord == "ON" || nextWord == "on")
+    {
+        std::cout << description << " ON" << std::endl;
+        on();
+    }
+    else if (nextWord == "OFF" || nextWord == "off")
+    {
+        std::cout << description << " OFF" << std::endl;
+        off();
+    }
+    else
+    {
+        std::cerr << "Error: Expected argument (on,off) after " << word << std::endl;
+    }
+    // Remove `command` and `nextWord` from accumulated_input
+    accumulated_input.erase(accumulated_input.find(word), word.length() + nextWord.length() + 2);
+    return true;
+}
+
+inline bool processCompilerOptionCommands(auto& it, const auto& words, std::string& accumulated_input)
+{
+    return processOptionCommand(it, words, accumulated_input, "*TOSCACHE", "TOS caching",
+                                [] { jc.tosCacheON(); }, [] { jc.tosCacheOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*PEEPHOLE", "Peephole optimizer",
+                                [] { jc.peepholeON(); }, [] { jc.peepholeOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*FOLD", "Constant folding",
+                                [] { jc.foldON(); }, [] { jc.foldOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*INLINE", "Inlining",
+                                [] { jc.inlineON(); }, [] { jc.inlineOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*TAILCALL", "Tail calls",
+                                [] { jc.tailCallON(); }, [] { jc.tailCallOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*REGLOOPS", "Register loops",
+                                [] { jc.registerLoopsON(); }, [] { jc.registerLoopsOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*CASEDISPATCH", "Case dispatch",
+                                [] { jc.caseDispatchON(); }, [] { jc.caseDispatchOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*BATCH", "Batch compilation",
+                                [] { jc.batchON(); }, [] { jc.batchOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*ARENA", "Code arena",
+                                [] { jc.arenaON(); }, [] { jc.arenaOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*LAZY", "Lazy compilation",
+                                [] { jc.lazyON(); }, [] { jc.lazyOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*TIERED", "Tiered compilation",
+                                [] { jc.tieredON(); }, [] { jc.tieredOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*REGALLOC", "Register allocation",
+                                [] { jc.regAllocON(); }, [] { jc.regAllocOFF(); })
+        || processOptionCommand(it, words, accumulated_input, "*FPREGS", "Floating point registers",
+                                [] { jc.floatRegsON(); }, [] { jc.floatRegsOFF(); });
+}
+
 inline bool processLoggingCommands(auto& it, const auto& words, std::string& accumulated_input)
 {
     const auto& word = *it;
@@ -330,12 +437,17 @@ inline void interactive_terminal()
     std::string input;
     std::string accumulated_input;
     bool compiling = false;
-    slurpIn("start.f");
+    bool inComment = false;
+    // an image loaded at startup already holds start.f
+    if (!jc.imageLoaded)
+    {
+        slurpIn("start.f");
+    }
 
     // The infinite terminal loop
     while (true)
     {
-        std::cout << (compiling ? "] " : "> ");
+        std::cout << (compiling || inComment ? "] " : "> ");
         std::getline(std::cin, input); // Read a line of input from the terminal
 
         if (input == "QUIT" || input == "quit")
@@ -351,11 +463,13 @@ inline void interactive_terminal()
             continue;
         }
 
-        accumulated_input += " " + input; // Accumulate input lines
+        accumulated_input += "\n" + input; // Accumulate input lines, new lines end \ comments
 
-        auto words = split(input);
+        // the same tokens as interpretText, so words in literals and comments are not counted
+        std::vector<std::string> words;
+        scanDefinitionLine(input, compiling, inComment, &words);
 
-        // Check if compiling is required based on the input
+        // terminal commands
         for (auto it = words.begin(); it != words.end(); ++it)
         {
             const auto& word = *it;
@@ -380,25 +494,18 @@ inline void interactive_terminal()
                 continue;
             }
 
-            if (processDumpCommands(it, words, accumulated_input))
+            if (processCompilerOptionCommands(it, words, accumulated_input))
             {
                 continue;
             }
 
-            if (word == ":")
-            {
-                compiling = true;
-            }
-            else if (word == ";")
+            if (processDumpCommands(it, words, accumulated_input))
             {
-                compiling = false;
-                interpreter(accumulated_input);
-                accumulated_input.clear();
-                break;
+                continue;
             }
         }
 
-        if (!compiling)
+        if (!compiling && !inComment)
         {
             interpreter(accumulated_input); // Process the accumulated input using the outer_interpreter
             accumulated_input.clear();
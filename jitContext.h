@@ -8,6 +8,23 @@
 
 static bool logging = false;
 
+// what a token of a definition is to the compiler, see CompileToken in CompilerUtility.h.
+// The optimization passes add instructions for the compiler to the words of a definition,
+// each with the numbers and the word it reads, tagged so none can be taken for a word of
+// the program or the other way round.
+enum class TokenTag : uint8_t
+{
+    WORD, // a word of the program, a number, or the name or literal a word reads
+    REGBLOCK, // the register blocks, JitGenerator::genRegBlock and genFPBlock
+    FPBLOCK,
+    MOVE, // the known lengths, JitGenerator::genKnownMove, genKnownErase and genKnownFill
+    ERASE,
+    FILL,
+    DISP, // the fused addresses, JitGenerator::genDisplaced and genIndexed
+    INDEX,
+    OPERAND // read by the instruction before it
+};
+
 class JitContext
 {
 public:
@@ -23,7 +40,7 @@ public:
     JitContext& operator=(const JitContext&) = delete;
 
     // Method to get the assembler reference
-    [[nodiscard]] asmjit::x86::Assembler& getAssembler() const
+    [[nodiscard]] asmjit::x86::Builder& getAssembler() const
     {
         return *assembler;
     }
@@ -32,27 +49,58 @@ public:
     {
         if (auto_reset)
         {
+            if (batchOpen)
+            {
+                startBatchWord();
+                return;
+            }
+
+            // The builder is detached by the reset, free it before making the next one
+            delete assembler;
+            assembler = nullptr;
+
             // Reset and reinitialize the code holder
             code.reset();
             code.init(rt.environment());
 
             asmjit::Section *dataSection;
             code.newSection(&dataSection, ".data", SIZE_MAX, asmjit::SectionFlags::kNone, 8);
-            // Attach the assembler to the CodeHolder
-            assembler = new asmjit::x86::Assembler(&code);
-
-            //
-            // // Recreate the assembler with the new code holder
-            // //delete assembler;
-            assembler = new asmjit::x86::Assembler(&code);
+            tosCached = false;
+            // Attach the builder to the CodeHolder
+            assembler = new asmjit::x86::Builder(&code);
             if (logging)
             {
                 code.setLogger(&logger);
                 logger.addFlags(asmjit::FormatFlags::kMachineCode);
             }
+
+            if (batchMode)
+            {
+                batchOpen = true;
+                startBatchWord();
+            }
         }
     }
 
+    // while batching, words share the code holder and each one starts at its own entry label
+    void startBatchWord()
+    {
+        discardBatchWord();
+        batchEntry = assembler->newLabel();
+        assembler->bind(batchEntry);
+        batchWordStart = assembler->lastNode();
+        batchWordOpen = true;
+        tosCached = false;
+    }
+
+    // drop the code of a word that was never finished, it may jump to labels that are not bound
+    void discardBatchWord()
+    {
+        if (!batchWordOpen) return;
+        assembler->removeNodes(batchWordStart, assembler->lastNode());
+        batchWordOpen = false;
+    }
+
 
     void reportMemoryUsage() const
     {
@@ -122,6 +170,145 @@ public:
         optLoopCheck = false;
     }
 
+    void tosCacheON()
+    {
+        optTosCache = true;
+    }
+
+    void tosCacheOFF()
+    {
+        optTosCache = false;
+    }
+
+    // ask the processor what the vector words can use, done when the context is made,
+    // so the flags are set before anything is compiled whatever the entry point
+    void detectSimd()
+    {
+        const auto& features = asmjit::CpuInfo::host().features().x86();
+        simdAVX2 = features.hasAVX2();
+        simdFMA = simdAVX2 && features.hasFMA();
+    }
+
+    void peepholeON()
+    {
+        optPeephole = true;
+    }
+
+    void peepholeOFF()
+    {
+        optPeephole = false;
+    }
+
+    void foldON()
+    {
+        optFold = true;
+    }
+
+    void foldOFF()
+    {
+        optFold = false;
+    }
+
+    void inlineON()
+    {
+        optInline = true;
+    }
+
+    void inlineOFF()
+    {
+        optInline = false;
+    }
+
+    void tailCallON()
+    {
+        optTailCall = true;
+    }
+
+    void tailCallOFF()
+    {
+        optTailCall = false;
+    }
+
+    void registerLoopsON()
+    {
+        optRegisterLoops = true;
+    }
+
+    void registerLoopsOFF()
+    {
+        optRegisterLoops = false;
+    }
+
+    void caseDispatchON()
+    {
+        optCaseDispatch = true;
+    }
+
+    void caseDispatchOFF()
+    {
+        optCaseDispatch = false;
+    }
+
+    void batchON()
+    {
+        optBatch = true;
+    }
+
+    void batchOFF()
+    {
+        optBatch = false;
+    }
+
+    void arenaON()
+    {
+        optArena = true;
+    }
+
+    void arenaOFF()
+    {
+        optArena = false;
+    }
+
+    void lazyON()
+    {
+        optLazy = true;
+    }
+
+    void lazyOFF()
+    {
+        optLazy = false;
+    }
+
+    void tieredON()
+    {
+        optTiered = true;
+    }
+
+    void tieredOFF()
+    {
+        optTiered = false;
+    }
+
+    void regAllocON()
+    {
+        optRegAlloc = true;
+    }
+
+    void regAllocOFF()
+    {
+        optRegAlloc = false;
+    }
+
+    void floatRegsON()
+    {
+        optFloatRegs = true;
+    }
+
+    void floatRegsOFF()
+    {
+        optFloatRegs = false;
+    }
+
     void overflowCheckON()
     {
         optOverflowCheck = true;
@@ -166,11 +353,12 @@ private:
         // Initialization code
         code.reset();
         code.init(rt.environment());
-        assembler = new asmjit::x86::Assembler(&code);
+        assembler = new asmjit::x86::Builder(&code);
         if (logging)
         {
             code.setLogger(&logger);
         }
+        detectSimd();
     }
 
     // Private destructor
@@ -184,7 +372,8 @@ public:
     asmjit::FileLogger logger; // Logs to the standard output
     asmjit::JitRuntime rt;
     asmjit::CodeHolder code;
-    asmjit::x86::Assembler* assembler;
+    // code is built as a node list, so it can be optimized before it is serialized
+    asmjit::x86::Builder* assembler;
     asmjit::Label epilogueLabel;
 
     // Used to pass arguments to the code generators
@@ -210,12 +399,53 @@ public:
     size_t pos_next_word;
     size_t pos_last_word;
     const std::vector<std::string>* words;
+    // the tags of words, while a definition the optimization passes wrote is compiled
+    const std::vector<TokenTag>* wordTags = nullptr;
     std::string word;
 
     // these are compiler options
 
     bool optLoopCheck = false;
     bool optOverflowCheck = false;
+    bool optTosCache = false;
+    bool optPeephole = true;
+    bool optFold = true;
+    bool optInline = false;
+    bool optTailCall = true;
+    bool optRegisterLoops = false;
+    bool optCaseDispatch = true;
+    bool optBatch = false;
+    bool optArena = true;
+    bool optLazy = false;
+    bool optTiered = false;
+    bool optRegAlloc = true;
+    bool optFloatRegs = true;
+    // calls and loop back edges before a tiered word is recompiled with the optimizations
+    size_t tierThreshold = 1000;
+    // colon definitions with at most this many tokens are inlined
+    size_t inlineMaxTokens = 8;
+
+    // code generation state
+    // true while the top of the data stack is held in r10 (see spillTOS/fillTOS)
+    bool tosCached = false;
+
+    // batch compilation, see JitGenerator::beginBatch
+    bool batchMode = false;        // words are collected instead of added to the runtime one by one
+    bool batchOpen = false;        // the code holder holds words waiting for flushBatch
+    bool batchWordOpen = false;    // a word has been started and not yet ended
+    asmjit::Label batchEntry;      // entry of the word being generated
+    asmjit::BaseNode* batchWordStart = nullptr;
+
+    // colon definitions get a stub and are compiled on their first call, see JitGenerator::genLazyStub
+    bool lazyMode = false;
+
+    // the words came from a saved image rather than being compiled
+    bool imageLoaded = false;
+
+    // what the processor offers the vector words and the string search, see detectSimd
+    bool simdAVX2 = false;
+    bool simdFMA = false;
+
     double double_A;
 };
 
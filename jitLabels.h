@@ -30,6 +30,9 @@ struct IfThenElseLabel
 //  when of sees the argument is not equal it jumps to its endof statement.
 //  each of has its own endof label.
 //
+// when every OF is preceded by a literal, CASE knows all the selectors and
+// dispatches straight to the arms instead, through a jump table or a compare tree.
+//
 
 // Labels for CASE control structure
 struct CaseLabel
@@ -38,6 +41,12 @@ struct CaseLabel
     std::vector<asmjit::Label> endOfLabels;
     int ofCount = 0;
 
+    // set by CASE when all the selectors are literals
+    bool dispatch = false;
+    std::vector<int64_t> selectors;     // one per OF, in source order
+    std::vector<asmjit::Label> armLabels;
+    asmjit::Label defaultLabel;         // the code after the last ENDOF
+
     void print() const
     {
         std::cout << "Case Label: " << end_case_label.id() << "\n";
@@ -59,6 +68,7 @@ struct DoLoopLabel
     asmjit::Label loopLabel;
     asmjit::Label leaveLabel;
     bool hasLeave;
+    bool inRegisters = false; // index in rsi and limit in rdi, see genDo
 };
 
 struct BeginAgainRepeatUntilLabel
@@ -94,6 +104,9 @@ inline std::stack<LoopLabel> loopStack;
 
 inline int doLoopDepth = 0;
 
+// DO loops open with their index and limit in rsi and rdi
+inline int registerLoopDepth = 0;
+
 inline std::stack<LoopLabel> tempLoopStack;
 
 // save stack to tempLoopStack
@@ -121,4 +134,49 @@ static void restoreStackFromTemp()
         tempLoopStack.pop();
     }
 }
+
+// bytes held on the return stack by the open control structures,
+// two cells (index and limit) per DO loop and one cell (the selector) per CASE.
+static int returnStackBytesInUse()
+{
+    int bytes = 0;
+    auto stack = loopStack;
+    while (!stack.empty())
+    {
+        if (stack.top().type == DO_LOOP) bytes += 16;
+        else if (stack.top().type == CASE_CONTROL) bytes += 8;
+        stack.pop();
+    }
+    return bytes;
+}
+
+// the innermost DO loop being compiled
+static DoLoopLabel innermostDoLoop()
+{
+    auto stack = loopStack;
+    while (!stack.empty())
+    {
+        if (stack.top().type == DO_LOOP)
+        {
+            return std::get<DoLoopLabel>(stack.top().label);
+        }
+        stack.pop();
+    }
+    throw std::runtime_error("No DO_LOOP structure on the loop stack");
+}
+
+// the entry and exit labels of the word being compiled, at the bottom of the loop stack
+static FunctionEntryExitLabel functionLabels()
+{
+    auto stack = loopStack;
+    while (!stack.empty())
+    {
+        if (stack.top().type == FUNCTION_ENTRY_EXIT)
+        {
+            return std::get<FunctionEntryExitLabel>(stack.top().label);
+        }
+        stack.pop();
+    }
+    throw std::runtime_error("No FUNCTION_ENTRY_EXIT structure on the loop stack");
+}
 #endif //JITLABELS_H
@@ -1,5 +1,7 @@
 #include <iostream>
-#include "JitContext.h"
+#include <cstdlib>
+#include <string>
+#include "jitContext.h"
 #include "ForthDictionary.h"
 #include "JitGenerator.h"
 #include "quit.h"
@@ -11,6 +13,50 @@ JitGenerator& gen = JitGenerator::getInstance();
 StringInterner& interner = StringInterner::getInstance();
 
 
+// stack effects of the primitives, ( in -- out ) in data stack cells.
+// Colon definitions get theirs inferred from these when they are compiled.
+// SP@ has none: a word that reads the cells through it could see cells a
+// register block has not written yet.
+void add_stack_effects()
+{
+    struct Effect
+    {
+        const char* name;
+        int in;
+        int out;
+    };
+    static constexpr Effect effects[] = {
+        {"1", 0, 1}, {"2", 0, 1}, {"3", 0, 1}, {"4", 0, 1}, {"8", 0, 1}, {"32", 0, 1}, {"64", 0, 1}, {"-1", 0, 1},
+        {"2*", 1, 1}, {"4*", 1, 1}, {"8*", 1, 1}, {"10*", 1, 1}, {"16*", 1, 1},
+        {"2/", 1, 1}, {"4/", 1, 1}, {"8/", 1, 1},
+        {"1+", 1, 1}, {"2+", 1, 1}, {"16+", 1, 1}, {"1-", 1, 1}, {"2-", 1, 1}, {"16-", 1, 1},
+        {"0=", 1, 1}, {"0<", 1, 1}, {"0>", 1, 1}, {"<", 2, 1}, {"=", 2, 1}, {">", 2, 1},
+        {"+", 2, 1}, {"-", 2, 1}, {"*", 2, 1}, {"/", 2, 1}, {"MOD", 2, 1}, {"sqrt", 1, 1}, {"gcd", 2, 1},
+        {"f+", 2, 1}, {"f-", 2, 1}, {"f*", 2, 1}, {"f/", 2, 1}, {"fmod", 2, 1}, {"fsqrt", 1, 1}, {"fabs", 1, 1},
+        {"FLOAT", 1, 1}, {"INTEGER", 1, 1}, {"fmax", 2, 1}, {"fmin", 2, 1}, {"fsin", 1, 1}, {"fcos", 1, 1},
+        {"f<", 2, 1}, {"f>", 2, 1}, {"f=", 2, 1}, {"f<>", 2, 1}, {"f.", 1, 0},
+        {"v+", 3, 0}, {"v-", 3, 0}, {"v*", 3, 0}, {"vmin", 3, 0}, {"vmax", 3, 0}, {"vfma", 3, 0},
+        {"vscale", 3, 0}, {"vfill", 2, 0}, {"vsum", 1, 1}, {"vdot", 2, 1}, {"vlen", 1, 1},
+        {"NEGATE", 1, 1}, {"INVERT", 1, 1}, {"ABS", 1, 1}, {"MIN", 2, 1}, {"MAX", 2, 1}, {"WITHIN", 3, 1},
+        {"DUP", 1, 2}, {"DROP", 1, 0}, {"SWAP", 2, 2}, {"OVER", 2, 3}, {"ROT", 3, 3}, {"NIP", 2, 1}, {"TUCK", 2, 3},
+        {"OR", 2, 1}, {"XOR", 2, 1}, {"AND", 2, 1}, {"NOT", 1, 1},
+        {">R", 1, 0}, {"R>", 0, 1}, {"R@", 0, 1}, {"RP@", 0, 1},
+        {"@", 1, 1}, {"!", 2, 0}, {"+!", 2, 0}, {"CELLS", 1, 1},
+        {"C@", 1, 1}, {"C!", 2, 0}, {"W@", 1, 1}, {"W!", 2, 0}, {"L@", 1, 1}, {"L!", 2, 0},
+        {"MOVE", 3, 0}, {"CMOVE", 3, 0}, {"FILL", 3, 0}, {"ERASE", 2, 0}, {"COMPARE", 4, 1},
+        {"I", 0, 1}, {"J", 0, 1}, {"K", 0, 1},
+        {"DEPTH", 0, 1}, {".", 1, 0}, {"h.", 1, 0}, {"emit", 1, 0},
+    };
+    for (const auto& effect : effects)
+    {
+        if (ForthWord* word = d.findWord(effect.name))
+        {
+            word->stackIn = static_cast<int8_t>(effect.in);
+            word->stackOut = static_cast<int8_t>(effect.out);
+        }
+    }
+}
+
 // start to test some code generation
 void add_words()
 {
@@ -102,6 +148,19 @@ void add_words()
     // print float
     d.addWord("f.", JitGenerator::genFDot, JitGenerator::build_forth(JitGenerator::genFDot), nullptr, nullptr);
 
+    // vector words over float arrays
+    d.addWord("v+", JitGenerator::genVPlus, JitGenerator::build_forth(JitGenerator::genVPlus), nullptr, nullptr);
+    d.addWord("v-", JitGenerator::genVSub, JitGenerator::build_forth(JitGenerator::genVSub), nullptr, nullptr);
+    d.addWord("v*", JitGenerator::genVMul, JitGenerator::build_forth(JitGenerator::genVMul), nullptr, nullptr);
+    d.addWord("vmin", JitGenerator::genVMin, JitGenerator::build_forth(JitGenerator::genVMin), nullptr, nullptr);
+    d.addWord("vmax", JitGenerator::genVMax, JitGenerator::build_forth(JitGenerator::genVMax), nullptr, nullptr);
+    d.addWord("vfma", JitGenerator::genVFma, JitGenerator::build_forth(JitGenerator::genVFma), nullptr, nullptr);
+    d.addWord("vscale", JitGenerator::genVScale, JitGenerator::build_forth(JitGenerator::genVScale), nullptr, nullptr);
+    d.addWord("vfill", JitGenerator::genVFill, JitGenerator::build_forth(JitGenerator::genVFill), nullptr, nullptr);
+    d.addWord("vsum", JitGenerator::genVSum, JitGenerator::build_forth(JitGenerator::genVSum), nullptr, nullptr);
+    d.addWord("vdot", JitGenerator::genVDot, JitGenerator::build_forth(JitGenerator::genVDot), nullptr, nullptr);
+    d.addWord("vlen", JitGenerator::genVLen, JitGenerator::build_forth(JitGenerator::genVLen), nullptr, nullptr);
+
 
     d.addWord("MOD", JitGenerator::genMod, JitGenerator::build_forth(JitGenerator::genMod), nullptr, nullptr);
     d.addWord("NEGATE", JitGenerator::genNegate, JitGenerator::build_forth(JitGenerator::genNegate), nullptr, nullptr);
@@ -141,6 +200,20 @@ void add_words()
     d.addWord("RP!", JitGenerator::genRPStore, JitGenerator::build_forth(JitGenerator::genRPStore), nullptr, nullptr);
     d.addWord("@", JitGenerator::genAT, JitGenerator::build_forth(JitGenerator::genAT), nullptr, nullptr);
     d.addWord("!", JitGenerator::genStore, JitGenerator::build_forth(JitGenerator::genStore), nullptr, nullptr);
+    d.addWord("+!", JitGenerator::genPlusStore, JitGenerator::build_forth(JitGenerator::genPlusStore), nullptr, nullptr);
+    d.addWord("C@", JitGenerator::genCFetch, JitGenerator::build_forth(JitGenerator::genCFetch), nullptr, nullptr);
+    d.addWord("C!", JitGenerator::genCStore, JitGenerator::build_forth(JitGenerator::genCStore), nullptr, nullptr);
+    d.addWord("W@", JitGenerator::genWFetch, JitGenerator::build_forth(JitGenerator::genWFetch), nullptr, nullptr);
+    d.addWord("W!", JitGenerator::genWStore, JitGenerator::build_forth(JitGenerator::genWStore), nullptr, nullptr);
+    d.addWord("L@", JitGenerator::genLFetch, JitGenerator::build_forth(JitGenerator::genLFetch), nullptr, nullptr);
+    d.addWord("L!", JitGenerator::genLStore, JitGenerator::build_forth(JitGenerator::genLStore), nullptr, nullptr);
+    // a cell is 8 bytes, so CELLS is 8*
+    d.addWord("CELLS", JitGenerator::gen8mul, JitGenerator::build_forth(JitGenerator::gen8mul), nullptr, nullptr);
+    d.addWord("MOVE", JitGenerator::genMove, JitGenerator::build_forth(JitGenerator::genMove), nullptr, nullptr);
+    d.addWord("CMOVE", JitGenerator::genCMove, JitGenerator::build_forth(JitGenerator::genCMove), nullptr, nullptr);
+    d.addWord("FILL", JitGenerator::genFill, JitGenerator::build_forth(JitGenerator::genFill), nullptr, nullptr);
+    d.addWord("ERASE", JitGenerator::genErase, JitGenerator::build_forth(JitGenerator::genErase), nullptr, nullptr);
+    d.addWord("COMPARE", JitGenerator::genCompare, JitGenerator::build_forth(JitGenerator::genCompare), nullptr, nullptr);
 
 
     // Add immediate functions for control flow words
@@ -169,6 +242,15 @@ void add_words()
 
     d.addCompileOnlyImmediate("ENDCASE", nullptr, nullptr, JitGenerator::genEndCase, nullptr);
 
+    // the instructions the optimization passes add, see CompilerUtility.h CompileToken
+    d.addCompileOnlyImmediate(JitGenerator::tagName(TokenTag::REGBLOCK), nullptr, nullptr, JitGenerator::genRegBlock, nullptr);
+    d.addCompileOnlyImmediate(JitGenerator::tagName(TokenTag::FPBLOCK), nullptr, nullptr, JitGenerator::genFPBlock, nullptr);
+    d.addCompileOnlyImmediate(JitGenerator::tagName(TokenTag::MOVE), nullptr, nullptr, JitGenerator::genKnownMove, nullptr);
+    d.addCompileOnlyImmediate(JitGenerator::tagName(TokenTag::ERASE), nullptr, nullptr, JitGenerator::genKnownErase, nullptr);
+    d.addCompileOnlyImmediate(JitGenerator::tagName(TokenTag::FILL), nullptr, nullptr, JitGenerator::genKnownFill, nullptr);
+    d.addCompileOnlyImmediate(JitGenerator::tagName(TokenTag::DISP), nullptr, nullptr, JitGenerator::genDisplaced, nullptr);
+    d.addCompileOnlyImmediate(JitGenerator::tagName(TokenTag::INDEX), nullptr, nullptr, JitGenerator::genIndexed, nullptr);
+
 
     d.addCompileOnlyImmediate("{", nullptr, nullptr, JitGenerator::gen_leftBrace, nullptr);
 
@@ -194,6 +276,14 @@ void add_words()
     d.addWord("strField", JitGenerator::genStringField, JitGenerator::build_forth(JitGenerator::genStringField), nullptr,
             nullptr);
 
+    // split off the next field in one pass. s" 1,2,3" BEGIN s" ," strNextField WHILE s. REPEAT
+    d.addWord("strNextField", JitGenerator::genNextField, JitGenerator::build_forth(JitGenerator::genNextField), nullptr,
+            nullptr);
+
+    // fill the ARRAY named after it with the offset of each field, return the number of fields.
+    // 16 array offsets  s" 1,22,333" s" ," strFieldOffsets offsets =3
+    d.addWord("strFieldOffsets", nullptr, nullptr, JitGenerator::genFieldOffsets, JitGenerator::execFieldOffsets);
+
 
     d.addWord("s.", JitGenerator::genPrint, JitGenerator::build_forth(JitGenerator::genPrint), nullptr, nullptr);
 
@@ -201,6 +291,7 @@ void add_words()
     d.addInterpretOnlyImmediate("value", nullptr, nullptr, nullptr, JitGenerator::genImmediateValue);
     d.addInterpretOnlyImmediate("fvalue", nullptr, nullptr, nullptr, JitGenerator::genImmediateFvalue);
     d.addInterpretOnlyImmediate("array", nullptr, nullptr, nullptr, JitGenerator::genImmediateArray);
+    d.addInterpretOnlyImmediate("farray", nullptr, nullptr, nullptr, JitGenerator::genImmediateFloatArray);
 
     d.addInterpretOnlyImmediate("string", nullptr, nullptr, nullptr, JitGenerator::genImmediateStringValue);
     d.addInterpretOnlyImmediate("constant", nullptr, nullptr, nullptr, JitGenerator::genImmediateConstant);
@@ -219,7 +310,11 @@ void add_words()
     d.addWord("emit", JitGenerator::genEmit, JitGenerator::build_forth(JitGenerator::genEmit), nullptr, nullptr);
     d.addWord(".s", nullptr, JitGenerator::dotS, nullptr, nullptr);
     d.addWord("words", nullptr, JitGenerator::words, nullptr, nullptr);
+    d.addWord("inline", nullptr, JitGenerator::markInline, nullptr, nullptr);
+    d.addWord("noinline", nullptr, JitGenerator::markNoInline, nullptr, nullptr);
     d.addWord("see", nullptr, nullptr, nullptr, JitGenerator::see);
+    d.addInterpretOnlyImmediate("save-image", nullptr, nullptr, nullptr, JitGenerator::genSaveImage);
+    d.addInterpretOnlyImmediate("load-image", nullptr, nullptr, nullptr, JitGenerator::genLoadImage);
 
 
     // SDL interface
@@ -237,17 +332,45 @@ void add_words()
     // needs more thought.
     //d.addWord("abort\"", nullptr, nullptr, JitGenerator::genImmediateAbortQuote, nullptr);
 
+    add_stack_effects();
 
 }
 
-typedef void* HINSTANCE;
-typedef char* LPSTR;
-int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
+// the image named by --image <file> on the command line, none by default
+static std::string startupImage(const int argc, char** argv)
+{
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--image") return argv[i + 1];
+    }
+    return {};
+}
 
+// the same start on every platform, only the entry point differs
+static int runForth(const int argc, char** argv)
+{
     jc.loggingOFF();
     add_words();
+    // an image is only loaded when one is asked for, it then replaces the words and start.f
+    if (const std::string image = startupImage(argc, argv); !image.empty())
+    {
+        JitGenerator::loadStartupImage(image);
+    }
     std::thread terminalThread(Quit());
 
 
     return 0;
 }
+
+#ifdef _WIN32
+typedef void* HINSTANCE;
+typedef char* LPSTR;
+int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
+    return runForth(__argc, __argv);
+}
+#else
+int main(int argc, char** argv)
+{
+    return runForth(argc, argv);
+}
+#endif
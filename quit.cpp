@@ -5,9 +5,50 @@
 #include "quit.h"
 #include "interpreter.h"
 #include <csetjmp>
+#include <cstdint>
+#include <cstring>
 #include <bits/std_thread.h>
+#ifndef _WIN32
+#include <csignal>
+#include <pthread.h>
+#include <ucontext.h>
+#include <vector>
+#endif
+
+
+// a fault in the guard area of one of the Forth stacks, see StackManager.h
+class StackFaultException : public std::runtime_error
+{
+public:
+    explicit StackFaultException(const char* message) : std::runtime_error(message)
+    {
+    }
+};
+
+// the stack registers are not to be trusted after a stack fault
+static void resetStacks()
+{
+    sm.resetDS();
+    sm.resetLS();
+    sm.resetSS();
+    sm.resetRS();
+}
+
+// Generated code is entered from C++ through runGenerated, which keeps a recovery point.
+// A fault in a stack guard goes back to the innermost one, which throws StackFaultException
+// from ordinary C++, so the C++ frames above it unwind as usual. The generated frames in
+// between hold nothing that needs cleaning up.
+// A fault is only recovered when the faulting instruction is in the code arena. A fault in
+// C++ called from generated code may be holding a lock or objects that the jump would skip,
+// so it is passed on and the program stops as it would without a handler.
+static const char* volatile faultMessage = nullptr;
 
+static bool inGeneratedCode(const void* instruction)
+{
+    return arena.contains(instruction);
+}
 
+#ifdef _WIN32
 // Define the WINAPI macro
 #ifndef WINAPI
 #define WINAPI __stdcall
@@ -44,25 +85,73 @@ short GetAsyncKeyState(int vKey);
 }
 
 
-class AccessViolationException : public std::exception
+#define EXCEPTION_ACCESS_VIOLATION 0xC0000005
+#define EXCEPTION_CONTINUE_SEARCH 0
+#define EXCEPTION_CONTINUE_EXECUTION (-1)
+
+// where rsp and rip are kept in the x64 CONTEXT record
+static constexpr size_t CONTEXT_RSP = 0x98;
+static constexpr size_t CONTEXT_RIP = 0xF8;
+
+// The handler can not throw through generated code, which has no unwind information, so
+// execution carries on in resumeAfterFault, which jumps back to the recovery point.
+// __builtin_longjmp restores the registers without unwinding.
+static void* recoverPoint[5];
+static volatile bool recoverArmed = false;
+
+[[noreturn]] static void resumeAfterFault()
 {
-public:
-    const char* what() const noexcept override
+    __builtin_longjmp(recoverPoint, 1);
+}
+
+LONG WINAPI VectoredHandler(PEXCEPTION_POINTERS ExceptionInfo)
+{
+    const EXCEPTION_RECORD* record = ExceptionInfo->ExceptionRecord;
+    if (record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION || !recoverArmed ||
+        !inGeneratedCode(record->ExceptionAddress))
     {
-        return "Caught an access violation (0xC0000005) exception";
+        return EXCEPTION_CONTINUE_SEARCH;
     }
-};
-
-#define EXCEPTION_ACCESS_VIOLATION 0xC0000005
-#define EXCEPTION_CONTINUE_SEARCH 1
+    // the second parameter of an access violation is the address that was accessed
+    const char* fault = sm.stackFault(reinterpret_cast<const void*>(record->ExceptionInformation[1]));
+    if (fault == nullptr)
+    {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+    faultMessage = fault;
+    auto* context = static_cast<uint8_t*>(ExceptionInfo->ContextRecord);
+    auto& rsp = *reinterpret_cast<uint64_t*>(context + CONTEXT_RSP);
+    auto& rip = *reinterpret_cast<uint64_t*>(context + CONTEXT_RIP);
+    // as if resumeAfterFault had been called
+    rsp = (rsp & ~uint64_t{15}) - 8;
+    rip = reinterpret_cast<uint64_t>(resumeAfterFault);
+    return EXCEPTION_CONTINUE_EXECUTION;
+}
 
-LONG WINAPI VectoredHandler(PEXCEPTION_POINTERS ExceptionInfo)
+void runGenerated(void (*fn)())
 {
-    if (ExceptionInfo->ExceptionRecord->ExceptionCode == EXCEPTION_ACCESS_VIOLATION)
+    void* outer[5];
+    const bool outerArmed = recoverArmed;
+    std::memcpy(outer, recoverPoint, sizeof(recoverPoint));
+    if (__builtin_setjmp(recoverPoint) != 0)
+    {
+        std::memcpy(recoverPoint, outer, sizeof(recoverPoint));
+        recoverArmed = outerArmed;
+        throw StackFaultException(faultMessage);
+    }
+    recoverArmed = true;
+    try
     {
-        throw AccessViolationException();
+        fn();
     }
-    return EXCEPTION_CONTINUE_SEARCH;
+    catch (...)
+    {
+        std::memcpy(recoverPoint, outer, sizeof(recoverPoint));
+        recoverArmed = outerArmed;
+        throw;
+    }
+    std::memcpy(recoverPoint, outer, sizeof(recoverPoint));
+    recoverArmed = outerArmed;
 }
 
 #define VK_ESCAPE 0x1B
@@ -76,15 +165,88 @@ bool escapePressed()
     return false;
 }
 
+#else
+// A signal handler can not throw, so a fault jumps back to the recovery point instead.
+// It runs on its own stack, so that it still runs when the machine stack itself has overflowed.
+// Only a fault in a stack guard, in generated code on the thread that set the recovery point,
+// is recovered; the state after any other fault is unknown, so it gets the default action.
+
+static sigjmp_buf* volatile recoverPoint = nullptr;
+static pthread_t recoverThread;
+
+static void faultHandler(const int signal, siginfo_t* info, void* uc)
+{
+    const auto* context = static_cast<const ucontext_t*>(uc);
+    const auto* rip = reinterpret_cast<const void*>(context->uc_mcontext.gregs[REG_RIP]);
+    const char* fault = recoverPoint != nullptr && pthread_equal(pthread_self(), recoverThread) &&
+                        inGeneratedCode(rip)
+                            ? sm.stackFault(info->si_addr)
+                            : nullptr;
+    if (fault == nullptr)
+    {
+        std::signal(signal, SIG_DFL);
+        std::raise(signal);
+        return;
+    }
+    faultMessage = fault;
+    siglongjmp(*recoverPoint, 1);
+}
+
+void runGenerated(void (*fn)())
+{
+    sigjmp_buf here;
+    sigjmp_buf* const outer = recoverPoint;
+    if (sigsetjmp(here, 1) != 0)
+    {
+        recoverPoint = outer;
+        throw StackFaultException(faultMessage);
+    }
+    if (outer == nullptr) recoverThread = pthread_self();
+    recoverPoint = &here;
+    try
+    {
+        fn();
+    }
+    catch (...)
+    {
+        recoverPoint = outer;
+        throw;
+    }
+    recoverPoint = outer;
+}
+
+static void installFaultHandler()
+{
+    static std::vector<uint8_t> signalStack(64 * 1024);
+    stack_t alternate{};
+    alternate.ss_sp = signalStack.data();
+    alternate.ss_size = signalStack.size();
+    sigaltstack(&alternate, nullptr);
+
+    struct sigaction action{};
+    action.sa_sigaction = faultHandler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, nullptr);
+    sigaction(SIGBUS, &action, nullptr);
+}
+
+bool escapePressed()
+{
+    return false;
+}
+#endif
+
 
 std::thread Quit()
 {
+#ifdef _WIN32
     PVOID handler = AddVectoredExceptionHandler(1, VectoredHandler);
+#else
+    installFaultHandler();
+#endif
     //
-    sm.resetDS();
-    sm.resetLS();
-    sm.resetSS();
-    sm.resetRS();
+    resetStacks();
 
 
     while (true)
@@ -94,10 +256,10 @@ std::thread Quit()
 
             interactive_terminal();
         }
-        catch (const AccessViolationException& e)
+        catch (const StackFaultException& e)
         {
-            std::cerr << e.what() << std::endl;
-            // Reset context and stack as required
+            std::cerr << "Runtime error: " << e.what() << std::endl;
+            resetStacks();
         }
         catch (const std::exception& e)
         {
@@ -106,5 +268,7 @@ std::thread Quit()
         }
     }
 
+#ifdef _WIN32
     RemoveVectoredExceptionHandler(handler);
+#endif
 }
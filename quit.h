@@ -5,5 +5,7 @@
 #include <bits/std_thread.h>
 std::thread Quit();  // Declaration of Quit function
 bool escapePressed();
+// runs generated code, a fault in a stack guard comes back out of it as an exception
+void runGenerated(void (*fn)());
 static jmp_buf jumpBuffer;
 #endif // QUIT_H
\ No newline at end of file
@@ -30,11 +30,14 @@ inline void run_word(const std::string& word)
     }
     else
     {
-        w->compiledFunc();
+        // words compiled in a batch only have their real address once it is flushed
+        JitGenerator::flushBatch();
+        runGenerated(JitGenerator::runnable(w->compiledFunc));
     }
 }
 
 void interpreter(const std::string& sourceCode);
+void interpretText(const std::string& text);
 void compileWord(const std::string& wordName, const std::string& compileText, const std::string& sourceCode);
 
 inline void test_against_ds(const std::string& words, const uint64_t expected_top)
@@ -100,6 +103,43 @@ inline void ftest_against_ds(const std::string& words, const float expected_top)
 }
 
 
+// the words are expected to fail with a runtime error
+inline void test_error(const std::string& words)
+{
+    total_tests++;
+    try
+    {
+        sm.resetDS();
+        std::cout << "Running: " << words << std::endl;
+        interpreter(words);
+        failed_tests++;
+        std::cout << "!!!! ---- Failed test: " << words << " Expected an error <<<<< ---- Failed test !!!" << std::endl;
+    }
+    catch (const std::runtime_error& e)
+    {
+        passed_tests++;
+        std::cout << "Passed test: " << words << " failed with: " << e.what() << std::endl;
+    }
+}
+
+
+// a check made from C++, such as on the dictionary entry of a word
+inline void test_that(const std::string& what, const bool ok)
+{
+    total_tests++;
+    if (ok)
+    {
+        passed_tests++;
+        std::cout << "Passed test: " << what << std::endl;
+    }
+    else
+    {
+        failed_tests++;
+        std::cout << "!!!! ---- Failed test: " << what << " <<<<< ---- Failed test !!!" << std::endl;
+    }
+}
+
+
 inline void testCompileAndRun(const std::string& wordName,
                               const std::string& wordDefinition,
                               const std::string& testString, int expectedResult)
@@ -359,6 +399,18 @@ void run_basic_tests()
                       9);
 
 
+    jc.registerLoopsON();
+    testCompileAndRun("testRegisterLoop",
+                      "0 10 0 DO I + 2 +LOOP",
+                      " testRegisterLoop",
+                      20);
+
+    testCompileAndRun("testRegisterLoop",
+                      "0 100 0 DO I 7 = IF LEAVE THEN 1+ LOOP",
+                      " testRegisterLoop",
+                      7);
+    jc.registerLoopsOFF();
+
     testCompileAndRun("testThreeLevelDeepLoop",
                       " 3 0 DO  2 0  DO  1 0 DO I J K + + LOOP LOOP LOOP ",
                       " testThreeLevelDeepLoop ",
@@ -445,12 +497,215 @@ void run_basic_tests()
                       " 5 rfactTest",
                       120);
 
+    // RECURSE in tail position becomes a jump, so this does not grow the native stack
+    testCompileAndRun("tailTest",
+                      "1- DUP 0= IF EXIT THEN RECURSE",
+                      " 1000000 tailTest",
+                      0);
+
+    // frameEnd ends in a call to C, which stays a call, and aligns rsp itself when frameCaller,
+    // which has no frame, calls it
+    interpreter(": frameEnd 1+ 32 emit ; : frameCaller 1+ frameEnd 1+ ;");
+    test_against_ds("1 frameCaller", 4);
+    test_against_ds("1 frameCaller frameCaller", 7);
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    testCompileAndRun("exitLoopTest",
+                      "10 0 DO I 5 = IF I EXIT THEN LOOP 99",
+                      " exitLoopTest",
+                      5);
+
     testCompileAndRun("strposTest",
                       R"(s" 1 2 3 4 5 6 7 8 " s" 6 " strpos 10 =)",
                       " strposTest",
                       -1);
 
     test_against_ds(R"(s" 1 2 3 4 5 6 7 8 " s" 6 " strpos)", 10);
+    // s+ interns the joined string
+    test_against_ds(R"(s" ab" s" cd" s+ s" cd" strpos)", 2);
+
+    // a string value keeps a reference to its string, to swaps it inline
+    {
+        interpreter(R"(s" abc" string strValue)");
+        testCompileAndRun("strValueTest",
+                          R"(10 0 DO s" xabc" to strValue LOOP strValue s" abc" strpos)",
+                          " strValueTest",
+                          1);
+        // strValueTest is only forgotten when it compiled
+        while (d.findWord("strValue") != nullptr) d.forgetLastWord();
+    }
+
+    // fields are slices of the string they came from
+    test_against_ds(R"(s" ab,cd" s" ," 1 strField s" x" s+ s" dx" strpos)", 1);
+    testCompileAndRun("nextFieldTest",
+                      R"(0 s" a,bb,ccc" BEGIN s" ," strNextField WHILE s" c" strpos + REPEAT)",
+                      " nextFieldTest",
+                      -2);
+
+    interpreter("8 array fieldOffsets");
+    test_against_ds(R"(s" ab,c,,def" s" ," strFieldOffsets fieldOffsets)", 4);
+    test_against_ds(R"(s" ab,c,,def" s" ," strFieldOffsets fieldOffsets drop 3 fieldOffsets)", 6);
+    testCompileAndRun("fieldOffsetsTest",
+                      R"(s" x,yy,zzz" s" ," strFieldOffsets fieldOffsets 2 fieldOffsets +)",
+                      " fieldOffsetsTest",
+                      8);
+    // the array holds eight offsets, the ninth field is counted but not written
+    test_against_ds(R"(s" 1,2,3,4,5,6,7,8,9" s" ," strFieldOffsets fieldOffsets drop 7 fieldOffsets)", 14);
+    test_against_ds(R"(s" 1,2,3,4,5,6,7,8,9" s" ," strFieldOffsets fieldOffsets)", 9);
+    interpreter("4 farray notOffsets");
+    test_error(R"(s" a,b" s" ," strFieldOffsets notOffsets)");
+    d.forgetLastWord();
+    test_against_ds(R"(s" ab--c--" s" --" strFields)", 2);
+    d.forgetLastWord();
+
+    // the hash table is rebuilt as it fills, the strings stay where they are
+    {
+        const size_t first = strIntern.intern("interner rebuild 0");
+        const void* address = strIntern.getStringAddress(first);
+        std::vector<size_t> indices{first};
+        for (int i = 1; i < 2000; ++i) indices.push_back(strIntern.intern("interner rebuild " + std::to_string(i)));
+        bool found = true;
+        for (int i = 0; i < 2000; ++i)
+        {
+            const size_t index = strIntern.intern("interner rebuild " + std::to_string(i));
+            found = found && index == indices[i] && strIntern.refCount(index) == 2;
+        }
+        test_that("2000 live strings are found after the table is rebuilt", found);
+        test_that("a string keeps its address when the table is rebuilt",
+                  strIntern.getStringAddress(first) == address &&
+                  strIntern.view(first) == "interner rebuild 0");
+        for (const size_t index : indices)
+        {
+            strIntern.release(index);
+            strIntern.release(index);
+        }
+    }
+
+    // a removed string gives its index and storage to the next one
+    {
+        const size_t index = strIntern.intern("interner reuse");
+        const size_t size = strIntern.size();
+        strIntern.release(index);
+        test_that("a removed string is empty", strIntern.refCount(index) == 0 && strIntern.view(index).empty());
+        const size_t again = strIntern.intern("interner reuse");
+        test_that("interning a removed string again reuses its index",
+                  again == index && strIntern.size() == size && strIntern.view(again) == "interner reuse");
+        strIntern.release(again);
+        for (int i = 0; i < 10000; ++i) strIntern.release(strIntern.intern("interner churn " + std::to_string(i)));
+        test_that("strings interned and released do not grow the interner", strIntern.size() == size);
+    }
+
+    // a value on the string stack holds a reference, so TO on its string value does not remove it
+    {
+        interpreter(R"(s" value " s" before" s+ string ssValue)");
+        sm.resetSS();
+        interpreter(R"(ssValue s" value after" to ssValue s" value " s" other" s+)");
+        const uint64_t other = sm.popSS();
+        const uint64_t before = sm.popSS();
+        test_that("a string on the string stack survives TO on its value",
+                  strIntern.view(before) == "value before" && strIntern.view(other) == "value other");
+        strIntern.drop(other);
+        strIntern.drop(before);
+        test_that("dropping the last reference removes the string", strIntern.refCount(before) == 0);
+        d.forgetLastWord();
+    }
+
+    // each string s+ makes is removed once the next one is made from it
+    {
+        const size_t size = strIntern.size();
+        testCompileAndRun("catLoopTest", R"(s" a" 1000 0 DO s" b" s+ LOOP s" b" strpos)", " catLoopTest", 1);
+        test_that("a loop of s+ does not grow the interner", strIntern.size() <= size + 4);
+    }
+
+    // a slice holds a reference to its base string until it is dropped
+    {
+        const size_t base = strIntern.intern("interner slice base");
+        const uint64_t part = strIntern.slice(base, 9, 5);
+        test_that("a slice takes a reference to its base", strIntern.refCount(base) == 2);
+        strIntern.release(base);
+        test_that("a slice keeps its base alive", strIntern.view(part) == "slice");
+        strIntern.drop(part);
+        test_that("dropping a slice releases its base", strIntern.refCount(base) == 0);
+
+        // a copy of a dropped slice is refused, and dropping it again does nothing
+        const size_t reused = strIntern.intern("interner stale slice");
+        const uint64_t stale = strIntern.slice(reused, 0, 8);
+        strIntern.drop(stale);
+        strIntern.drop(stale);
+        const uint64_t later = strIntern.slice(reused, 9, 5);
+        bool refused = false;
+        try
+        {
+            (void)strIntern.view(stale);
+        }
+        catch (const std::out_of_range&)
+        {
+            refused = true;
+        }
+        test_that("a dropped slice is not read as a later one",
+                  refused && later != stale && strIntern.view(later) == "stale" && strIntern.refCount(reused) == 2);
+        strIntern.drop(later);
+        strIntern.release(reused);
+
+        const size_t line = strIntern.intern(std::string(3 << 20, 'a') + ",field");
+        const size_t comma = strIntern.intern(",");
+        const uint64_t field = strIntern.StringSplit(line, comma, 1);
+        test_that("a slice can start past 1MB", StringInterner::isSlice(field) && strIntern.view(field) == "field");
+        const uint64_t first = strIntern.StringSplit(line, comma, 0);
+        test_that("a slice can be longer than 1MB", strIntern.view(first).size() == 3 << 20);
+        strIntern.drop(field);
+        strIntern.drop(first);
+        strIntern.release(comma);
+        strIntern.release(line);
+        test_that("the fields of a line release it when dropped", strIntern.refCount(line) == 0);
+    }
+
+    // strings longer than the SIMD blocks, searched with and without AVX2
+    {
+        const bool hostAVX2 = jc.simdAVX2;
+        const auto text = [](const std::string& str) { return "s\" " + str + "\" "; };
+        const std::string straddle = std::string(31, '.') + "XYZ" + std::string(40, '.');
+        const std::string line = std::string(80, 'q');
+        std::string commas;
+        for (int i = 0; i < 40; ++i) commas += "a,";
+        for (const bool avx2 : {false, true})
+        {
+            if (avx2 && !hostAVX2) continue;
+            jc.simdAVX2 = avx2;
+            std::cout << "String search with AVX2 " << (avx2 ? "on" : "off") << std::endl;
+            // across the 16 and 32 byte block boundaries
+            test_against_ds(text(straddle) + text("XYZ") + "strpos", 31);
+            // every position is a candidate for the first byte
+            test_against_ds(text(std::string(72, 'a') + "b") + text("aab") + "strpos", 70);
+            test_against_ds(text(std::string(70, 'a')) + text("aa") + "strFields", 35);
+            // the needle is the whole text
+            test_against_ds(text(line) + text(line) + "strpos", 0);
+            test_against_ds(text(line) + text(std::string(79, 'q') + "r") + "strpos", -1);
+            // the last position
+            test_against_ds(text(std::string(79, 'x') + ",") + text(",") + "strpos", 79);
+            // a one byte delimiter is counted, with and without a trailing one
+            test_against_ds(text(commas + "a") + text(",") + "strFields", 41);
+            test_against_ds(text(commas) + text(",") + "strFields", 40);
+        }
+        jc.simdAVX2 = hostAVX2;
+    }
+
+    // comments and literals are found in one scan
+    test_against_ds("1 ( 2 ) 3 +", 4);
+    test_against_ds("5 \\ 6 7\n 1 +", 6);
+    test_against_ds(R"(s" a ) b" s" b" strpos)", 4);
+
+    // text read a line at a time carries a ( comment over to the next line
+    interpretText(": commentTest ( a\n b ; c ) 1 2 +\n ;\n");
+    test_against_ds("commentTest", 3);
+    d.forgetLastWord();
+    interpretText("( a comment\n over two lines ) : commentTest 4 ;\n");
+    test_against_ds("commentTest", 4);
+    d.forgetLastWord();
+    interpretText(R"(: commentTest s" ;" 5 ;)");
+    test_against_ds("commentTest", 5);
+    d.forgetLastWord();
 
     testCompileAndRun("testcase",
                       R"(
@@ -562,6 +817,296 @@ void run_basic_tests()
         " 2 2 nestedcase",
         200);
 
+    // literal selectors, dense enough for a jump table
+    const std::string denseCase = R"(
+                      CASE
+                        1 OF 10 ENDOF 2 OF 20 ENDOF 3 OF 30 ENDOF
+                        4 OF 40 ENDOF 5 OF 50 ENDOF 6 OF 60 ENDOF
+                        DEFAULT 99
+                      ENDCASE )";
+    testCompileAndRun("densecase", denseCase, " 4 densecase", 40);
+    testCompileAndRun("densecase", denseCase, " 0 densecase", 99);
+    testCompileAndRun("densecase", denseCase, " 7 densecase", 99);
+
+    // sparse selectors use a compare tree
+    const std::string sparseCase = R"(
+                      CASE
+                        -5 OF 1 ENDOF 100 OF 2 ENDOF 1000 OF 3 ENDOF 70000 OF 4 ENDOF
+                        3000000000 OF 5 ENDOF 7 OF 6 ENDOF 9 OF 7 ENDOF
+                        DEFAULT 99
+                      ENDCASE )";
+    testCompileAndRun("sparsecase", sparseCase, " 3000000000 sparsecase", 5);
+    testCompileAndRun("sparsecase", sparseCase, " -5 sparsecase", 1);
+    testCompileAndRun("sparsecase", sparseCase, " 8 sparsecase", 99);
+
+
+    // newest definition wins, and forgetting it reveals the older one
+    compileWord("shadowTest", "1", "shadowTest 1 ;");
+    testCompileAndRun("shadowTest", "2", " SHADOWTEST", 2);
+    test_against_ds(" shadowtest", 1);
+    d.forgetLastWord();
+
+
+    // constant folding, through the interpreter so the definition goes through handleCompileMode
+    interpreter(": foldTest 3 4 + 8* ;");
+    test_against_ds(" foldTest", 56);
+    d.forgetLastWord();
+    interpreter(": foldTest 10 SWAP 1 2 < - ;");
+    test_against_ds(" 5 foldTest", 6);
+    d.forgetLastWord();
+
+
+    // small user words are inlined into later definitions
+    jc.inlineON();
+    interpreter(": inlSq DUP * ;");
+    interpreter(": inlTest inlSq 1+ ;");
+    test_against_ds(" 5 inlTest", 26);
+    d.forgetLastWord();
+    interpreter(": inlTest 3 inlSq ;");
+    test_against_ds(" inlTest", 9);
+    jc.inlineOFF();
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // batch compilation, batchB calls batchA through its entry label and runs once the batch is flushed
+    JitGenerator::beginBatch();
+    interpreter(": batchA 20 ; : batchB batchA 1+ ;");
+    test_against_ds(" batchB", 21);
+    JitGenerator::endBatch();
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // words in the code arena call each other directly
+    interpreter(": arenaA 40 ; : arenaB arenaA 2 + ;");
+    test_against_ds(" arenaB", 42);
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // lazy words are compiled on their first call, lazyB calls lazyA through its stub
+    jc.lazyMode = true;
+    interpreter(": lazyA 40 ; : lazyB lazyA 2 + ;");
+    jc.lazyMode = false;
+    test_against_ds(" lazyB", 42);
+    test_against_ds(" lazyB", 42);
+    test_against_ds(" lazyA", 40);
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // a lazy word that does not compile fails when it is called, and again on the next call
+    jc.lazyMode = true;
+    interpreter(": lazyBad 1 noSuchWordForLazy ;");
+    jc.lazyMode = false;
+    test_error(" lazyBad");
+    test_error(" lazyBad");
+    d.forgetLastWord();
+
+    // a tiered word is recompiled when its counter runs out, here part way through the loop
+    const size_t tierThreshold = jc.tierThreshold;
+    jc.tieredON();
+    jc.tierThreshold = 4;
+    interpreter(": tierA 0 10 0 DO I + LOOP ;");
+    const ForthFunction tierBaseline = d.findWord("tierA")->compiledFunc;
+    test_against_ds(" tierA", 45);
+    test_that("tierA moved to the top tier", d.findWord("tierA")->compiledFunc != tierBaseline);
+    test_that("tierA is still a colon definition", d.findWord("tierA")->type == ForthWordType::WORD);
+    test_against_ds(" tierA", 45);
+
+    // a recompile that fails is thrown back to the interpreter, and is tried again later
+    {
+        ForthWord* hot = d.findWord("tierA");
+        const ForthFunction current = hot->compiledFunc;
+        TierCounter counter{0, reinterpret_cast<char*>(hot) - reinterpret_cast<char*>(&counter)};
+        const ForthFunction failed = JitGenerator::tierUp(&counter, [](ForthWord*) -> ForthFunction
+        {
+            throw std::runtime_error("no code");
+        });
+        bool thrown = false;
+        try
+        {
+            if (failed != nullptr) failed();
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        test_that("a failed recompile is reported as an error", thrown);
+        test_that("a failed recompile counts down again",
+                  counter.count == static_cast<int64_t>(jc.tierThreshold) && hot->compiledFunc == current);
+    }
+    jc.tierThreshold = tierThreshold;
+    jc.tieredOFF();
+    d.forgetLastWord();
+
+    // register blocks, the shuffles only rename values and the stack is written once at the end
+    interpreter(": regA OVER * + ; : regB ROT SWAP - NEGATE 10 * ;");
+    test_against_ds("2 3 4 regA", 15);
+    test_against_ds("2 3 4 regA DROP", 2);
+    test_against_ds("1 2 3 regB", 20);
+    test_against_ds("1 2 3 regB DROP", 2);
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // a block goes on across a call to a word whose effect is known, the 5 below the call stays a constant
+    interpreter(": regSq DUP * ; : regC 5 SWAP regSq + 2 * ;");
+    test_that("regSq is ( 1 -- 1 )", d.findWord("regSq")->stackIn == 1 && d.findWord("regSq")->stackOut == 1);
+    const CompileTokens inBlock = allocateRegisters(splitTokens("5 SWAP regSq + 2 * "));
+    test_that("the block takes in the call", inBlock.size() == 8 && inBlock[0].tag == TokenTag::REGBLOCK &&
+              inBlock[1].tag == TokenTag::OPERAND && inBlock[1].text == "6" && inBlock[4].text == "regSq");
+    const CompileTokens ends = allocateRegisters(splitTokens("regSq 1 + regSq "));
+    test_that("calls at the ends stay outside the block", ends.size() == 6 && ends[0].text == "regSq" &&
+              ends[1].tag == TokenTag::REGBLOCK && ends[2].text == "2" && ends[5].text == "regSq");
+    test_against_ds("3 regC", 28);
+    test_against_ds("1 2 regC DROP", 1);
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // TO a string value takes nothing from the data stack
+    interpreter(R"(s" abc" string regStr : regTo s" def" to regStr ;)");
+    test_that("TO a string value is ( 0 -- 0 )", d.findWord("regTo")->stackIn == 0 && d.findWord("regTo")->stackOut == 0);
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // floating point blocks keep their temporaries in xmm registers
+    interpreter(": fpA DUP f* SWAP DUP f* f+ fsqrt ; : fpB 1.5 f* 0.5 f- fabs ;");
+    ftest_against_ds("3.0 4.0 fpA", 5.0);
+    ftest_against_ds("2.0 fpB", 2.5);
+    ftest_against_ds("-3.0 fpB", 5.0);
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // vector words, seven elements run through the wide loop and the scalar tail
+    interpreter("7 farray va 7 farray vb 7 farray vc 1.5 va vfill 2.0 vb vfill");
+    test_against_ds("vc vlen", 7);
+    ftest_against_ds("va vb vdot", 21.0);
+    ftest_against_ds("va vb vc v+ vc vsum", 24.5);
+    ftest_against_ds("va vb vc v- vc vsum", -3.5);
+    ftest_against_ds("va vb vc v* vc vsum", 21.0);
+    ftest_against_ds("vb va vc vmin vc vsum", 10.5);
+    ftest_against_ds("va 4.0 vc vscale vc vsum", 42.0);
+    ftest_against_ds("va vb vc vfma vc vsum", 63.0);
+    ftest_against_ds("va vb vc vmax vc vsum", 14.0);
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // bulk memory, the words with a literal length are generated in line
+    interpreter("40 farray ba 40 farray bb");
+    test_against_ds("ba 320 7 FILL ba 312 + @", 506381209866536711);
+    interpreter(": bulkA ba 20 ERASE ba 16 + @ ;");
+    test_against_ds(" bulkA", 506381209748635648);
+    interpreter(": bulkB ba bb 100 MOVE bb 96 + @ ;");
+    test_against_ds(" bulkB", 117901063);
+    interpreter(": bulkC bb 3 65 FILL bb @ ;");
+    test_against_ds(" bulkC", 4276545);
+    test_against_ds("ba 8 bb 8 COMPARE", -1);
+    test_against_ds("ba 4 ba 8 COMPARE", -1);
+    test_against_ds("bb 3 bb 3 COMPARE", 0);
+    test_against_ds("bb bb 1+ 7 CMOVE bb @", 4702111234474983745);
+    test_against_ds("bb ba 8 MOVE ba @", 4702111234474983745);
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // narrow memory access, and addresses fused into the access
+    interpreter("4 farray mb mb 32 ERASE 258 mb W!");
+    test_against_ds("mb C@", 2);
+    test_against_ds("3 CELLS", 24);
+    interpreter(": memA mb 1 + C@ ; : memB mb 8 + L! ; : memC mb SWAP CELLS + @ ;");
+    interpreter(": memD mb 2 CELLS + +! ; : memE mb SWAP 2* + W@ ; : memF mb 3 + C! ;");
+    test_against_ds(" memA", 1);
+    test_against_ds("-1 memB mb 8 + @", 4294967295);
+    test_against_ds("1 memC", 4294967295);
+    test_against_ds("5 memD 5 memD mb 16 + @", 10);
+    test_against_ds("0 memE", 258);
+    test_against_ds("300 memF mb 3 + C@", 44);
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // the instructions the passes add are tagged, words of the program with their names stay words
+    interpreter("4 farray tagMb 7 tagMb 16 + ! : #DISP 100 + ; : REGBLOCK 2* ;");
+    interpreter(": tagA tagMb 16 + @ #DISP ; : tagB 3 REGBLOCK 1+ ;");
+    test_against_ds(" tagA", 107);
+    test_against_ds(" tagB", 7);
+    const CompileTokens fusedTokens = optimizeTokens("tagMb 16 + @ #DISP ");
+    test_that("a fused address is an instruction", fusedTokens.size() == 5 &&
+              fusedTokens[1].tag == TokenTag::DISP && fusedTokens[2].tag == TokenTag::OPERAND &&
+              fusedTokens[3].tag == TokenTag::OPERAND && fusedTokens[4].tag == TokenTag::WORD);
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // an image saved and loaded straight back, the words then run from the loaded copy of the code
+    interpreter("variable imageVar 7 imageVar ! : imageTest imageVar @ 1+ ;");
+    interpreter("save-image imageTest.img load-image imageTest.img");
+    test_against_ds(" imageTest", 8);
+    std::remove("imageTest.img");
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+    // only tagged immediates are relocated, a literal in the address range is a number
+    interpreter(": imageLiteral 4194304 ;");
+    interpreter("save-image imageTest.img load-image imageTest.img");
+    test_against_ds(" imageLiteral", 4194304);
+    std::remove("imageTest.img");
+    d.forgetLastWord();
+
+    // an address stored in a variable is relocated with the dictionary
+    interpreter("variable imageAddress 4 farray imageArray imageArray imageAddress ! 99 imageArray !");
+    interpreter("save-image imageTest.img load-image imageTest.img");
+    test_against_ds(" imageAddress @ @", 99);
+    test_against_ds(" imageAddress @ imageArray =", -1);
+    std::remove("imageTest.img");
+    d.forgetLastWord();
+    d.forgetLastWord();
+
+
+    // same words again with the top of stack cached in r10
+    jc.tosCacheON();
+    testCompileAndRun("testTosCache", "2 3 + 4 * 1- 1 SWAP OVER - NIP", " testTosCache", 18);
+    testCompileAndRun("testTosCache", "10 0 DO I + LOOP", " 0 testTosCache", 45);
+    testCompileAndRun("testTosCache", "DUP 2 < IF DROP 1 EXIT THEN  DUP 1- RECURSE * ", " 5 testTosCache", 120);
+
+    // both sides of a join have to leave the top of stack in the same place
+    testCompileAndRun("testTosCache", "1 SWAP IF 7 ELSE 9 THEN +", " 5 testTosCache", 8);
+    testCompileAndRun("testTosCache", "1 SWAP IF 7 ELSE 9 THEN +", " 0 testTosCache", 10);
+    testCompileAndRun("testTosCache", "DUP 10 > IF 10 - THEN 3 +", " 15 testTosCache", 8);
+    testCompileAndRun("testTosCache", "DUP 10 > IF 10 - THEN 3 +", " 4 testTosCache", 7);
+
+    // and so do the back edges of a loop
+    testCompileAndRun("testTosCache", "0 SWAP BEGIN DUP ROT + SWAP 1- DUP 0= UNTIL DROP", " 4 testTosCache", 10);
+    testCompileAndRun("testTosCache", "BEGIN DUP 100 < WHILE 2 * REPEAT", " 1 testTosCache", 128);
+    testCompileAndRun("testTosCache", "0 3 0 DO 4 0 DO I J * + LOOP LOOP", " testTosCache", 18);
+    testCompileAndRun("testTosCache", "0 20 0 DO I + 5 +LOOP", " testTosCache", 30);
+    testCompileAndRun("testTosCache", "0 100 0 DO I 5 = IF LEAVE THEN I + LOOP", " testTosCache", 10);
+
+    // case arms, tested one after the other and through a jump table
+    testCompileAndRun("testTosCache", "5 SWAP CASE 1 OF 10 ENDOF 2 OF 20 ENDOF DEFAULT 40 ENDCASE +",
+                      " 2 testTosCache", 25);
+    testCompileAndRun("testTosCache", "5 SWAP CASE 1 OF 10 ENDOF 2 OF 20 ENDOF DEFAULT 40 ENDCASE +",
+                      " 9 testTosCache", 45);
+    testCompileAndRun("testTosCache", "5 SWAP " + denseCase + " +", " 6 testTosCache", 65);
+
+    // calls to words compiled with and without the cache
+    jc.tosCacheOFF();
+    interpreter(": tosPlain 3 + ;");
+    jc.tosCacheON();
+    interpreter(": tosSquare DUP * ;");
+    testCompileAndRun("testTosCache", "tosSquare 1+ tosSquare", " 3 testTosCache", 100);
+    testCompileAndRun("testTosCache", "DUP tosSquare SWAP tosPlain +", " 4 testTosCache", 23);
+    testCompileAndRun("testTosCache", "0 4 0 DO I tosSquare + LOOP tosPlain", " testTosCache", 17);
+    d.forgetLastWord();
+    d.forgetLastWord();
+    jc.tosCacheOFF();
+
 
     ftest_against_ds("3.14159", 3.14159); // Single float value
     ftest_against_ds("2.0 2.0 f+", 4.0); // Addition resulting in a float
@@ -636,6 +1181,11 @@ void run_basic_tests()
     test_against_ds("2.0 1.0 f<>", -1); // 2.0 <> 1.0 is true
     test_against_ds("1.0 1.0 f<>", 0); // 1.0 <> 1.0 is false
 
+    // a pop one cell past the top of the data stack touches its guard
+    test_error(" 1 +");
+    test_error(" dup");
+    test_against_ds(" 1 2 +", 3);
+
 
     // Print summary after running tests
     std::cout << "\nTest results:" << std::endl;
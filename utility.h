@@ -9,6 +9,7 @@
 #include <bitset>
 #include <iomanip>
 #include <cstdint>
+#include <stdexcept>
 
 extern "C" {
 inline void printDecimal(int64_t number)
@@ -123,12 +124,53 @@ inline bool is_number(const std::string& s)
     return true;
 }
 
+inline int64_t parseNumber(const std::string& word) {
+    if (word.empty()) {
+        throw std::invalid_argument("Empty string is not a valid number");
+    }
+
+    size_t startIndex = 0;
+    bool isNegative = false;
+
+    // Check for an optional leading minus sign for decimal numbers
+    if (word[0] == '-') {
+        isNegative = true;
+        startIndex = 1;
+    }
+
+    // Handle hexadecimal and binary prefixes
+    if (startIndex + 2 < word.length() && word[startIndex] == '0') {
+        if (word[startIndex + 1] == 'x' || word[startIndex + 1] == 'X') {
+            return std::stoull(word.substr(startIndex), nullptr, 16); // Hexadecimal (unsigned)
+        } else if (word[startIndex + 1] == 'b' || word[startIndex + 1] == 'B') {
+            return std::stoull(word.substr(startIndex + 2), nullptr, 2); // Binary (unsigned)
+        }
+    }
+
+    // Default to decimal
+    int64_t number = std::stoll(word.substr(startIndex), nullptr, 10); // Decimal
+
+    // Apply the negative sign if necessary
+    if (isNegative) {
+        number = -number;
+    }
+
+    return number;
+}
+
+// split at white space, comments and literals have already been dealt with
 inline std::vector<std::string> split(const std::string& str)
 {
     std::vector<std::string> result;
-    std::istringstream iss(str);
-    for (std::string word; iss >> word;)
-        result.push_back(word);
+    size_t pos = 0;
+    while (true)
+    {
+        while (pos < str.size() && std::isspace(static_cast<unsigned char>(str[pos]))) ++pos;
+        if (pos == str.size()) break;
+        const size_t start = pos;
+        while (pos < str.size() && !std::isspace(static_cast<unsigned char>(str[pos]))) ++pos;
+        result.emplace_back(str, start, pos - start);
+    }
     return result;
 }
 
@@ -139,6 +181,14 @@ inline std::string to_lower(const std::string& s)
     return result;
 }
 
+// words that read the token after them at compile time: the name after TO, the character
+// after CHAR, the literal after S" and ." and the array after STRFIELDOFFSETS.
+// Passes that walk the split words skip that token rather than treat it as a word.
+inline bool readsNextToken(const std::string& lower)
+{
+    return lower == "to" || lower == "char" || lower == "s\"" || lower == ".\"" || lower == "strfieldoffsets";
+}
+
 inline void dump(const void* address) {
     const unsigned char* addr = static_cast<const unsigned char*>(address);
     size_t length = 32;